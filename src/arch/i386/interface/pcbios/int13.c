@@ -26,6 +26,7 @@ FILE_LICENCE ( GPL2_OR_LATER );
 #include <assert.h>
 #include <ipxe/list.h>
 #include <ipxe/blockdev.h>
+#include <ipxe/umalloc.h>
 #include <ipxe/io.h>
 #include <ipxe/open.h>
 #include <ipxe/uri.h>
@@ -63,6 +64,38 @@ FILE_LICENCE ( GPL2_OR_LATER );
  */
 #define INT13_COMMAND_TIMEOUT ( 15 * TICKS_PER_SEC )
 
+/** Maximum number of concurrently outstanding INT 13 commands */
+#define INT13_MAX_COMMANDS 4
+
+/** Minimum length of a fragment issued as a separate command */
+#define INT13_MIN_FRAGMENT ( 16 * 1024 )
+
+/** Number of consecutive sequential reads required to trigger read-ahead */
+#define INT13_CACHE_SEQUENTIAL 1
+
+/** An INT 13 read-ahead cache
+ *
+ * Boot loaders typically read the disk in small, sequential chunks.
+ * Since each read requires at least one round trip to the SAN
+ * target, this is extremely slow.  Once a sequential access pattern
+ * is detected, reads are therefore extended to fill a cache, from
+ * which subsequent reads can be satisfied without any round trip.
+ */
+struct int13_cache {
+	/** Cache buffer, or UNULL if read-ahead is disabled */
+	userptr_t data;
+	/** Size of cache buffer (in underlying blocks) */
+	unsigned int blocks;
+	/** Starting logical block address of cached data */
+	uint64_t lba;
+	/** Number of valid blocks in cache */
+	unsigned int count;
+	/** Logical block address following the most recent read */
+	uint64_t next_lba;
+	/** Number of consecutive sequential reads */
+	unsigned int sequential;
+};
+
 /** An INT 13 emulated drive */
 struct int13_drive {
 	/** Reference count */
@@ -133,6 +166,9 @@ struct int13_drive {
 	int block_rc;
 	/** Status of last operation */
 	int last_status;
+
+	/** Read-ahead cache */
+	struct int13_cache cache;
 };
 
 /** Vector for chaining to other INT 13 handlers */
@@ -335,12 +371,276 @@ static void int13_command_stop ( struct int13_command *command ) {
 	command->int13 = NULL;
 }
 
-/** The single active INT 13 command */
-static struct int13_command int13_command = {
-	.block = INTF_INIT ( int13_command_desc ),
-	.timer = TIMER_INIT ( int13_command_expired ),
+/** The INT 13 commands */
+static struct int13_command int13_commands[INT13_MAX_COMMANDS] = {
+	[ 0 ... ( INT13_MAX_COMMANDS - 1 ) ] = {
+		.block = INTF_INIT ( int13_command_desc ),
+		.timer = TIMER_INIT ( int13_command_expired ),
+	},
 };
 
+/**
+ * Find unused INT 13 command
+ *
+ * @ret command		INT 13 command, or NULL if all are in use
+ */
+static struct int13_command * int13_command_unused ( void ) {
+	struct int13_command *command;
+	unsigned int i;
+
+	for ( i = 0 ; i < INT13_MAX_COMMANDS ; i++ ) {
+		command = &int13_commands[i];
+		if ( ! command->int13 )
+			return command;
+	}
+	return NULL;
+}
+
+/**
+ * Reap completed INT 13 commands
+ *
+ * @v rc		Status code to update with first failure
+ * @ret busy		Number of commands still in progress
+ */
+static unsigned int int13_command_reap ( int *rc ) {
+	struct int13_command *command;
+	unsigned int busy = 0;
+	unsigned int i;
+
+	for ( i = 0 ; i < INT13_MAX_COMMANDS ; i++ ) {
+		command = &int13_commands[i];
+		if ( ! command->int13 )
+			continue;
+		if ( command->rc == -EINPROGRESS ) {
+			busy++;
+			continue;
+		}
+		if ( *rc == 0 )
+			*rc = command->rc;
+		int13_command_stop ( command );
+	}
+	return busy;
+}
+
+/**
+ * Read from or write to underlying block device
+ *
+ * @v int13		Emulated drive
+ * @v lba		Starting underlying logical block address
+ * @v count		Number of underlying logical blocks
+ * @v buffer		Data buffer
+ * @v block_rw		Block read/write method
+ * @ret rc		Return status code
+ *
+ * The request is split into fragments which are issued concurrently,
+ * up to the limit of INT13_MAX_COMMANDS and of the underlying block
+ * device's flow control window.  If any fragment fails, no further
+ * fragments are issued, and the first failure is returned once all
+ * outstanding fragments have completed.
+ */
+static int int13_block_rw ( struct int13_drive *int13, uint64_t lba,
+			    unsigned int count, userptr_t buffer,
+			    int ( * block_rw ) ( struct interface *control,
+						 struct interface *data,
+						 uint64_t lba,
+						 unsigned int count,
+						 userptr_t buffer,
+						 size_t len ) ) {
+	size_t blksize = int13->capacity.blksize;
+	struct int13_command *command;
+	unsigned int frag_max;
+	unsigned int frag_min;
+	unsigned int frag_count;
+	size_t frag_len;
+	unsigned int busy;
+	int rc = 0;
+
+	/* Determine maximum fragment length.  Split the request
+	 * evenly between the available commands, but avoid creating
+	 * fragments too small to be worth issuing separately.
+	 */
+	frag_max = ( ( count + INT13_MAX_COMMANDS - 1 ) / INT13_MAX_COMMANDS );
+	frag_min = ( INT13_MIN_FRAGMENT / blksize );
+	if ( frag_max < frag_min )
+		frag_max = frag_min;
+	if ( frag_max > int13->capacity.max_count )
+		frag_max = int13->capacity.max_count;
+	if ( ! frag_max )
+		frag_max = 1;
+
+	while ( 1 ) {
+
+		/* Reap any completed commands */
+		busy = int13_command_reap ( &rc );
+
+		/* Finish when all commands have completed, and either
+		 * all fragments have been issued or an error occurred
+		 */
+		if ( ( ( count == 0 ) || ( rc != 0 ) ) && ( busy == 0 ) )
+			break;
+
+		/* Issue next fragment, if the block device will
+		 * accept another command without waiting.  If no
+		 * commands are in progress, int13_command_start()
+		 * will wait for the block device to become ready.
+		 */
+		command = int13_command_unused();
+		if ( count && ( rc == 0 ) && command &&
+		     ( ( busy == 0 ) || xfer_window ( &int13->block ) ) ) {
+
+			/* Determine fragment length */
+			frag_count = count;
+			if ( frag_count > frag_max )
+				frag_count = frag_max;
+			frag_len = ( blksize * frag_count );
+
+			/* Issue command */
+			if ( ( ( rc = int13_command_start ( command,
+							    int13 ) ) != 0 ) ||
+			     ( ( rc = block_rw ( &int13->block,
+						 &command->block, lba,
+						 frag_count, buffer,
+						 frag_len ) ) != 0 ) ) {
+				int13_command_stop ( command );
+				continue;
+			}
+
+			/* Move to next fragment */
+			lba += frag_count;
+			count -= frag_count;
+			buffer = userptr_add ( buffer, frag_len );
+			continue;
+		}
+
+		/* Wait for a command to complete */
+		step();
+	}
+
+	return rc;
+}
+
+/**
+ * Initialise INT 13 read-ahead cache
+ *
+ * @v int13		Emulated drive
+ *
+ * Failure to allocate the cache is not an error; reads will simply
+ * not be cached.
+ */
+static void int13_cache_init ( struct int13_drive *int13 ) {
+	struct int13_cache *cache = &int13->cache;
+	size_t blksize = int13->capacity.blksize;
+
+	/* Do nothing if read-ahead is disabled or pointless */
+	if ( ! blksize )
+		return;
+	cache->blocks = ( SANBOOT_CACHE_SIZE / blksize );
+	if ( cache->blocks < 2 ) {
+		cache->blocks = 0;
+		return;
+	}
+
+	/* Allocate cache buffer */
+	cache->data = umalloc ( cache->blocks * blksize );
+	if ( ! cache->data ) {
+		DBGC ( int13, "INT13 drive %02x could not allocate %zd-byte "
+		       "read-ahead cache\n", int13->drive,
+		       ( cache->blocks * blksize ) );
+		cache->blocks = 0;
+		return;
+	}
+	DBGC ( int13, "INT13 drive %02x using %zd-byte read-ahead cache\n",
+	       int13->drive, ( cache->blocks * blksize ) );
+}
+
+/**
+ * Invalidate INT 13 read-ahead cache
+ *
+ * @v int13		Emulated drive
+ * @v lba		Starting underlying logical block address
+ * @v count		Number of underlying logical blocks
+ */
+static void int13_cache_invalidate ( struct int13_drive *int13,
+				     uint64_t lba, unsigned int count ) {
+	struct int13_cache *cache = &int13->cache;
+
+	if ( ( lba < ( cache->lba + cache->count ) ) &&
+	     ( ( lba + count ) > cache->lba ) )
+		cache->count = 0;
+}
+
+/**
+ * Read from INT 13 drive via read-ahead cache
+ *
+ * @v int13		Emulated drive
+ * @v lba		Starting underlying logical block address
+ * @v count		Number of underlying logical blocks
+ * @v buffer		Data buffer
+ * @ret rc		Return status code
+ */
+static int int13_cache_read ( struct int13_drive *int13, uint64_t lba,
+			      unsigned int count, userptr_t buffer ) {
+	struct int13_cache *cache = &int13->cache;
+	size_t blksize = int13->capacity.blksize;
+	unsigned int frag_count;
+	int rc;
+
+	/* Detect sequential access */
+	if ( lba == cache->next_lba ) {
+		cache->sequential++;
+	} else {
+		cache->sequential = 0;
+	}
+	cache->next_lba = ( lba + count );
+
+	while ( count ) {
+
+		/* Satisfy as much as possible from the cache */
+		if ( ( lba >= cache->lba ) &&
+		     ( lba < ( cache->lba + cache->count ) ) ) {
+			frag_count = ( cache->lba + cache->count - lba );
+			if ( frag_count > count )
+				frag_count = count;
+			memcpy_user ( buffer, 0, cache->data,
+				      ( ( lba - cache->lba ) * blksize ),
+				      ( frag_count * blksize ) );
+			lba += frag_count;
+			count -= frag_count;
+			buffer = userptr_add ( buffer, ( frag_count * blksize ));
+			continue;
+		}
+
+		/* Read directly unless the access pattern is
+		 * sequential and the request is small enough to
+		 * benefit from reading ahead.
+		 */
+		if ( ( cache->blocks == 0 ) ||
+		     ( cache->sequential < INT13_CACHE_SEQUENTIAL ) ||
+		     ( count >= cache->blocks ) ||
+		     ( lba >= int13->capacity.blocks ) ) {
+			return int13_block_rw ( int13, lba, count, buffer,
+						block_read );
+		}
+
+		/* Refill cache, reading ahead of the request */
+		frag_count = cache->blocks;
+		if ( frag_count > ( int13->capacity.blocks - lba ) )
+			frag_count = ( int13->capacity.blocks - lba );
+		cache->count = 0;
+		if ( ( rc = int13_block_rw ( int13, lba, frag_count,
+					     cache->data, block_read ) ) != 0 ) {
+			DBGC ( int13, "INT13 drive %02x could not read ahead: "
+			       "%s\n", int13->drive, strerror ( rc ) );
+			return int13_block_rw ( int13, lba, count, buffer,
+						block_read );
+		}
+		cache->lba = lba;
+		cache->count = frag_count;
+	}
+
+	return 0;
+}
+
 /**
  * Read from or write to INT 13 drive
  *
@@ -357,41 +657,18 @@ static int int13_rw ( struct int13_drive *int13, uint64_t lba,
 					   struct interface *data,
 					   uint64_t lba, unsigned int count,
 					   userptr_t buffer, size_t len ) ) {
-	struct int13_command *command = &int13_command;
-	unsigned int frag_count;
-	size_t frag_len;
-	int rc;
 
 	/* Translate to underlying blocksize */
 	lba <<= int13->blksize_shift;
 	count <<= int13->blksize_shift;
 
-	while ( count ) {
-
-		/* Determine fragment length */
-		frag_count = count;
-		if ( frag_count > int13->capacity.max_count )
-			frag_count = int13->capacity.max_count;
-		frag_len = ( int13->capacity.blksize * frag_count );
-
-		/* Issue command */
-		if ( ( ( rc = int13_command_start ( command, int13 ) ) != 0 ) ||
-		     ( ( rc = block_rw ( &int13->block, &command->block, lba,
-					 frag_count, buffer,
-					 frag_len ) ) != 0 ) ||
-		     ( ( rc = int13_command_wait ( command ) ) != 0 ) ) {
-			int13_command_stop ( command );
-			return rc;
-		}
-		int13_command_stop ( command );
+	/* Reads may be satisfied from the read-ahead cache */
+	if ( block_rw == block_read )
+		return int13_cache_read ( int13, lba, count, buffer );
 
-		/* Move to next fragment */
-		lba += frag_count;
-		count -= frag_count;
-		buffer = userptr_add ( buffer, frag_len );
-	}
-
-	return 0;
+	/* Writes must not leave stale data in the cache */
+	int13_cache_invalidate ( int13, lba, count );
+	return int13_block_rw ( int13, lba, count, buffer, block_rw );
 }
 
 /**
@@ -401,7 +678,7 @@ static int int13_rw ( struct int13_drive *int13, uint64_t lba,
  * @ret rc		Return status code
  */
 static int int13_read_capacity ( struct int13_drive *int13 ) {
-	struct int13_command *command = &int13_command;
+	struct int13_command *command = &int13_commands[0];
 	int rc;
 
 	/* Issue command */
@@ -1388,6 +1665,7 @@ static void int13_free ( struct refcnt *refcnt ) {
 	struct int13_drive *int13 =
 		container_of ( refcnt, struct int13_drive, refcnt );
 
+	ufree ( int13->cache.data );
 	uri_put ( int13->uri );
 	free ( int13 );
 }
@@ -1441,6 +1719,9 @@ static int int13_hook ( struct uri *uri, unsigned int drive ) {
 	if ( ( rc = int13_read_capacity ( int13 ) ) != 0 )
 		goto err_read_capacity;
 
+	/* Allocate read-ahead cache */
+	int13_cache_init ( int13 );
+
 	/* Allocate scratch area */
 	scratch = malloc ( int13_blksize ( int13 ) );
 	if ( ! scratch )
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** @file
+ *
+ * CRC32C (Castagnoli) checksum
+ *
+ * Where available, the SSE4.2 "crc32" instruction is used to process
+ * four bytes per instruction.  Despite being part of SSE4.2, this
+ * instruction operates only on general-purpose registers, and so
+ * does not require any SSE state to have been enabled.  CPUs without
+ * SSE4.2 fall back to the generic table-driven implementation.
+ */
+
+FILE_LICENCE ( GPL2_OR_LATER );
+
+#include <stdint.h>
+#include <ipxe/crc32c.h>
+
+/** CPUID flag for SSE4.2 support (in %ecx of CPUID level 1) */
+#define CPUID_SSE4_2 0x00100000UL
+
+/** EFLAGS bit indicating that the CPUID instruction is supported */
+#define EFLAGS_ID 0x00200000UL
+
+/** SSE4.2 support state (zero if not yet checked) */
+static int x86_crc32c_sse42;
+
+/**
+ * Check for CPUID instruction support
+ *
+ * @ret supported	CPUID instruction is supported
+ */
+static int x86_crc32c_has_cpuid ( void ) {
+	unsigned long f1;
+	unsigned long f2;
+
+	__asm__ ( "pushf\n\t"
+		  "pushf\n\t"
+		  "pop %0\n\t"
+		  "mov %0, %1\n\t"
+		  "xor %2, %0\n\t"
+		  "push %0\n\t"
+		  "popf\n\t"
+		  "pushf\n\t"
+		  "pop %0\n\t"
+		  "popf\n\t"
+		  : "=&r" ( f1 ), "=&r" ( f2 )
+		  : "ir" ( EFLAGS_ID ) );
+
+	return ( ( ( f1 ^ f2 ) & EFLAGS_ID ) != 0 );
+}
+
+/**
+ * Check for SSE4.2 "crc32" instruction support
+ *
+ * @ret supported	Instruction is supported
+ */
+static int x86_crc32c_supported ( void ) {
+	uint32_t eax;
+	uint32_t ebx;
+	uint32_t ecx;
+	uint32_t edx;
+
+	if ( ! x86_crc32c_sse42 ) {
+		x86_crc32c_sse42 = -1;
+		if ( x86_crc32c_has_cpuid() ) {
+			__asm__ ( "cpuid" : "=a" ( eax ), "=b" ( ebx ),
+				  "=c" ( ecx ), "=d" ( edx ) : "0" ( 0 ) );
+			if ( eax >= 1 ) {
+				__asm__ ( "cpuid" : "=a" ( eax ), "=b" ( ebx ),
+					  "=c" ( ecx ), "=d" ( edx )
+					: "0" ( 1 ) );
+				if ( ecx & CPUID_SSE4_2 )
+					x86_crc32c_sse42 = 1;
+			}
+		}
+		DBG ( "CRC32C %s SSE4.2\n",
+		      ( ( x86_crc32c_sse42 > 0 ) ? "using" : "not using" ) );
+	}
+	return ( x86_crc32c_sse42 > 0 );
+}
+
+/**
+ * Calculate 32-bit little-endian CRC32C checksum
+ *
+ * @v seed		Initial value
+ * @v data		Data to checksum
+ * @v len		Length of data
+ * @ret crc		Updated CRC
+ */
+uint32_t x86_crc32c_le ( uint32_t seed, const void *data, size_t len ) {
+	uint32_t crc = seed;
+	const uint8_t *src = data;
+	const uint32_t *src32;
+
+	/* Use generic implementation if instruction is not supported */
+	if ( ! x86_crc32c_supported() )
+		return generic_crc32c_le ( seed, data, len );
+
+	/* Process leading bytes until aligned */
+	while ( len && ( ( ( intptr_t ) src ) & ( sizeof ( *src32 ) - 1 ) ) ) {
+		__asm__ ( "crc32b %1, %0" : "+r" ( crc ) : "rm" ( *src++ ) );
+		len--;
+	}
+
+	/* Process four bytes at a time */
+	src32 = ( ( const uint32_t * ) src );
+	while ( len >= sizeof ( *src32 ) ) {
+		__asm__ ( "crc32l %1, %0" : "+r" ( crc ) : "rm" ( *src32++ ) );
+		len -= sizeof ( *src32 );
+	}
+	src = ( ( const uint8_t * ) src32 );
+
+	/* Process trailing bytes */
+	while ( len-- )
+		__asm__ ( "crc32b %1, %0" : "+r" ( crc ) : "rm" ( *src++ ) );
+
+	return crc;
+}
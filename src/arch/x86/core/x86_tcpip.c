@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** @file
+ *
+ * TCP/IP checksum
+ *
+ * The checksum is accumulated 32 bits at a time using add-with-carry,
+ * with the carry from each addition propagated into the next.  Since
+ * the ones'-complement sum is independent of byte order, summing
+ * little-endian dwords and folding the result produces the same
+ * checksum as summing big-endian 16-bit words.
+ *
+ * x86 permits unaligned memory accesses, so no special handling is
+ * required for buffers that are not dword-aligned.
+ */
+
+FILE_LICENCE ( GPL2_OR_LATER );
+
+#include <string.h>
+#include <ipxe/tcpip.h>
+
+/**
+ * Fold 32-bit partial sum and trailing bytes into 16-bit checksum
+ *
+ * @v sum		32-bit partial sum
+ * @v data		Trailing bytes
+ * @v len		Number of trailing bytes (0-3)
+ * @ret cksum		Checksum, in network byte order
+ */
+static uint16_t x86_tcpip_fold ( uint32_t sum, const uint8_t *data,
+				 size_t len ) {
+	uint32_t value;
+
+	/* Add trailing word and byte, if any */
+	if ( len & 2 ) {
+		value = ( data[0] | ( data[1] << 8 ) );
+		sum += value;
+		if ( sum < value )
+			sum++;
+		data += 2;
+	}
+	if ( len & 1 ) {
+		value = data[0];
+		sum += value;
+		if ( sum < value )
+			sum++;
+	}
+
+	/* Fold to 16 bits */
+	sum = ( ( sum & 0xffff ) + ( sum >> 16 ) );
+	sum = ( ( sum & 0xffff ) + ( sum >> 16 ) );
+
+	return ( ~sum );
+}
+
+/**
+ * Calculate continued TCP/IP checkum
+ *
+ * @v partial		Checksum of already-summed data, in network byte order
+ * @v data		Data buffer
+ * @v len		Length of data buffer
+ * @ret cksum		Updated checksum, in network byte order
+ *
+ * Calculates a TCP/IP-style 16-bit checksum over the data block.  The
+ * checksum is returned in network byte order.
+ *
+ * This function may be used to add new data to an existing checksum.
+ * The function assumes that both the old data and the new data start
+ * on even byte offsets.
+ */
+uint16_t x86_tcpip_continue_chksum ( uint16_t partial,
+				     const void *data, size_t len ) {
+	uint32_t sum = ( ( ~partial ) & 0xffff );
+	unsigned long count;
+
+	/* Sum sixteen bytes at a time.  Neither "lea" nor "dec"
+	 * affects the carry flag, so the carry propagates between
+	 * iterations.
+	 */
+	count = ( len / 16 );
+	if ( count ) {
+		__asm__ ( "clc\n\t"
+			  "\n1:\n\t"
+			  "adcl 0(%1), %0\n\t"
+			  "adcl 4(%1), %0\n\t"
+			  "adcl 8(%1), %0\n\t"
+			  "adcl 12(%1), %0\n\t"
+			  "lea 16(%1), %1\n\t"
+			  "dec %2\n\t"
+			  "jnz 1b\n\t"
+			  "adcl $0, %0\n\t"
+			  : "+r" ( sum ), "+r" ( data ), "+r" ( count )
+			  : : "memory" );
+	}
+
+	/* Sum remaining whole dwords */
+	count = ( ( len / 4 ) % 4 );
+	if ( count ) {
+		__asm__ ( "clc\n\t"
+			  "\n1:\n\t"
+			  "adcl 0(%1), %0\n\t"
+			  "lea 4(%1), %1\n\t"
+			  "dec %2\n\t"
+			  "jnz 1b\n\t"
+			  "adcl $0, %0\n\t"
+			  : "+r" ( sum ), "+r" ( data ), "+r" ( count )
+			  : : "memory" );
+	}
+
+	/* Add trailing bytes and fold */
+	return x86_tcpip_fold ( sum, data, ( len % 4 ) );
+}
+
+/**
+ * Copy data and calculate continued TCP/IP checksum
+ *
+ * @v partial		Checksum of already-summed data, in network byte order
+ * @v dest		Destination buffer
+ * @v src		Source buffer
+ * @v len		Length of data
+ * @ret cksum		Updated checksum, in network byte order
+ *
+ * This performs the equivalent of memcpy() followed by
+ * tcpip_continue_chksum() over the copied data, touching each byte
+ * only once.
+ */
+uint16_t x86_tcpip_copy_chksum ( uint16_t partial, void *dest,
+				 const void *src, size_t len ) {
+	uint32_t sum = ( ( ~partial ) & 0xffff );
+	unsigned long count;
+	uint32_t discard_value;
+
+	/* Copy and sum one dword at a time.  Neither "mov", "lea"
+	 * nor "dec" affects the carry flag.
+	 */
+	count = ( len / 4 );
+	if ( count ) {
+		__asm__ ( "clc\n\t"
+			  "\n1:\n\t"
+			  "movl 0(%2), %3\n\t"
+			  "movl %3, 0(%1)\n\t"
+			  "adcl %3, %0\n\t"
+			  "lea 4(%1), %1\n\t"
+			  "lea 4(%2), %2\n\t"
+			  "dec %4\n\t"
+			  "jnz 1b\n\t"
+			  "adcl $0, %0\n\t"
+			  : "+r" ( sum ), "+r" ( dest ), "+r" ( src ),
+			    "=&r" ( discard_value ), "+r" ( count )
+			  : : "memory" );
+	}
+
+	/* Copy trailing bytes, then add them and fold */
+	memcpy ( dest, src, ( len % 4 ) );
+	return x86_tcpip_fold ( sum, src, ( len % 4 ) );
+}
@@ -0,0 +1,29 @@
+#ifndef _BITS_CRC32C_H
+#define _BITS_CRC32C_H
+
+/** @file
+ *
+ * CRC32C (Castagnoli) checksum
+ *
+ */
+
+FILE_LICENCE ( GPL2_OR_LATER );
+
+extern uint32_t x86_crc32c_le ( uint32_t seed, const void *data,
+				size_t len );
+
+/**
+ * Calculate 32-bit little-endian CRC32C checksum
+ *
+ * @v seed		Initial value
+ * @v data		Data to checksum
+ * @v len		Length of data
+ * @ret crc		Updated CRC
+ */
+static inline __attribute__ (( always_inline )) uint32_t
+crc32c_le ( uint32_t seed, const void *data, size_t len ) {
+
+	return x86_crc32c_le ( seed, data, len );
+}
+
+#endif /* _BITS_CRC32C_H */
@@ -0,0 +1,47 @@
+#ifndef _BITS_TCPIP_H
+#define _BITS_TCPIP_H
+
+/** @file
+ *
+ * Transport-network layer interface
+ *
+ */
+
+FILE_LICENCE ( GPL2_OR_LATER );
+
+extern uint16_t x86_tcpip_continue_chksum ( uint16_t partial,
+					    const void *data, size_t len );
+extern uint16_t x86_tcpip_copy_chksum ( uint16_t partial, void *dest,
+					const void *src, size_t len );
+
+/**
+ * Calculate continued TCP/IP checkum
+ *
+ * @v partial		Checksum of already-summed data, in network byte order
+ * @v data		Data buffer
+ * @v len		Length of data buffer
+ * @ret cksum		Updated checksum, in network byte order
+ */
+static inline __attribute__ (( always_inline )) uint16_t
+tcpip_continue_chksum ( uint16_t partial, const void *data, size_t len ) {
+
+	return x86_tcpip_continue_chksum ( partial, data, len );
+}
+
+/**
+ * Copy data and calculate continued TCP/IP checksum
+ *
+ * @v partial		Checksum of already-summed data, in network byte order
+ * @v dest		Destination buffer
+ * @v src		Source buffer
+ * @v len		Length of data
+ * @ret cksum		Updated checksum, in network byte order
+ */
+static inline __attribute__ (( always_inline )) uint16_t
+tcpip_copy_chksum ( uint16_t partial, void *dest, const void *src,
+		    size_t len ) {
+
+	return x86_tcpip_copy_chksum ( partial, dest, src, len );
+}
+
+#endif /* _BITS_TCPIP_H */
@@ -211,6 +211,12 @@ REQUIRE_OBJECT ( ifmgmt_cmd );
 #ifdef ROUTE_CMD
 REQUIRE_OBJECT ( route_cmd );
 #endif
+#ifdef NEIGHBOUR_CMD
+REQUIRE_OBJECT ( neighbour_cmd );
+#endif
+#ifdef TCP_CMD
+REQUIRE_OBJECT ( tcp_cmd );
+#endif
 #ifdef IMAGE_CMD
 REQUIRE_OBJECT ( image_cmd );
 #endif
@@ -42,6 +42,18 @@ FILE_LICENCE ( GPL2_OR_LATER );
 #define	NET_PROTO_IPV4		/* IPv4 protocol */
 #undef	NET_PROTO_FCOE		/* Fibre Channel over Ethernet protocol */
 
+/*
+ * Neighbour (ARP/NDP) cache
+ *
+ */
+#define NEIGHBOUR_CACHE_SIZE	32	/* Maximum number of cached neighbours */
+
+/*
+ * Downloads
+ *
+ */
+#define DOWNLOAD_CONNECTIONS	1	/* Parallel range requests per download */
+
 /*
  * PXE support
  *
@@ -116,6 +128,8 @@ FILE_LICENCE ( GPL2_OR_LATER );
 #undef	IWMGMT_CMD		/* Wireless interface management commands */
 #undef FCMGMT_CMD		/* Fibre Channel management commands */
 #undef	ROUTE_CMD		/* Routing table management commands */
+#undef	NEIGHBOUR_CMD		/* Neighbour (ARP) cache commands */
+#undef	TCP_CMD			/* TCP statistics commands */
 #define IMAGE_CMD		/* Image management commands */
 #undef DHCP_CMD		/* DHCP management commands */
 #define SANBOOT_CMD		/* SAN boot commands */
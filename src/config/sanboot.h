@@ -11,6 +11,20 @@ FILE_LICENCE ( GPL2_OR_LATER );
 
 #include <config/defaults.h>
 
+/** Size of read-ahead cache for each SAN drive (zero to disable) */
+#define SANBOOT_CACHE_SIZE ( 256 * 1024 )
+
+/** Maximum number of concurrent SCSI commands per iSCSI session */
+#define ISCSI_MAX_TASKS 4
+
+/** Require CRC32C header and data digests on iSCSI connections
+ *
+ * If this is defined, login will fail unless the target agrees to
+ * use both header and data digests.  Otherwise, digests are offered
+ * but not insisted upon.
+ */
+#undef ISCSI_DIGESTS_REQUIRED
+
 #include <config/local/sanboot.h>
 
 #endif /* CONFIG_SANBOOT_H */
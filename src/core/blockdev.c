@@ -26,6 +26,12 @@ FILE_LICENCE ( GPL2_OR_LATER );
  *
  * Block devices
  *
+ * The flow control window of a block device's control interface
+ * indicates whether or not the device is prepared to accept a further
+ * command.  A block device may accept several commands concurrently,
+ * each with its own data interface; callers may continue to issue
+ * commands for as long as the window remains non-zero.
+ *
  */
 
 /**
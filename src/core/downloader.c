@@ -21,6 +21,8 @@ FILE_LICENCE ( GPL2_OR_LATER );
 #include <stdlib.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <ipxe/list.h>
+#include <ipxe/uri.h>
 #include <ipxe/iobuf.h>
 #include <ipxe/xfer.h>
 #include <ipxe/open.h>
@@ -29,6 +31,7 @@ FILE_LICENCE ( GPL2_OR_LATER );
 #include <ipxe/umalloc.h>
 #include <ipxe/image.h>
 #include <ipxe/downloader.h>
+#include <config/general.h>
 
 /** @file
  *
@@ -50,8 +53,57 @@ struct downloader {
 	struct image *image;
 	/** Current position within image buffer */
 	size_t pos;
+	/** Allocated length of image buffer
+	 *
+	 * This may exceed the image length, since the buffer is
+	 * extended in progressively larger steps when the final size
+	 * of the download is not known in advance.
+	 */
+	size_t alloc_len;
+
+	/** URI being downloaded (if known) */
+	struct uri *uri;
+	/** List of parallel range requests */
+	struct list_head ranges;
+	/** End of the portion fetched via the data transfer interface
+	 *
+	 * This is zero unless parallel range requests are in use.
+	 */
+	size_t end;
+	/** Data transfer interface has completed */
+	int xfer_done;
+	/** Parallel range requests have been attempted */
+	int ranges_tried;
+	/** Length of data received via parallel range requests */
+	size_t ranges_len;
+};
+
+/** A parallel range request within a download */
+struct downloader_range {
+	/** Reference count for this object */
+	struct refcnt refcnt;
+	/** List of range requests */
+	struct list_head list;
+	/** Downloader */
+	struct downloader *downloader;
+	/** Data transfer interface */
+	struct interface xfer;
+	/** Starting offset within image */
+	size_t start;
+	/** Length of range, or zero to continue to end of file */
+	size_t len;
+	/** Current position within range */
+	size_t pos;
 };
 
+/** Minimum step by which to extend a download buffer */
+#define DOWNLOADER_MIN_EXTEND ( 128 * 1024 )
+
+/** Minimum length of each range in a parallel download */
+#define DOWNLOADER_MIN_RANGE ( 1024 * 1024 )
+
+static void downloader_range_close ( struct downloader_range *range, int rc );
+
 /**
  * Free downloader object
  *
@@ -62,9 +114,65 @@ static void downloader_free ( struct refcnt *refcnt ) {
 		container_of ( refcnt, struct downloader, refcnt );
 
 	image_put ( downloader->image );
+	uri_put ( downloader->uri );
 	free ( downloader );
 }
 
+/**
+ * Record URI being downloaded
+ *
+ * @v downloader	Downloader
+ * @v type		Location type
+ * @v args		Remaining arguments depend upon location type
+ *
+ * The URI is required only in order to open parallel range
+ * requests, so failure is not an error.
+ */
+static void downloader_set_uri ( struct downloader *downloader, int type,
+				 va_list args ) {
+	struct uri *uri;
+
+	switch ( type ) {
+	case LOCATION_URI:
+		uri = uri_get ( va_arg ( args, struct uri * ) );
+		break;
+	case LOCATION_URI_STRING:
+		uri = parse_uri ( va_arg ( args, const char * ) );
+		break;
+	default:
+		uri = NULL;
+		break;
+	}
+	uri_put ( downloader->uri );
+	downloader->uri = uri;
+}
+
+/**
+ * Release any unused space at the end of the download buffer
+ *
+ * @v downloader	Downloader
+ */
+static void downloader_trim ( struct downloader *downloader ) {
+	struct image *image = downloader->image;
+	userptr_t new_buffer;
+
+	/* Do nothing unless we have allocated excess space */
+	if ( downloader->alloc_len <= image->len )
+		return;
+
+	DBGC ( downloader, "Downloader %p trimming from %zd to %zd bytes\n",
+	       downloader, downloader->alloc_len, image->len );
+
+	/* Shrink buffer.  Failure is harmless, since the excess space
+	 * will eventually be freed along with the image.
+	 */
+	new_buffer = urealloc ( image->data, image->len );
+	if ( ! new_buffer )
+		return;
+	image->data = new_buffer;
+	downloader->alloc_len = image->len;
+}
+
 /**
  * Terminate download
  *
@@ -72,39 +180,115 @@ static void downloader_free ( struct refcnt *refcnt ) {
  * @v rc		Reason for termination
  */
 static void downloader_finished ( struct downloader *downloader, int rc ) {
+	struct downloader_range *range;
+	struct downloader_range *tmp;
+
+	/* Abort any outstanding range requests */
+	list_for_each_entry_safe ( range, tmp, &downloader->ranges, list )
+		downloader_range_close ( range, rc );
+
+	/* Release unused buffer space */
+	downloader_trim ( downloader );
 
 	/* Shut down interfaces */
 	intf_shutdown ( &downloader->xfer, rc );
 	intf_shutdown ( &downloader->job, rc );
 }
 
+/**
+ * Reallocate download buffer
+ *
+ * @v downloader	Downloader
+ * @v alloc_len		New allocation size
+ * @ret new_buffer	New buffer, or UNULL on failure
+ *
+ * Some external memory allocators (e.g. the BIOS top-of-memory
+ * allocator) can expand only the most recently allocated block.  If
+ * another image has been allocated since this buffer was last
+ * extended (e.g. by a concurrent background download), then
+ * urealloc() will refuse to expand the buffer.  Fall back to
+ * allocating a new buffer and copying the existing contents.
+ */
+static userptr_t downloader_realloc ( struct downloader *downloader,
+				      size_t alloc_len ) {
+	struct image *image = downloader->image;
+	userptr_t new_buffer;
+
+	/* Try to reallocate in place */
+	new_buffer = urealloc ( image->data, alloc_len );
+	if ( new_buffer )
+		return new_buffer;
+
+	/* Allocate new buffer and copy existing contents */
+	new_buffer = umalloc ( alloc_len );
+	if ( ! new_buffer )
+		return UNULL;
+	DBGC ( downloader, "Downloader %p moved buffer to extend to %zd "
+	       "bytes\n", downloader, alloc_len );
+	memcpy_user ( new_buffer, 0, image->data, 0, image->len );
+	ufree ( image->data );
+
+	return new_buffer;
+}
+
 /**
  * Ensure that download buffer is large enough for the specified size
  *
  * @v downloader	Downloader
  * @v len		Required minimum size
+ * @v exact		Size is a hint for the final size of the download
  * @ret rc		Return status code
+ *
+ * Extending the buffer may require the existing contents to be
+ * copied, so extending it by only the length of each received packet
+ * would result in quadratic copying.  Unless the final size is known
+ * (e.g. from an HTTP Content-Length or a TFTP "tsize" option), the
+ * buffer is therefore extended geometrically, and any excess space
+ * is released when the download completes.  Repeated size hints
+ * (e.g. from HTTP chunked transfer encoding) are also treated
+ * geometrically.
  */
 static int downloader_ensure_size ( struct downloader *downloader,
-				    size_t len ) {
+				    size_t len, int exact ) {
+	struct image *image = downloader->image;
 	userptr_t new_buffer;
+	size_t alloc_len;
 
 	/* If buffer is already large enough, do nothing */
-	if ( len <= downloader->image->len )
+	if ( len <= image->len )
 		return 0;
 
-	DBGC ( downloader, "Downloader %p extending to %zd bytes\n",
-	       downloader, len );
-
-	/* Extend buffer */
-	new_buffer = urealloc ( downloader->image->data, len );
-	if ( ! new_buffer ) {
-		DBGC ( downloader, "Downloader %p could not extend buffer to "
-		       "%zd bytes\n", downloader, len );
-		return -ENOBUFS;
+	/* Extend buffer if necessary */
+	if ( len > downloader->alloc_len ) {
+
+		/* Calculate new allocation size */
+		alloc_len = len;
+		if ( alloc_len < ( 2 * downloader->alloc_len ) )
+			alloc_len = ( 2 * downloader->alloc_len );
+		if ( ( ! exact ) &&
+		     ( alloc_len < ( len + DOWNLOADER_MIN_EXTEND ) ) )
+			alloc_len = ( len + DOWNLOADER_MIN_EXTEND );
+		DBGC ( downloader, "Downloader %p extending to %zd bytes\n",
+		       downloader, alloc_len );
+
+		/* Extend buffer, falling back to the exact size
+		 * required if the larger allocation fails.
+		 */
+		new_buffer = downloader_realloc ( downloader, alloc_len );
+		if ( ( ! new_buffer ) && ( alloc_len > len ) ) {
+			alloc_len = len;
+			new_buffer = downloader_realloc ( downloader,
+							  alloc_len );
+		}
+		if ( ! new_buffer ) {
+			DBGC ( downloader, "Downloader %p could not extend "
+			       "buffer to %zd bytes\n", downloader, len );
+			return -ENOBUFS;
+		}
+		image->data = new_buffer;
+		downloader->alloc_len = alloc_len;
 	}
-	downloader->image->data = new_buffer;
-	downloader->image->len = len;
+	image->len = len;
 
 	return 0;
 }
@@ -128,10 +312,284 @@ static void downloader_progress ( struct downloader *downloader,
 	 * arrive out of order (e.g. with multicast protocols), but
 	 * it's a reasonable first approximation.
 	 */
-	progress->completed = downloader->pos;
+	progress->completed = ( downloader->pos + downloader->ranges_len );
 	progress->total = downloader->image->len;
 }
 
+/****************************************************************************
+ *
+ * Parallel range requests
+ *
+ */
+
+/**
+ * Check for completion of all parts of a download
+ *
+ * @v downloader	Downloader
+ */
+static void downloader_check_done ( struct downloader *downloader ) {
+
+	if ( downloader->xfer_done && list_empty ( &downloader->ranges ) )
+		downloader_finished ( downloader, 0 );
+}
+
+/**
+ * Free range request
+ *
+ * @v refcnt		Range request reference counter
+ */
+static void downloader_range_free ( struct refcnt *refcnt ) {
+	struct downloader_range *range =
+		container_of ( refcnt, struct downloader_range, refcnt );
+
+	ref_put ( &range->downloader->refcnt );
+	free ( range );
+}
+
+/**
+ * Close range request
+ *
+ * @v range		Range request
+ * @v rc		Reason for close
+ */
+static void downloader_range_close ( struct downloader_range *range,
+				     int rc ) {
+
+	/* Shut down interface */
+	intf_shutdown ( &range->xfer, rc );
+
+	/* Remove from list of range requests, dropping the list's
+	 * reference.
+	 */
+	list_del ( &range->list );
+	ref_put ( &range->refcnt );
+}
+
+/**
+ * Handle completion of range request
+ *
+ * @v range		Range request
+ * @v rc		Reason for completion
+ */
+static void downloader_range_finished ( struct downloader_range *range,
+					int rc ) {
+	struct downloader *downloader = range->downloader;
+	struct downloader_range *tmp;
+
+	/* Keep downloader alive while we tidy up */
+	ref_get ( &downloader->refcnt );
+
+	DBGC ( downloader, "Downloader %p range %zd+%zd finished: %s\n",
+	       downloader, range->start, range->len, strerror ( rc ) );
+	downloader_range_close ( range, rc );
+
+	if ( rc == 0 ) {
+		/* Check for overall completion */
+		downloader_check_done ( downloader );
+	} else if ( ! downloader->xfer_done ) {
+		/* Fall back to fetching the whole file via the
+		 * original data transfer interface.  Any data already
+		 * received via range requests is valid, and will be
+		 * overwritten with identical data.
+		 */
+		DBGC ( downloader, "Downloader %p falling back to a single "
+		       "connection\n", downloader );
+		list_for_each_entry_safe ( range, tmp, &downloader->ranges,
+					   list ) {
+			downloader_range_close ( range, 0 );
+		}
+		downloader->end = 0;
+		downloader->ranges_len = 0;
+	} else {
+		/* Too late to fall back */
+		downloader_finished ( downloader, rc );
+	}
+
+	ref_put ( &downloader->refcnt );
+}
+
+/**
+ * Handle data received via range request
+ *
+ * @v range		Range request
+ * @v iobuf		Datagram I/O buffer
+ * @v meta		Data transfer metadata
+ * @ret rc		Return status code
+ */
+static int downloader_range_deliver ( struct downloader_range *range,
+				      struct io_buffer *iobuf,
+				      struct xfer_metadata *meta ) {
+	struct downloader *downloader = range->downloader;
+	size_t len;
+	int rc;
+
+	/* Calculate new position within range */
+	if ( meta->flags & XFER_FL_ABS_OFFSET )
+		range->pos = 0;
+	range->pos += meta->offset;
+
+	/* Refuse data outside the requested range */
+	len = iob_len ( iobuf );
+	if ( range->len && ( ( range->pos + len ) > range->len ) ) {
+		DBGC ( downloader, "Downloader %p range %zd+%zd overrun\n",
+		       downloader, range->start, range->len );
+		rc = -ERANGE;
+		goto done;
+	}
+
+	/* Ensure that we have enough buffer space for this data */
+	if ( ( rc = downloader_ensure_size ( downloader,
+					     ( range->start + range->pos +
+					       len ), ( len == 0 ) ) ) != 0 )
+		goto done;
+
+	/* Copy data directly to its position within the image */
+	copy_to_user ( downloader->image->data, ( range->start + range->pos ),
+		       iobuf->data, len );
+	range->pos += len;
+	downloader->ranges_len += len;
+
+ done:
+	free_iob ( iobuf );
+	if ( rc != 0 )
+		downloader_range_finished ( range, rc );
+	return rc;
+}
+
+/**
+ * Handle redirection of range request
+ *
+ * @v range		Range request
+ * @v type		New location type
+ * @v args		Remaining arguments depend upon location type
+ * @ret rc		Return status code
+ */
+static int downloader_range_vredirect ( struct downloader_range *range,
+					int type, va_list args ) {
+	int rc;
+
+	/* Reopen at new location, requesting the same range */
+	if ( ( rc = xfer_vreopen ( &range->xfer, type, args ) ) != 0 )
+		return rc;
+	return xfer_range ( &range->xfer, range->start, range->len );
+}
+
+/** Range request data transfer interface operations */
+static struct interface_operation downloader_range_operations[] = {
+	INTF_OP ( xfer_deliver, struct downloader_range *,
+		  downloader_range_deliver ),
+	INTF_OP ( xfer_vredirect, struct downloader_range *,
+		  downloader_range_vredirect ),
+	INTF_OP ( intf_close, struct downloader_range *,
+		  downloader_range_finished ),
+};
+
+/** Range request data transfer interface descriptor */
+static struct interface_descriptor downloader_range_desc =
+	INTF_DESC ( struct downloader_range, xfer,
+		    downloader_range_operations );
+
+/**
+ * Open range request
+ *
+ * @v downloader	Downloader
+ * @v start		Starting offset within image
+ * @v len		Length of range, or zero to continue to end of file
+ * @ret rc		Return status code
+ */
+static int downloader_range_open ( struct downloader *downloader,
+				   size_t start, size_t len ) {
+	struct downloader_range *range;
+	int rc;
+
+	/* Allocate and initialise structure */
+	range = zalloc ( sizeof ( *range ) );
+	if ( ! range )
+		return -ENOMEM;
+	ref_init ( &range->refcnt, downloader_range_free );
+	intf_init ( &range->xfer, &downloader_range_desc, &range->refcnt );
+	range->downloader = downloader;
+	ref_get ( &downloader->refcnt );
+	range->start = start;
+	range->len = len;
+	list_add_tail ( &range->list, &downloader->ranges );
+
+	/* Open URI and restrict to the requested range */
+	if ( ( rc = xfer_open_uri ( &range->xfer, downloader->uri ) ) != 0 )
+		goto err;
+	if ( ( rc = xfer_range ( &range->xfer, start, len ) ) != 0 )
+		goto err;
+
+	DBGC ( downloader, "Downloader %p opened range %zd+%zd\n",
+	       downloader, start, len );
+	return 0;
+
+ err:
+	downloader_range_close ( range, rc );
+	return rc;
+}
+
+/**
+ * Start parallel range requests, if applicable
+ *
+ * @v downloader	Downloader
+ * @v len		Expected length of download
+ *
+ * The data transfer interface continues to fetch the first part of
+ * the file, and is closed once that part is complete.  The final
+ * range request is left open-ended, so that an inaccurate size hint
+ * cannot result in a truncated download.
+ */
+static void downloader_ranges_start ( struct downloader *downloader,
+				      size_t len ) {
+	unsigned int count = DOWNLOAD_CONNECTIONS;
+	xfer_range_TYPE ( void * ) *op;
+	struct downloader_range *range;
+	struct downloader_range *tmp;
+	struct interface *dest;
+	size_t chunk;
+	size_t start;
+	unsigned int i;
+	int rc;
+
+	/* Attempt only once per download, and only if worthwhile */
+	if ( downloader->ranges_tried || ( ! downloader->uri ) ||
+	     ( count < 2 ) || ( len < ( count * DOWNLOADER_MIN_RANGE ) ) )
+		return;
+	downloader->ranges_tried = 1;
+
+	/* Use range requests only if the protocol supports them */
+	op = intf_get_dest_op ( &downloader->xfer, xfer_range, &dest );
+	intf_put ( dest );
+	if ( ! op ) {
+		DBGC ( downloader, "Downloader %p protocol does not support "
+		       "ranges\n", downloader );
+		return;
+	}
+
+	/* Open range requests for all but the first part */
+	chunk = ( len / count );
+	for ( i = 1 ; i < count ; i++ ) {
+		start = ( i * chunk );
+		if ( ( rc = downloader_range_open ( downloader, start,
+						    ( ( i < ( count - 1 ) ) ?
+						      chunk : 0 ) ) ) != 0 ) {
+			DBGC ( downloader, "Downloader %p could not open "
+			       "range: %s\n", downloader, strerror ( rc ) );
+			list_for_each_entry_safe ( range, tmp,
+						   &downloader->ranges, list ){
+				downloader_range_close ( range, rc );
+			}
+			return;
+		}
+	}
+
+	/* Limit data transfer interface to the first part */
+	downloader->end = chunk;
+	DBGC ( downloader, "Downloader %p fetching %zd bytes using %d "
+	       "connections\n", downloader, len, count );
+}
+
 /****************************************************************************
  *
  * Data transfer interface
@@ -153,17 +611,41 @@ static int downloader_xfer_deliver ( struct downloader *downloader,
 	size_t max;
 	int rc;
 
+	/* Ignore any data after completion of our part of the file */
+	if ( downloader->xfer_done ) {
+		rc = 0;
+		goto done;
+	}
+
 	/* Calculate new buffer position */
 	if ( meta->flags & XFER_FL_ABS_OFFSET )
 		downloader->pos = 0;
 	downloader->pos += meta->offset;
 
-	/* Ensure that we have enough buffer space for this data */
+	/* Ensure that we have enough buffer space for this data.  A
+	 * zero-length delivery (i.e. a seek) beyond the end of the
+	 * existing data indicates the expected size of the download.
+	 */
 	len = iob_len ( iobuf );
 	max = ( downloader->pos + len );
-	if ( ( rc = downloader_ensure_size ( downloader, max ) ) != 0 )
+	if ( ( rc = downloader_ensure_size ( downloader, max,
+					     ( len == 0 ) ) ) != 0 )
 		goto done;
 
+	/* Use parallel range requests for the remainder of the file,
+	 * if the expected size is known before any data arrives.
+	 */
+	if ( ( len == 0 ) && ( downloader->pos == max ) &&
+	     ( downloader->image->len == max ) &&
+	     ( downloader->ranges_len == 0 ) )
+		downloader_ranges_start ( downloader, max );
+
+	/* Discard any data beyond the end of our part of the file */
+	if ( downloader->end && ( max > downloader->end ) ) {
+		len = ( ( downloader->pos < downloader->end ) ?
+			( downloader->end - downloader->pos ) : 0 );
+	}
+
 	/* Copy data to buffer */
 	copy_to_user ( downloader->image->data, downloader->pos,
 		       iobuf->data, len );
@@ -171,15 +653,73 @@ static int downloader_xfer_deliver ( struct downloader *downloader,
 	/* Update current buffer position */
 	downloader->pos += len;
 
+	/* Close data transfer interface once our part is complete */
+	if ( downloader->end && iob_len ( iobuf ) &&
+	     ( downloader->pos >= downloader->end ) ) {
+		DBGC ( downloader, "Downloader %p completed first %zd bytes\n",
+		       downloader, downloader->end );
+		downloader->xfer_done = 1;
+		intf_restart ( &downloader->xfer, 0 );
+		downloader_check_done ( downloader );
+	}
+
  done:
 	free_iob ( iobuf );
 	return rc;
 }
 
+/**
+ * Handle data transfer interface redirection
+ *
+ * @v downloader	Downloader
+ * @v type		New location type
+ * @v args		Remaining arguments depend upon location type
+ * @ret rc		Return status code
+ */
+static int downloader_xfer_vredirect ( struct downloader *downloader,
+				       int type, va_list args ) {
+	va_list tmp;
+	int rc;
+
+	/* Record new location for use by any parallel range requests */
+	va_copy ( tmp, args );
+	downloader_set_uri ( downloader, type, tmp );
+	va_end ( tmp );
+
+	/* Reopen at new location */
+	if ( ( rc = xfer_vreopen ( &downloader->xfer, type, args ) ) != 0 )
+		return rc;
+	xfer_window_changed ( &downloader->xfer );
+
+	return 0;
+}
+
+/**
+ * Handle data transfer interface close
+ *
+ * @v downloader	Downloader
+ * @v rc		Reason for close
+ */
+static void downloader_xfer_close ( struct downloader *downloader, int rc ) {
+
+	/* Abort download on error */
+	if ( rc != 0 ) {
+		downloader_finished ( downloader, rc );
+		return;
+	}
+
+	/* Otherwise, wait for any outstanding range requests */
+	intf_restart ( &downloader->xfer, 0 );
+	downloader->xfer_done = 1;
+	downloader_check_done ( downloader );
+}
+
 /** Downloader data transfer interface operations */
 static struct interface_operation downloader_xfer_operations[] = {
 	INTF_OP ( xfer_deliver, struct downloader *, downloader_xfer_deliver ),
-	INTF_OP ( intf_close, struct downloader *, downloader_finished ),
+	INTF_OP ( xfer_vredirect, struct downloader *,
+		  downloader_xfer_vredirect ),
+	INTF_OP ( intf_close, struct downloader *, downloader_xfer_close ),
 };
 
 /** Downloader data transfer interface descriptor */
@@ -224,6 +764,7 @@ int create_downloader ( struct interface *job, struct image *image,
 			int type, ... ) {
 	struct downloader *downloader;
 	va_list args;
+	va_list tmp;
 	int rc;
 
 	/* Allocate and initialise structure */
@@ -236,8 +777,14 @@ int create_downloader ( struct interface *job, struct image *image,
 	intf_init ( &downloader->xfer, &downloader_xfer_desc,
 		    &downloader->refcnt );
 	downloader->image = image_get ( image );
+	INIT_LIST_HEAD ( &downloader->ranges );
 	va_start ( args, type );
 
+	/* Record URI for use by any parallel range requests */
+	va_copy ( tmp, args );
+	downloader_set_uri ( downloader, type, tmp );
+	va_end ( tmp );
+
 	/* Instantiate child objects and attach to our interfaces */
 	if ( ( rc = xfer_vopen ( &downloader->xfer, type, args ) ) != 0 )
 		goto err;
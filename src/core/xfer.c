@@ -146,6 +146,40 @@ void xfer_window_changed ( struct interface *intf ) {
 	intf_put ( dest );
 }
 
+/**
+ * Restrict data transfer to a byte range
+ *
+ * @v intf		Data transfer interface
+ * @v offset		Starting offset
+ * @v len		Length of range, or zero to continue to end of data
+ * @ret rc		Return status code
+ *
+ * This may be used only before any data has been transferred.
+ */
+int xfer_range ( struct interface *intf, size_t offset, size_t len ) {
+	struct interface *dest;
+	xfer_range_TYPE ( void * ) *op =
+		intf_get_dest_op ( intf, xfer_range, &dest );
+	void *object = intf_object ( dest );
+	int rc;
+
+	if ( op ) {
+		rc = op ( object, offset, len );
+	} else {
+		/* Default is to not support byte ranges */
+		rc = -ENOTSUP;
+	}
+
+	if ( rc != 0 ) {
+		DBGC ( INTF_COL ( intf ), "INTF " INTF_INTF_FMT " range "
+		       "%zd+%zd failed: %s\n", INTF_INTF_DBG ( intf, dest ),
+		       offset, len, strerror ( rc ) );
+	}
+
+	intf_put ( dest );
+	return rc;
+}
+
 /**
  * Allocate I/O buffer
  *
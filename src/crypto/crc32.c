@@ -20,10 +20,106 @@
 
 FILE_LICENCE ( GPL2_OR_LATER );
 
+#include <stdint.h>
+#include <byteswap.h>
 #include <ipxe/crc32.h>
 
+/** @file
+ *
+ * Little-endian CRC32
+ *
+ * The CRC is calculated using the "slice-by-8" algorithm, which
+ * processes eight bytes per iteration using eight lookup tables.
+ * The tables are constructed on first use, to avoid adding 8kB of
+ * constant data to the binary.  The same engine is used for any
+ * polynomial, via crc32_slice8_le().
+ */
+
 #define CRCPOLY		0xedb88320
 
+/** CRC32 lookup tables */
+static struct crc32_tables crc32_tables;
+
+/**
+ * Construct CRC lookup tables
+ *
+ * @v tables		Slice-by-8 CRC lookup tables
+ * @v poly		Polynomial (bit-reversed)
+ */
+static void crc32_init ( struct crc32_tables *tables, u32 poly ) {
+	u32 crc;
+	unsigned int i;
+	unsigned int j;
+
+	for ( i = 0 ; i < 256 ; i++ ) {
+		crc = i;
+		for ( j = 0 ; j < 8 ; j++ )
+			crc = ( ( crc >> 1 ) ^ ( ( crc & 1 ) ? poly : 0 ) );
+		tables->table[0][i] = crc;
+	}
+	for ( i = 0 ; i < 256 ; i++ ) {
+		crc = tables->table[0][i];
+		for ( j = 1 ; j < CRC32_SLICES ; j++ ) {
+			crc = ( ( crc >> 8 ) ^ tables->table[0][ crc & 0xff ] );
+			tables->table[j][i] = crc;
+		}
+	}
+	tables->ready = 1;
+}
+
+/**
+ * Calculate 32-bit little-endian CRC checksum using slice-by-8 tables
+ *
+ * @v tables	Slice-by-8 CRC lookup tables
+ * @v poly	Polynomial (bit-reversed)
+ * @v seed	Initial value
+ * @v data	Data to checksum
+ * @v len	Length of data
+ * @ret crc	Updated CRC
+ */
+u32 crc32_slice8_le ( struct crc32_tables *tables, u32 poly, u32 seed,
+		      const void *data, size_t len ) {
+	u32 ( * table )[256] = tables->table;
+	u32 crc = seed;
+	const u8 *src = data;
+	const u32 *src32;
+	u32 one;
+	u32 two;
+
+	/* Construct lookup tables, if not already done */
+	if ( ! tables->ready )
+		crc32_init ( tables, poly );
+
+	/* Process leading bytes until aligned */
+	while ( len && ( ( ( intptr_t ) src ) & ( sizeof ( *src32 ) - 1 ) ) ) {
+		crc = ( ( crc >> 8 ) ^ table[0][ ( crc ^ *src++ ) & 0xff ] );
+		len--;
+	}
+
+	/* Process eight bytes at a time */
+	src32 = ( ( const u32 * ) src );
+	while ( len >= 8 ) {
+		one = ( le32_to_cpu ( *src32++ ) ^ crc );
+		two = le32_to_cpu ( *src32++ );
+		crc = ( table[7][ one & 0xff ] ^
+			table[6][ ( one >> 8 ) & 0xff ] ^
+			table[5][ ( one >> 16 ) & 0xff ] ^
+			table[4][ one >> 24 ] ^
+			table[3][ two & 0xff ] ^
+			table[2][ ( two >> 8 ) & 0xff ] ^
+			table[1][ ( two >> 16 ) & 0xff ] ^
+			table[0][ two >> 24 ] );
+		len -= 8;
+	}
+	src = ( ( const u8 * ) src32 );
+
+	/* Process trailing bytes */
+	while ( len-- )
+		crc = ( ( crc >> 8 ) ^ table[0][ ( crc ^ *src++ ) & 0xff ] );
+
+	return crc;
+}
+
 /**
  * Calculate 32-bit little-endian CRC checksum
  *
@@ -37,18 +133,5 @@ FILE_LICENCE ( GPL2_OR_LATER );
  */
 u32 crc32_le ( u32 seed, const void *data, size_t len )
 {
-	u32 crc = seed;
-	const u8 *src = data;
-	u32 mult;
-	int i;
-
-	while ( len-- ) {
-		crc ^= *src++;
-		for ( i = 0; i < 8; i++ ) {
-			mult = ( crc & 1 ) ? CRCPOLY : 0;
-			crc = ( crc >> 1 ) ^ mult;
-		}
-	}
-
-	return crc;
+	return crc32_slice8_le ( &crc32_tables, CRCPOLY, seed, data, len );
 }
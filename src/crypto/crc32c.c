@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+FILE_LICENCE ( GPL2_OR_LATER );
+
+#include <stdint.h>
+#include <ipxe/crc32.h>
+#include <ipxe/crc32c.h>
+
+/** @file
+ *
+ * CRC32C (Castagnoli) checksum
+ *
+ * This is the portable implementation, using the same "slice-by-8"
+ * engine as crc32_le().  Architectures may provide a faster
+ * implementation of crc32c_le() via <bits/crc32c.h>.
+ */
+
+/** CRC32C polynomial (reversed) */
+#define CRC32C_POLY 0x82f63b78
+
+/** CRC32C lookup tables */
+static struct crc32_tables crc32c_tables;
+
+/**
+ * Calculate 32-bit little-endian CRC32C checksum
+ *
+ * @v seed		Initial value
+ * @v data		Data to checksum
+ * @v len		Length of data
+ * @ret crc		Updated CRC
+ *
+ * Usually @a seed is initially all one bits, and the final CRC is
+ * inverted.  To continue a CRC checksum over multiple calls, pass the
+ * return value from one call as the @a seed parameter to the next.
+ */
+uint32_t generic_crc32c_le ( uint32_t seed, const void *data, size_t len ) {
+
+	return crc32_slice8_le ( &crc32c_tables, CRC32C_POLY, seed, data,
+				 len );
+}
@@ -47,6 +47,7 @@ int vp_find_vq(unsigned int ioaddr, int queue_index,
    }
 
    vq->queue_index = queue_index;
+   vq->num_free = num;
 
    /* initialize the queue */
 
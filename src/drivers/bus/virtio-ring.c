@@ -42,8 +42,11 @@ void vring_detach(struct vring_virtqueue *vq, unsigned int head)
    /* find end of given descriptor */
 
    i = head;
-   while (vr->desc[i].flags & VRING_DESC_F_NEXT)
+   vq->num_free++;
+   while (vr->desc[i].flags & VRING_DESC_F_NEXT) {
            i = vr->desc[i].next;
+           vq->num_free++;
+   }
 
    /* link it with free list and point to it */
 
@@ -80,6 +83,10 @@ void *vring_get_buf(struct vring_virtqueue *vq, unsigned int *len)
 
    vq->last_used_idx++;
 
+   /* request an interrupt for the next used buffer, if enabled */
+   if (vq->event_idx && !(vr->avail->flags & VRING_AVAIL_F_NO_INTERRUPT))
+           vring_used_event(vr) = vq->last_used_idx;
+
    return opaque;
 }
 
@@ -92,6 +99,8 @@ void vring_add_buf(struct vring_virtqueue *vq,
    int i, avail, head, prev;
 
    BUG_ON(out + in == 0);
+   BUG_ON(!vring_has_free(vq, out + in));
+   vq->num_free -= (out + in);
 
    prev = 0;
    head = vq->free_head;
@@ -122,15 +131,32 @@ void vring_add_buf(struct vring_virtqueue *vq,
    wmb();
 }
 
+/*
+ * vring_kick
+ *
+ * make the added buffers available, and notify the host if it has
+ * asked to be notified
+ *
+ */
+
 void vring_kick(unsigned int ioaddr, struct vring_virtqueue *vq, int num_added)
 {
    struct vring *vr = &vq->vring;
+   u16 old_idx;
+   u16 new_idx;
+   int notify;
 
    wmb();
-   vr->avail->idx += num_added;
+   old_idx = vr->avail->idx;
+   new_idx = old_idx + num_added;
+   vr->avail->idx = new_idx;
 
    mb();
-   if (!(vr->used->flags & VRING_USED_F_NO_NOTIFY))
+   if (vq->event_idx)
+           notify = vring_need_event(vring_avail_event(vr), new_idx, old_idx);
+   else
+           notify = !(vr->used->flags & VRING_USED_F_NO_NOTIFY);
+   if (notify)
            vp_notify(ioaddr, vq->queue_index);
 }
 
@@ -24,6 +24,7 @@ FILE_LICENCE ( GPL2_OR_LATER );
 
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <ipxe/list.h>
 #include <ipxe/iobuf.h>
 #include <ipxe/netdevice.h>
@@ -78,7 +79,16 @@ enum {
 
 enum {
 	/** Max number of pending rx packets */
-	NUM_RX_BUF = 8,
+	NUM_RX_BUF = 32,
+
+	/** Max number of pending rx packets with large receive offload
+	 *
+	 * A coalesced packet of up to 64kB plus header occupies 43
+	 * mergeable rx buffers.  The host will not deliver it until
+	 * that many buffers are available, so post enough to hold one
+	 * such packet with room to spare.
+	 */
+	NUM_RX_BUF_LRO = 64,
 
 	/** Max Ethernet frame length, including FCS and VLAN tag */
 	RX_BUF_SIZE = 1522,
@@ -97,45 +107,134 @@ struct virtnet_nic {
 	/** Pending rx packet count */
 	unsigned int rx_num_iobufs;
 
-	/** Virtio net packet header, we only need one */
-	struct virtio_net_hdr empty_header;
+	/** Max number of pending rx packets */
+	unsigned int rx_max_iobufs;
+
+	/** Buffers added to each virtqueue since it was last kicked */
+	unsigned int num_added[QUEUE_NB];
+
+	/** Mergeable rx buffers are in use */
+	int mergeable;
+
+	/** Virtio net packet header length */
+	size_t header_len;
+
+	/** Virtio net packet header, shared between tx packets that
+	 * do not require checksum offload
+	 */
+	struct virtio_net_hdr_mrg_rxbuf empty_header;
+
+	/** Virtio net packet headers for tx packets that require
+	 * checksum offload, indexed by head descriptor
+	 */
+	struct virtio_net_hdr_mrg_rxbuf tx_headers[MAX_QUEUE_NUM];
 };
 
+/** Features supported by this driver */
+#define VIRTNET_FEATURES ( ( 1 << VIRTIO_NET_F_CSUM ) |		\
+			   ( 1 << VIRTIO_NET_F_GUEST_CSUM ) |	\
+			   ( 1 << VIRTIO_NET_F_MAC ) |		\
+			   ( 1 << VIRTIO_NET_F_GUEST_TSO4 ) |	\
+			   ( 1 << VIRTIO_NET_F_MRG_RXBUF ) |	\
+			   ( 1 << VIRTIO_RING_F_EVENT_IDX ) )
+
+/** Features required for large receive offload
+ *
+ * Coalesced packets may be up to 64kB in length, and so can be
+ * received only into mergeable rx buffers.
+ */
+#define VIRTNET_LRO_FEATURES ( ( 1 << VIRTIO_NET_F_GUEST_CSUM ) |	\
+			       ( 1 << VIRTIO_NET_F_MRG_RXBUF ) )
+
 /** Add an iobuf to a virtqueue
  *
  * @v netdev		Network device
  * @v vq_idx		Virtqueue index (RX_INDEX or TX_INDEX)
  * @v iobuf		I/O buffer
+ * @ret rc		Return status code
  *
- * The virtqueue is kicked after the iobuf has been added.
+ * The iobuf is not made available to the host until the virtqueue is
+ * next kicked using virtnet_kick().  This allows many iobufs to be
+ * added at the cost of a single notification (and hence a single
+ * exit to the hypervisor).
  */
-static void virtnet_enqueue_iob ( struct net_device *netdev,
-				  int vq_idx, struct io_buffer *iobuf ) {
+static int virtnet_enqueue_iob ( struct net_device *netdev,
+				 int vq_idx, struct io_buffer *iobuf ) {
 	struct virtnet_nic *virtnet = netdev->priv;
 	struct vring_virtqueue *vq = &virtnet->virtqueue[vq_idx];
-	unsigned int out = ( vq_idx == TX_INDEX ) ? 2 : 0;
-	unsigned int in = ( vq_idx == TX_INDEX ) ? 0 : 2;
-	struct vring_list list[] = {
-		{
-			/* Share a single zeroed virtio net header between all
-			 * rx and tx packets.  This works because this driver
-			 * does not use any advanced features so none of the
-			 * header fields get used.
-			 */
-			.addr = ( char* ) &virtnet->empty_header,
-			.length = sizeof ( virtnet->empty_header ),
-		},
-		{
-			.addr = ( char* ) iobuf->data,
-			.length = iob_len ( iobuf ),
-		},
-	};
-
-	DBGC ( virtnet, "VIRTIO-NET %p enqueuing iobuf %p on vq %d\n",
-	       virtnet, iobuf, vq_idx );
-
-	vring_add_buf ( vq, list, out, in, iobuf, 0 );
-	vring_kick ( virtnet->ioaddr, vq, 1 );
+	unsigned int out = 0;
+	unsigned int in = 0;
+	struct vring_list list[2];
+	struct virtio_net_hdr_mrg_rxbuf *header;
+	unsigned int num_descs;
+
+	num_descs = ( ( ( vq_idx == RX_INDEX ) && virtnet->mergeable ) ? 1 : 2 );
+	if ( ! vring_has_free ( vq, num_descs ) ) {
+		DBGC ( virtnet, "VIRTIO-NET %p vq %d is full\n",
+		       virtnet, vq_idx );
+		return -ENOBUFS;
+	}
+
+	if ( vq_idx == TX_INDEX ) {
+		/* Share a single zeroed virtio net header between all
+		 * tx packets that do not require checksum offload.
+		 * Packets that do require checksum offload use a
+		 * header associated with the head descriptor, which
+		 * remains in use until transmission is complete.
+		 */
+		header = &virtnet->empty_header;
+		if ( iobuf->flags & IOB_FL_CSUM_PARTIAL ) {
+			header = &virtnet->tx_headers[vq->free_head];
+			memset ( header, 0, sizeof ( *header ) );
+			header->hdr.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+			header->hdr.csum_start =
+				( iobuf->csum_start - iobuf->data );
+			header->hdr.csum_offset = iobuf->csum_offset;
+		}
+		list[0].addr = ( char* ) header;
+		list[0].length = virtnet->header_len;
+		list[1].addr = ( char* ) iobuf->data;
+		list[1].length = iob_len ( iobuf );
+		out = 2;
+	} else if ( virtnet->mergeable ) {
+		/* The header is placed at the start of each mergeable
+		 * rx buffer, within the same descriptor.
+		 */
+		list[0].addr = ( char* ) iobuf->data;
+		list[0].length = iob_len ( iobuf );
+		in = 1;
+	} else {
+		/* Each rx packet has its own header, placed at the
+		 * start of the iobuf but in a separate descriptor.
+		 */
+		list[0].addr = ( char* ) iobuf->data;
+		list[0].length = virtnet->header_len;
+		list[1].addr = ( char* ) iobuf->data + virtnet->header_len;
+		list[1].length = iob_len ( iobuf ) - virtnet->header_len;
+		in = 2;
+	}
+
+	DBGC2 ( virtnet, "VIRTIO-NET %p enqueuing iobuf %p on vq %d\n",
+		virtnet, iobuf, vq_idx );
+
+	vring_add_buf ( vq, list, out, in, iobuf,
+			virtnet->num_added[vq_idx]++ );
+	return 0;
+}
+
+/** Make added iobufs available to the host
+ *
+ * @v netdev		Network device
+ * @v vq_idx		Virtqueue index (RX_INDEX or TX_INDEX)
+ */
+static void virtnet_kick ( struct net_device *netdev, int vq_idx ) {
+	struct virtnet_nic *virtnet = netdev->priv;
+
+	if ( virtnet->num_added[vq_idx] ) {
+		vring_kick ( virtnet->ioaddr, &virtnet->virtqueue[vq_idx],
+			     virtnet->num_added[vq_idx] );
+		virtnet->num_added[vq_idx] = 0;
+	}
 }
 
 /** Try to keep rx virtqueue filled with iobufs
@@ -144,22 +243,26 @@ static void virtnet_enqueue_iob ( struct net_device *netdev,
  */
 static void virtnet_refill_rx_virtqueue ( struct net_device *netdev ) {
 	struct virtnet_nic *virtnet = netdev->priv;
+	size_t len = ( virtnet->header_len + RX_BUF_SIZE );
 
-	while ( virtnet->rx_num_iobufs < NUM_RX_BUF ) {
+	while ( virtnet->rx_num_iobufs < virtnet->rx_max_iobufs ) {
 		struct io_buffer *iobuf;
 
 		/* Try to allocate a buffer, stop for now if out of memory */
-		iobuf = alloc_iob ( RX_BUF_SIZE );
+		iobuf = alloc_iob ( len );
 		if ( ! iobuf )
 			break;
 
-		/* Keep track of iobuf so close() can free it */
-		list_add ( &iobuf->list, &virtnet->rx_iobufs );
-
 		/* Mark packet length until we know the actual size */
-		iob_put ( iobuf, RX_BUF_SIZE );
+		iob_put ( iobuf, len );
+
+		if ( virtnet_enqueue_iob ( netdev, RX_INDEX, iobuf ) != 0 ) {
+			free_iob ( iobuf );
+			break;
+		}
 
-		virtnet_enqueue_iob ( netdev, RX_INDEX, iobuf );
+		/* Keep track of iobuf so close() can free it */
+		list_add ( &iobuf->list, &virtnet->rx_iobufs );
 		virtnet->rx_num_iobufs++;
 	}
 }
@@ -178,6 +281,20 @@ static int virtnet_open ( struct net_device *netdev ) {
 	/* Reset for sanity */
 	vp_reset ( ioaddr );
 
+	/* Negotiate features */
+	features = ( vp_get_features ( ioaddr ) & VIRTNET_FEATURES );
+	if ( ( features & VIRTNET_LRO_FEATURES ) != VIRTNET_LRO_FEATURES )
+		features &= ~( 1 << VIRTIO_NET_F_GUEST_TSO4 );
+	vp_set_features ( ioaddr, features );
+	virtnet->mergeable = ( features & ( 1 << VIRTIO_NET_F_MRG_RXBUF ) );
+	virtnet->header_len = ( virtnet->mergeable ?
+				sizeof ( struct virtio_net_hdr_mrg_rxbuf ) :
+				sizeof ( struct virtio_net_hdr ) );
+	virtnet->rx_max_iobufs =
+		( ( features & ( 1 << VIRTIO_NET_F_GUEST_TSO4 ) ) ?
+		  NUM_RX_BUF_LRO : NUM_RX_BUF );
+	DBGC ( virtnet, "VIRTIO-NET %p features %#08x\n", virtnet, features );
+
 	/* Allocate virtqueues */
 	virtnet->virtqueue = zalloc ( QUEUE_NB *
 				      sizeof ( *virtnet->virtqueue ) );
@@ -193,6 +310,9 @@ static int virtnet_open ( struct net_device *netdev ) {
 			virtnet->virtqueue = NULL;
 			return -ENOENT;
 		}
+		virtnet->virtqueue[i].event_idx =
+			( features & ( 1 << VIRTIO_RING_F_EVENT_IDX ) );
+		virtnet->num_added[i] = 0;
 	}
 
 	/* Initialize rx packets */
@@ -204,9 +324,10 @@ static int virtnet_open ( struct net_device *netdev ) {
 	netdev_irq ( netdev, 0 );
 
 	/* Driver is ready */
-	features = vp_get_features ( ioaddr );
-	vp_set_features ( ioaddr, features & ( 1 << VIRTIO_NET_F_MAC ) );
 	vp_set_status ( ioaddr, VIRTIO_CONFIG_S_DRIVER | VIRTIO_CONFIG_S_DRIVER_OK );
+
+	/* Make rx buffers available */
+	virtnet_kick ( netdev, RX_INDEX );
 	return 0;
 }
 
@@ -238,11 +359,13 @@ static void virtnet_close ( struct net_device *netdev ) {
  * @v netdev	Network device
  * @v iobuf	I/O buffer
  * @ret rc	Return status code
+ *
+ * The packet is made available to the host when the device is next
+ * polled, so that a burst of packets requires only a single kick.
  */
 static int virtnet_transmit ( struct net_device *netdev,
 			      struct io_buffer *iobuf ) {
-	virtnet_enqueue_iob ( netdev, TX_INDEX, iobuf );
-	return 0;
+	return virtnet_enqueue_iob ( netdev, TX_INDEX, iobuf );
 }
 
 /** Complete packet transmission
@@ -256,35 +379,133 @@ static void virtnet_process_tx_packets ( struct net_device *netdev ) {
 	while ( vring_more_used ( tx_vq ) ) {
 		struct io_buffer *iobuf = vring_get_buf ( tx_vq, NULL );
 
-		DBGC ( virtnet, "VIRTIO-NET %p tx complete iobuf %p\n",
-		       virtnet, iobuf );
+		DBGC2 ( virtnet, "VIRTIO-NET %p tx complete iobuf %p\n",
+			virtnet, iobuf );
 
 		netdev_tx_complete ( netdev, iobuf );
 	}
 }
 
+/** Get next completed rx buffer
+ *
+ * @v netdev		Network device
+ * @ret iobuf		I/O buffer, or NULL if none completed
+ */
+static struct io_buffer * virtnet_get_rx_iob ( struct net_device *netdev ) {
+	struct virtnet_nic *virtnet = netdev->priv;
+	struct vring_virtqueue *rx_vq = &virtnet->virtqueue[RX_INDEX];
+	struct io_buffer *iobuf;
+	unsigned int len;
+
+	if ( ! vring_more_used ( rx_vq ) )
+		return NULL;
+	iobuf = vring_get_buf ( rx_vq, &len );
+
+	/* Release ownership of iobuf */
+	list_del ( &iobuf->list );
+	virtnet->rx_num_iobufs--;
+
+	/* Update iobuf length */
+	iob_unput ( iobuf, iob_len ( iobuf ) );
+	iob_put ( iobuf, len );
+
+	return iobuf;
+}
+
+/** Merge a packet spread across several mergeable rx buffers
+ *
+ * @v netdev		Network device
+ * @v iobuf		First rx buffer, including header
+ * @v num_buffers	Number of rx buffers used by packet
+ * @ret iobuf		Merged packet, or NULL on error
+ */
+static struct io_buffer * virtnet_merge_rx ( struct net_device *netdev,
+					     struct io_buffer *iobuf,
+					     unsigned int num_buffers ) {
+	struct virtnet_nic *virtnet = netdev->priv;
+	struct io_buffer *merged;
+	struct io_buffer *next;
+	size_t len;
+	int rc;
+
+	/* Allocate buffer large enough for the whole packet.  This
+	 * may be up to 64kB if large receive offload is in use.
+	 */
+	len = ( num_buffers * ( virtnet->header_len + RX_BUF_SIZE ) );
+	merged = alloc_iob ( len );
+	if ( merged )
+		memcpy ( iob_put ( merged, iob_len ( iobuf ) ), iobuf->data,
+			 iob_len ( iobuf ) );
+	free_iob ( iobuf );
+
+	/* Append remaining buffers.  The host makes all buffers of a
+	 * packet available at once, so they must already be present.
+	 */
+	while ( --num_buffers ) {
+		next = virtnet_get_rx_iob ( netdev );
+		if ( ! next ) {
+			rc = -EIO;
+			goto err;
+		}
+		if ( merged ) {
+			memcpy ( iob_put ( merged, iob_len ( next ) ),
+				 next->data, iob_len ( next ) );
+		}
+		free_iob ( next );
+	}
+	if ( ! merged ) {
+		rc = -ENOMEM;
+		goto err;
+	}
+
+	return merged;
+
+ err:
+	netdev_rx_err ( netdev, merged, rc );
+	return NULL;
+}
+
 /** Complete packet reception
  *
  * @v netdev	Network device
  */
 static void virtnet_process_rx_packets ( struct net_device *netdev ) {
 	struct virtnet_nic *virtnet = netdev->priv;
-	struct vring_virtqueue *rx_vq = &virtnet->virtqueue[RX_INDEX];
-
-	while ( vring_more_used ( rx_vq ) ) {
-		unsigned int len;
-		struct io_buffer *iobuf = vring_get_buf ( rx_vq, &len );
+	struct virtio_net_hdr_mrg_rxbuf *header;
+	struct io_buffer *iobuf;
+	unsigned int num_buffers;
+	uint8_t flags;
+
+	while ( ( iobuf = virtnet_get_rx_iob ( netdev ) ) != NULL ) {
+
+		/* Merge packet spread across several buffers, if
+		 * applicable.
+		 */
+		header = iobuf->data;
+		num_buffers = ( virtnet->mergeable ? header->num_buffers : 1 );
+		if ( num_buffers > 1 ) {
+			iobuf = virtnet_merge_rx ( netdev, iobuf,
+						   num_buffers );
+			if ( ! iobuf )
+				continue;
+			header = iobuf->data;
+		}
 
-		/* Release ownership of iobuf */
-		list_del ( &iobuf->list );
-		virtnet->rx_num_iobufs--;
+		/* Strip header */
+		flags = header->hdr.flags;
+		iob_pull ( iobuf, virtnet->header_len );
 
-		/* Update iobuf length */
-		iob_unput ( iobuf, RX_BUF_SIZE );
-		iob_put ( iobuf, len - sizeof ( struct virtio_net_hdr ) );
+		DBGC2 ( virtnet, "VIRTIO-NET %p rx complete iobuf %p len %zd\n",
+			virtnet, iobuf, iob_len ( iobuf ) );
 
-		DBGC ( virtnet, "VIRTIO-NET %p rx complete iobuf %p len %zd\n",
-		       virtnet, iobuf, iob_len ( iobuf ) );
+		/* Record checksum validation.  A packet with a partial
+		 * checksum (including any packet coalesced by large
+		 * receive offload) originates from within the host and
+		 * so cannot have been corrupted in transit.
+		 */
+		if ( flags & ( VIRTIO_NET_HDR_F_DATA_VALID |
+			       VIRTIO_NET_HDR_F_NEEDS_CSUM ) )
+			iobuf->flags |= IOB_FL_CSUM_VALID;
 
 		/* Pass completed packet to the network stack */
 		netdev_rx ( netdev, iobuf );
@@ -309,6 +530,12 @@ static void virtnet_poll ( struct net_device *netdev ) {
 
 	virtnet_process_tx_packets ( netdev );
 	virtnet_process_rx_packets ( netdev );
+
+	/* Make any refilled rx buffers and newly transmitted packets
+	 * available to the host, using at most one kick per queue.
+	 */
+	virtnet_kick ( netdev, RX_INDEX );
+	virtnet_kick ( netdev, TX_INDEX );
 }
 
 /** Enable or disable interrupts
@@ -377,6 +604,12 @@ static int virtnet_probe ( struct pci_device *pci ) {
 		       eth_ntoa ( netdev->hw_addr ) );
 	}
 
+	/* Record offload features */
+	if ( features & ( 1 << VIRTIO_NET_F_GUEST_CSUM ) )
+		netdev->features |= NETDEV_RX_CSUM;
+	if ( features & ( 1 << VIRTIO_NET_F_CSUM ) )
+		netdev->features |= NETDEV_TX_CSUM;
+
 	/* Register network device */
 	if ( ( rc = register_netdev ( netdev ) ) != 0 )
 		goto err_register_netdev;
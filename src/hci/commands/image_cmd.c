@@ -38,18 +38,23 @@ FILE_LICENCE ( GPL2_OR_LATER );
 struct imgfetch_options {
 	/** Image name */
 	const char *name;
+	/** Download in background */
+	int background;
 };
 
 /** "imgfetch" option list */
 static struct option_descriptor imgfetch_opts[] = {
 	OPTION_DESC ( "name", 'n', required_argument,
 		      struct imgfetch_options, name, parse_string ),
+	OPTION_DESC ( "background", 'b', no_argument,
+		      struct imgfetch_options, background, parse_flag ),
 };
 
 /** "imgfetch" command descriptor */
 static struct command_descriptor imgfetch_cmd =
 	COMMAND_DESC ( struct imgfetch_options, imgfetch_opts, 1, MAX_ARGUMENTS,
-		       "[--name <name>] <uri> [<arguments>...]" );
+		       "[--name <name>] [--background] <uri> "
+		       "[<arguments>...]" );
 
 /**
  * The "imgfetch" and friends command body
@@ -86,8 +91,14 @@ static int imgfetch_core_exec ( int argc, char **argv,
 	}
 
 	/* Fetch the image */
-	if ( ( rc = imgdownload_string ( uri_string, opts.name, cmdline,
-					 action ) ) != 0 ) {
+	if ( opts.background ) {
+		rc = imgdownload_background_string ( uri_string, opts.name,
+						     cmdline, action );
+	} else {
+		rc = imgdownload_string ( uri_string, opts.name, cmdline,
+					  action );
+	}
+	if ( rc != 0 ) {
 		printf ( "Could not %s %s: %s\n",
 			 action_name, uri_string, strerror ( rc ) );
 		goto err_imgdownload;
@@ -270,6 +281,13 @@ static int imgexec_exec ( int argc, char **argv ) {
 	if ( ( rc = parse_options ( argc, argv, &imgexec_cmd, &opts ) ) != 0 )
 		return rc;
 
+	/* Complete any background downloads */
+	if ( ( rc = imgwait() ) != 0 ) {
+		printf ( "Could not complete background downloads: %s\n",
+			 strerror ( rc ) );
+		return rc;
+	}
+
 	/* Parse image name */
 	if ( optind < argc ) {
 		if ( ( rc = parse_image ( argv[optind], &image ) ) != 0 )
@@ -370,6 +388,41 @@ static int imgfree_exec ( int argc, char **argv ) {
 	return 0;
 }
 
+/** "imgwait" options */
+struct imgwait_options {};
+
+/** "imgwait" option list */
+static struct option_descriptor imgwait_opts[] = {};
+
+/** "imgwait" command descriptor */
+static struct command_descriptor imgwait_cmd =
+	COMMAND_DESC ( struct imgwait_options, imgwait_opts, 0, 0, "" );
+
+/**
+ * The "imgwait" command
+ *
+ * @v argc		Argument count
+ * @v argv		Argument list
+ * @ret rc		Return status code
+ */
+static int imgwait_exec ( int argc, char **argv ) {
+	struct imgwait_options opts;
+	int rc;
+
+	/* Parse options */
+	if ( ( rc = parse_options ( argc, argv, &imgwait_cmd, &opts ) ) != 0 )
+		return rc;
+
+	/* Wait for background downloads */
+	if ( ( rc = imgwait() ) != 0 ) {
+		printf ( "Could not complete background downloads: %s\n",
+			 strerror ( rc ) );
+		return rc;
+	}
+
+	return 0;
+}
+
 /** Image management commands */
 struct command image_commands[] __command = {
 	{
@@ -420,4 +473,8 @@ struct command image_commands[] __command = {
 		.name = "imgfree",
 		.exec = imgfree_exec,
 	},
+	{
+		.name = "imgwait",
+		.exec = imgwait_exec,
+	},
 };
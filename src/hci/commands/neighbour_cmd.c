@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+FILE_LICENCE ( GPL2_OR_LATER );
+
+#include <stdio.h>
+#include <getopt.h>
+#include <ipxe/command.h>
+#include <ipxe/parseopt.h>
+#include <usr/neighmgmt.h>
+
+/** @file
+ *
+ * Neighbour cache management commands
+ *
+ */
+
+/** "arp" options */
+struct arp_options {};
+
+/** "arp" option list */
+static struct option_descriptor arp_opts[] = {};
+
+/** "arp" command descriptor */
+static struct command_descriptor arp_cmd =
+	COMMAND_DESC ( struct arp_options, arp_opts, 0, 0, "" );
+
+/**
+ * The "arp" command
+ *
+ * @v argc		Argument count
+ * @v argv		Argument list
+ * @ret rc		Return status code
+ */
+static int arp_exec ( int argc, char **argv ) {
+	struct arp_options opts;
+	int rc;
+
+	/* Parse options */
+	if ( ( rc = parse_options ( argc, argv, &arp_cmd, &opts ) ) != 0 )
+		return rc;
+
+	neighbour_stat();
+
+	return 0;
+}
+
+/** Neighbour cache management commands */
+struct command neighbour_commands[] __command = {
+	{
+		.name = "arp",
+		.exec = arp_exec,
+	},
+};
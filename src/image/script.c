@@ -36,6 +36,7 @@ FILE_LICENCE ( GPL2_OR_LATER );
 #include <ipxe/image.h>
 #include <ipxe/shell.h>
 #include <usr/prompt.h>
+#include <usr/imgmgmt.h>
 #include <ipxe/script.h>
 
 /** Offset within current script
@@ -135,6 +136,7 @@ static int script_exec_line ( const char *line ) {
 static int script_exec ( struct image *image ) {
 	size_t saved_offset;
 	int rc;
+	int rc2;
 
 	/* Temporarily de-register image, so that a "boot" command
 	 * doesn't throw us into an execution loop.
@@ -148,6 +150,11 @@ static int script_exec ( struct image *image ) {
 	rc = process_script ( image, script_exec_line,
 			      terminate_on_exit_or_failure );
 
+	/* Complete any background downloads started by the script */
+	rc2 = imgwait();
+	if ( rc == 0 )
+		rc = rc2;
+
 	/* Restore saved state */
 	script_offset = saved_offset;
 
@@ -5,6 +5,23 @@ FILE_LICENCE ( GPL2_OR_LATER );
 
 #include <stdint.h>
 
-u32 crc32_le ( u32 seed, const void *data, size_t len );
+/** Number of slice-by-8 lookup tables */
+#define CRC32_SLICES 8
+
+/** Slice-by-8 CRC lookup tables for a given polynomial */
+struct crc32_tables {
+	/** Lookup tables have been constructed */
+	int ready;
+	/** Lookup tables
+	 *
+	 * table[0] is the standard byte-at-a-time table; table[n]
+	 * gives the effect of a byte followed by @c n zero bytes.
+	 */
+	u32 table[CRC32_SLICES][256];
+};
+
+extern u32 crc32_slice8_le ( struct crc32_tables *tables, u32 poly,
+			     u32 seed, const void *data, size_t len );
+extern u32 crc32_le ( u32 seed, const void *data, size_t len );
 
 #endif
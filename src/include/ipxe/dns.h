@@ -19,6 +19,7 @@ FILE_LICENCE ( GPL2_OR_LATER );
 
 #define DNS_TYPE_A		1
 #define DNS_TYPE_CNAME		5
+#define DNS_TYPE_SOA		6
 #define DNS_TYPE_ANY		255
 
 #define DNS_CLASS_IN		1
@@ -43,6 +44,20 @@ FILE_LICENCE ( GPL2_OR_LATER );
 #define	DNS_MAX_RETRIES		3
 #define	DNS_MAX_CNAME_RECURSION	0x30
 
+/** Maximum number of DNS servers queried in parallel */
+#define DNS_MAX_NAMESERVERS	4
+
+/** Maximum number of entries in the DNS cache */
+#define DNS_CACHE_SIZE		16
+
+/** Maximum time for which a DNS result will be cached (in seconds) */
+#define DNS_CACHE_MAX_TTL	3600
+
+/** Time for which a negative DNS result will be cached in the absence
+ * of an SOA record (in seconds)
+ */
+#define DNS_DEFAULT_NEGATIVE_TTL 60
+
 /*
  * DNS protocol structures
  *
@@ -83,10 +98,26 @@ struct dns_rr_info_cname {
 	char cname[0];
 } __attribute__ (( packed ));
 
+struct dns_rr_info_soa {
+	struct dns_rr_info_common common;
+	/** Primary server name and responsible mailbox name */
+	char names[0];
+} __attribute__ (( packed ));
+
+/** Fixed-length portion of an SOA record following the names */
+struct dns_soa_tail {
+	uint32_t	serial;
+	uint32_t	refresh;
+	uint32_t	retry;
+	uint32_t	expire;
+	uint32_t	minimum;
+} __attribute__ (( packed ));
+
 union dns_rr_info {
 	struct dns_rr_info_common common;
 	struct dns_rr_info_a a;
 	struct dns_rr_info_cname cname;
+	struct dns_rr_info_soa soa;
 };
 
 #endif /* _IPXE_DNS_H */
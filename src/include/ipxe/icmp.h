@@ -19,7 +19,24 @@ struct icmp_header {
 	uint16_t chksum;
 } __attribute__ (( packed ));
 
+/** An ICMP "destination unreachable" message */
+struct icmp_unreachable {
+	/** ICMP header */
+	struct icmp_header icmp;
+	/** Unused */
+	uint16_t unused;
+	/** Next-hop MTU (for "fragmentation needed" messages) */
+	uint16_t mtu;
+} __attribute__ (( packed ));
+
 #define ICMP_ECHO_RESPONSE 0
+#define ICMP_DESTINATION_UNREACHABLE 3
 #define ICMP_ECHO_REQUEST 8
 
+/** "Fragmentation needed and DF set" code */
+#define ICMP_FRAGMENTATION_NEEDED 4
+
+/** Minimum IPv4 MTU (RFC 791) */
+#define ICMP_MIN_MTU 68
+
 #endif /* _IPXE_ICMP_H */
@@ -57,8 +57,36 @@ struct io_buffer {
 	void *tail;
 	/** End of the buffer */
         void *end;
+
+	/** Flags
+	 *
+	 * This is the bitwise-OR of zero or more IOB_FL_XXX constants.
+	 */
+	unsigned int flags;
+	/** Start of region covered by transport-layer checksum
+	 *
+	 * Valid only if @c IOB_FL_CSUM_PARTIAL is set.
+	 */
+	void *csum_start;
+	/** Offset of transport-layer checksum field within region
+	 *
+	 * Valid only if @c IOB_FL_CSUM_PARTIAL is set.
+	 */
+	size_t csum_offset;
 };
 
+/** Transport-layer checksum has been validated by hardware */
+#define IOB_FL_CSUM_VALID 0x0001
+
+/** Transport-layer checksum is incomplete
+ *
+ * The checksum field contains only the pseudo-header checksum; the
+ * remainder of the checksum (covering the region starting at @c
+ * csum_start) must be calculated by the network layer or by the
+ * hardware.
+ */
+#define IOB_FL_CSUM_PARTIAL 0x0002
+
 /**
  * Reserve space at start of I/O buffer
  *
@@ -199,6 +227,7 @@ static inline void iob_populate ( struct io_buffer *iobuf,
 	iobuf->head = iobuf->data = data;
 	iobuf->tail = ( data + len );
 	iobuf->end = ( data + max_len );
+	iobuf->flags = 0;
 }
 
 /**
@@ -70,14 +70,46 @@ struct ipv4_miniroute {
 	struct in_addr gateway;
 };
 
-/* IPv4 fragment reassembly buffer */
+/** Maximum length of an IPv4 header */
+#define IP_MAX_HLEN		( IP_MASK_HLEN * 4 )
+
+/** Maximum length of an IPv4 datagram */
+#define IP_MAX_LEN		0xffffU
+
+/** A missing range within an IPv4 fragment reassembly buffer
+ *
+ * This is a hole descriptor as described in RFC 815.
+ */
+struct ipv4_hole {
+	/** List of holes */
+	struct list_head list;
+	/** Offset of first missing byte */
+	size_t first;
+	/** Offset of last missing byte */
+	size_t last;
+};
+
+/** IPv4 fragment reassembly buffer */
 struct ipv4_fragment {
-	/* List of fragment reassembly buffers */
+	/** List of fragment reassembly buffers */
 	struct list_head list;
-	/** Reassembled packet */
+	/** Reassembled payload */
 	struct io_buffer *iobuf;
-	/** Current offset */
-	size_t offset;
+	/** IPv4 header (from the first fragment, if received) */
+	union {
+		struct iphdr iphdr;
+		uint8_t bytes[IP_MAX_HLEN];
+	} hdr;
+	/** Length of IPv4 header */
+	size_t hdrlen;
+	/** Total payload length, or zero if not yet known */
+	size_t len;
+	/** List of holes */
+	struct list_head holes;
+	/** Checksum of payload received so far */
+	uint16_t csum;
+	/** Fragments have overlapped, so the payload checksum is unusable */
+	int overlapped;
 	/** Reassembly timer */
 	struct retry_timer timer;
 };
@@ -16,6 +16,7 @@ FILE_LICENCE ( GPL2_OR_LATER );
 #include <ipxe/refcnt.h>
 #include <ipxe/xfer.h>
 #include <ipxe/process.h>
+#include <config/sanboot.h>
 
 /** Default iSCSI port */
 #define ISCSI_PORT 3260
@@ -119,8 +120,10 @@ struct iscsi_bhs_common_response {
 	uint32_t statsn;
 	/** Expected command sequence number */
 	uint32_t expcmdsn;
+	/** Maximum command sequence number */
+	uint32_t maxcmdsn;
 	/** Fields specific to the PDU type */
-	uint8_t other_d[16];
+	uint8_t other_d[12];
 };
 
 /**
@@ -505,6 +508,83 @@ union iscsi_bhs {
 	unsigned char bytes[ sizeof ( struct iscsi_bhs_common ) ];
 };
 
+/** An iSCSI data-out sequence
+ *
+ * This represents a sequence of data-out PDUs still to be sent,
+ * either as unsolicited data following a SCSI command or in response
+ * to an R2T.
+ */
+struct iscsi_transfer {
+	/** Target transfer tag
+	 *
+	 * This is ISCSI_TAG_RESERVED for unsolicited data.
+	 */
+	uint32_t ttt;
+	/** Offset of remaining data within the data-out buffer */
+	uint32_t offset;
+	/** Length of remaining data */
+	uint32_t len;
+	/** Data sequence number of next data-out PDU */
+	uint32_t datasn;
+};
+
+/** Maximum data segment length that we are prepared to receive */
+#define ISCSI_MAX_RECV_DATA_SEG_LEN 65536
+
+/** Default maximum data segment length that we may send
+ *
+ * This is the RFC-defined default value of the target's
+ * MaxRecvDataSegmentLength, used until the target declares its own
+ * value.
+ */
+#define ISCSI_DEFAULT_MAX_SEND_LEN 8192
+
+/** Maximum length of unsolicited data that we will offer to send */
+#define ISCSI_FIRST_BURST_LEN 65536
+
+/** Maximum number of outstanding R2Ts that we will offer to handle */
+#define ISCSI_MAX_OUTSTANDING_R2T 4
+
+/** Maximum number of pending data-out sequences
+ *
+ * This allows for one unsolicited sequence plus the maximum number
+ * of outstanding R2Ts.
+ */
+#define ISCSI_MAX_TRANSFERS ( ISCSI_MAX_OUTSTANDING_R2T + 1 )
+
+/** An iSCSI task
+ *
+ * A task represents a single SCSI command, from the point at which
+ * it is issued until the point at which its response is received.
+ */
+struct iscsi_task {
+	/** iSCSI session */
+	struct iscsi_session *iscsi;
+	/** SCSI command interface */
+	struct interface data;
+	/** SCSI command */
+	struct scsi_cmd command;
+	/** Initiator task tag
+	 *
+	 * This is zero if the task is not in use.
+	 */
+	uint32_t itt;
+	/** Command sequence number */
+	uint32_t cmdsn;
+	/** SCSI command PDU has not yet been transmitted */
+	int command_pending;
+	/** Pending data-out sequences
+	 *
+	 * This is a ring buffer of sequences awaiting transmission,
+	 * which are processed in order of arrival.
+	 */
+	struct iscsi_transfer transfers[ISCSI_MAX_TRANSFERS];
+	/** Pending data-out sequence producer counter */
+	unsigned int transfer_prod;
+	/** Pending data-out sequence consumer counter */
+	unsigned int transfer_cons;
+};
+
 /** State of an iSCSI TX engine */
 enum iscsi_tx_state {
 	/** Nothing to send */
@@ -513,10 +593,14 @@ enum iscsi_tx_state {
 	ISCSI_TX_BHS,
 	/** Sending the additional header segment */
 	ISCSI_TX_AHS,
+	/** Sending the header digest */
+	ISCSI_TX_HEADER_DIGEST,
 	/** Sending the data segment */
 	ISCSI_TX_DATA,
 	/** Sending the data segment padding */
 	ISCSI_TX_DATA_PADDING,
+	/** Sending the data digest */
+	ISCSI_TX_DATA_DIGEST,
 };
 
 /** State of an iSCSI RX engine */
@@ -525,12 +609,22 @@ enum iscsi_rx_state {
 	ISCSI_RX_BHS = 0,
 	/** Receiving the additional header segment */
 	ISCSI_RX_AHS,
+	/** Receiving the header digest */
+	ISCSI_RX_HEADER_DIGEST,
 	/** Receiving the data segment */
 	ISCSI_RX_DATA,
 	/** Receiving the data segment padding */
 	ISCSI_RX_DATA_PADDING,
+	/** Receiving the data digest */
+	ISCSI_RX_DATA_DIGEST,
 };
 
+/** Header digest is in use */
+#define ISCSI_DIGEST_HEADER 0x01
+
+/** Data digest is in use */
+#define ISCSI_DIGEST_DATA 0x02
+
 /** An iSCSI session */
 struct iscsi_session {
 	/** Reference counter */
@@ -538,8 +632,6 @@ struct iscsi_session {
 
 	/** SCSI command-issuing interface */
 	struct interface control;
-	/** SCSI command interface */
-	struct interface data;
 	/** Transport-layer socket */
 	struct interface socket;
 
@@ -585,36 +677,48 @@ struct iscsi_session {
 	uint16_t isid_iana_qual;
 	/** Initiator task tag
 	 *
-	 * This is the tag of the current command.  It is incremented
-	 * whenever a new command is started.
+	 * This is the tag used for login requests.  It is assigned
+	 * whenever a new connection is opened.
 	 */
 	uint32_t itt;
-	/** Target transfer tag
+
+	/** Target uses InitialR2T
 	 *
-	 * This is the tag attached to a sequence of data-out PDUs in
-	 * response to an R2T.
+	 * If set, we may not send any unsolicited data-out PDUs.
 	 */
-	uint32_t ttt;
-	/** Transfer offset
+	int initial_r2t;
+	/** Target accepts immediate data */
+	int immediate_data;
+	/** Negotiated maximum length of unsolicited data */
+	size_t first_burst_len;
+	/** Maximum data segment length that we may send
 	 *
-	 * This is the offset for an in-progress sequence of data-out
-	 * PDUs in response to an R2T.
+	 * This is the target's declared MaxRecvDataSegmentLength.
 	 */
-	uint32_t transfer_offset;
-	/** Transfer length
+	size_t max_send_len;
+	/** Negotiated digests
 	 *
-	 * This is the length for an in-progress sequence of data-out
-	 * PDUs in response to an R2T.
+	 * This is the bitwise-OR of zero or more ISCSI_DIGEST_XXX
+	 * constants.  Digests take effect only once the full feature
+	 * phase has been reached.
 	 */
-	uint32_t transfer_len;
+	unsigned int digests;
 	/** Command sequence number
 	 *
-	 * This is the sequence number of the current command, used to
-	 * fill out the CmdSN field in iSCSI request PDUs.  It is
-	 * updated with the value of the ExpCmdSN field whenever we
-	 * receive an iSCSI response PDU containing such a field.
+	 * This is the sequence number to be assigned to the next
+	 * command, used to fill out the CmdSN field in iSCSI request
+	 * PDUs.  It is initialised with the value of the ExpCmdSN
+	 * field in the login response, and incremented whenever a
+	 * new command is issued.
 	 */
 	uint32_t cmdsn;
+	/** Maximum command sequence number
+	 *
+	 * This is the most recent value of the MaxCmdSN field present
+	 * in an iSCSI response PDU.  We may not issue a command with
+	 * a CmdSN greater than this value.
+	 */
+	uint32_t maxcmdsn;
 	/** Status sequence number
 	 *
 	 * This is the most recent status sequence number present in
@@ -628,6 +732,14 @@ struct iscsi_session {
 	union iscsi_bhs tx_bhs;
 	/** State of the TX engine */
 	enum iscsi_tx_state tx_state;
+	/** Task to which the current TX PDU belongs, if any */
+	struct iscsi_task *tx_task;
+	/** Next task to consider for data-out transmission */
+	unsigned int tx_next;
+	/** Digests in use for current TX PDU */
+	unsigned int tx_digests;
+	/** Data digest CRC for current TX PDU */
+	uint32_t tx_crc;
 	/** TX process */
 	struct process process;
 
@@ -641,9 +753,18 @@ struct iscsi_session {
 	size_t rx_len;
 	/** Buffer for received data (not always used) */
 	void *rx_buffer;
-
-	/** Current SCSI command, if any */
-	struct scsi_cmd *command;
+	/** Digests in use for current RX PDU */
+	unsigned int rx_digests;
+	/** Header or data digest CRC for current RX PDU */
+	uint32_t rx_crc;
+	/** Received header or data digest */
+	union {
+		uint32_t crc;
+		uint8_t bytes[4];
+	} __attribute__ (( packed )) rx_digest;
+
+	/** Tasks */
+	struct iscsi_task tasks[ISCSI_MAX_TASKS];
 
 	/** Target socket address (for boot firmware table) */
 	struct sockaddr target_sockaddr;
@@ -0,0 +1,139 @@
+#ifndef _IPXE_NEIGHBOUR_H
+#define _IPXE_NEIGHBOUR_H
+
+/** @file
+ *
+ * Neighbour cache
+ *
+ */
+
+FILE_LICENCE ( GPL2_OR_LATER );
+
+#include <stdint.h>
+#include <ipxe/list.h>
+#include <ipxe/netdevice.h>
+#include <ipxe/retry.h>
+#include <ipxe/timer.h>
+
+/** A neighbour discovery protocol */
+struct neighbour_discovery {
+	/** Name */
+	const char *name;
+	/** Transmit neighbour discovery request
+	 *
+	 * @v netdev		Network device
+	 * @v net_protocol	Network-layer protocol
+	 * @v net_dest		Destination network-layer address
+	 * @v net_source	Source network-layer address
+	 * @ret rc		Return status code
+	 */
+	int ( * tx_request ) ( struct net_device *netdev,
+			       struct net_protocol *net_protocol,
+			       const void *net_dest, const void *net_source );
+};
+
+/** Neighbour cache entry states */
+enum neighbour_state {
+	/** Address resolution in progress */
+	NEIGHBOUR_INCOMPLETE = 0,
+	/** Link-layer address recently confirmed */
+	NEIGHBOUR_REACHABLE,
+	/** Link-layer address in use, but awaiting reconfirmation */
+	NEIGHBOUR_STALE,
+};
+
+/** A neighbour cache entry */
+struct neighbour {
+	/** List of neighbour cache entries, most recently used first */
+	struct list_head list;
+	/** Next entry in hash chain */
+	struct neighbour *hash_next;
+	/** Network device */
+	struct net_device *netdev;
+	/** Network-layer protocol */
+	struct net_protocol *net_protocol;
+	/** Neighbour discovery protocol */
+	struct neighbour_discovery *discovery;
+	/** Network-layer address */
+	uint8_t net_addr[MAX_NET_ADDR_LEN];
+	/** Network-layer source address for discovery requests */
+	uint8_t net_source[MAX_NET_ADDR_LEN];
+	/** Link-layer address */
+	uint8_t ll_addr[MAX_LL_ADDR_LEN];
+	/** State */
+	enum neighbour_state state;
+	/** Time at which link-layer address was last confirmed */
+	unsigned long confirmed;
+	/** Number of discovery requests transmitted */
+	unsigned int requests;
+	/** Queue of packets awaiting address resolution */
+	struct list_head tx_queue;
+	/** Number of packets in transmit queue */
+	unsigned int tx_count;
+	/** Discovery request retransmission timer */
+	struct retry_timer timer;
+};
+
+/** Neighbour cache statistics */
+struct neighbour_statistics {
+	/** Number of lookups satisfied from the cache */
+	unsigned int hits;
+	/** Number of lookups requiring address resolution */
+	unsigned int misses;
+	/** Number of entries evicted to make room for new entries */
+	unsigned int evictions;
+	/** Number of address resolutions that timed out */
+	unsigned int failures;
+	/** Number of queued packets discarded */
+	unsigned int drops;
+};
+
+/** Maximum number of packets queued for each unresolved address */
+#define NEIGHBOUR_MAX_QUEUE 8
+
+/** Interval between discovery requests for an unresolved address */
+#define NEIGHBOUR_REQUEST_TIMEOUT TICKS_PER_SEC
+
+/** Number of discovery requests to send before giving up */
+#define NEIGHBOUR_MAX_REQUESTS 3
+
+/** Time for which a confirmed link-layer address is trusted
+ *
+ * After this time, the next use of the entry will trigger a fresh
+ * discovery request while continuing to use the cached address.  If
+ * NEIGHBOUR_MAX_REQUESTS requests go unanswered, the stale entry is
+ * destroyed.
+ */
+#define NEIGHBOUR_REACHABLE_TIMEOUT ( 60 * TICKS_PER_SEC )
+
+extern struct list_head neighbours;
+extern struct neighbour_statistics neighbour_stats;
+
+extern int neighbour_tx ( struct io_buffer *iobuf, struct net_device *netdev,
+			  struct net_protocol *net_protocol,
+			  const void *net_dest, const void *net_source,
+			  struct neighbour_discovery *discovery );
+extern int neighbour_update ( struct net_device *netdev,
+			      struct net_protocol *net_protocol,
+			      const void *net_dest, const void *ll_dest );
+extern int neighbour_define ( struct net_device *netdev,
+			      struct net_protocol *net_protocol,
+			      const void *net_dest, const void *ll_dest );
+
+/**
+ * Get neighbour cache entry state name (for debugging)
+ *
+ * @v neighbour		Neighbour cache entry
+ * @ret name		State name
+ */
+static inline __attribute__ (( always_inline )) const char *
+neighbour_state_name ( struct neighbour *neighbour ) {
+	switch ( neighbour->state ) {
+	case NEIGHBOUR_INCOMPLETE:	return "incomplete";
+	case NEIGHBOUR_REACHABLE:	return "reachable";
+	case NEIGHBOUR_STALE:		return "stale";
+	default:			return "unknown";
+	}
+}
+
+#endif /* _IPXE_NEIGHBOUR_H */
@@ -324,6 +324,18 @@ struct net_device {
 	 * This is the bitwise-OR of zero or more NETDEV_XXX constants.
 	 */
 	unsigned int state;
+	/** Hardware offload features
+	 *
+	 * This is the bitwise-OR of zero or more NETDEV_XXX_CSUM
+	 * constants, and is set by the driver before the device is
+	 * registered.
+	 *
+	 * There is no segmentation offload feature: TCP never
+	 * constructs a segment larger than the MSS, and the send
+	 * window is limited to TCP_MAX_SEND_WINDOW_SIZE, so there is
+	 * little for a device to gain from splitting segments.
+	 */
+	unsigned int features;
 	/** Link status code
 	 *
 	 * Zero indicates that the link is up; any other value
@@ -360,6 +372,20 @@ struct net_device {
 /** Network device receive queue processing is frozen */
 #define NETDEV_RX_FROZEN 0x0004
 
+/** Network device may validate received transport-layer checksums
+ *
+ * Received packets for which the checksum has been validated will be
+ * marked with @c IOB_FL_CSUM_VALID.
+ */
+#define NETDEV_RX_CSUM 0x0001
+
+/** Network device can calculate transmitted transport-layer checksums
+ *
+ * Transmitted packets for which the checksum must be calculated will
+ * be marked with @c IOB_FL_CSUM_PARTIAL.
+ */
+#define NETDEV_TX_CSUM 0x0002
+
 /** Link-layer protocol table */
 #define LL_PROTOCOLS __table ( struct ll_protocol, "ll_protocols" )
 
@@ -37,6 +37,18 @@ struct retry_timer {
 	unsigned long max_timeout;
 	/** Start time (in ticks) */
 	unsigned long start;
+	/** Smoothed round-trip time (in ticks, scaled by 8)
+	 *
+	 * Equivalent to SRTT in RFC 6298 terminology.  A value of
+	 * zero (along with a zero @c rttvar) means that no round-trip
+	 * time sample has yet been taken.
+	 */
+	unsigned long srtt;
+	/** Round-trip time variation (in ticks, scaled by 4)
+	 *
+	 * Equivalent to RTTVAR in RFC 6298 terminology.
+	 */
+	unsigned long rttvar;
 	/** Retry count */
 	unsigned int count;
 	/** Timer expired callback
@@ -85,6 +97,8 @@ extern void start_timer ( struct retry_timer *timer );
 extern void start_timer_fixed ( struct retry_timer *timer,
 				unsigned long timeout );
 extern void stop_timer ( struct retry_timer *timer );
+extern void stop_timer_nosample ( struct retry_timer *timer );
+extern void timer_rtt_sample ( struct retry_timer *timer, unsigned long rtt );
 
 /**
  * Start timer with no delay
@@ -54,6 +54,74 @@ struct tcp_mss_option {
 /** Code for the TCP MSS option */
 #define TCP_OPTION_MSS 2
 
+/** TCP window scale option */
+struct tcp_window_scale_option {
+	uint8_t kind;
+	uint8_t length;
+	uint8_t scale;
+} __attribute__ (( packed ));
+
+/** Padded TCP window scale option (used for sending) */
+struct tcp_window_scale_padded_option {
+	uint8_t nop[1];
+	struct tcp_window_scale_option wsopt;
+} __attribute__ (( packed ));
+
+/** Code for the TCP window scale option */
+#define TCP_OPTION_WS 3
+
+/** Maximum TCP window scale
+ *
+ * RFC 1323 limits the shift count to 14, giving a maximum window
+ * size of 1GB.
+ */
+#define TCP_MAX_WINDOW_SCALE 14
+
+/** TCP SACK-permitted option */
+struct tcp_sack_permitted_option {
+	uint8_t kind;
+	uint8_t length;
+} __attribute__ (( packed ));
+
+/** Padded TCP SACK-permitted option (used for sending) */
+struct tcp_sack_permitted_padded_option {
+	uint8_t nop[2];
+	struct tcp_sack_permitted_option spopt;
+} __attribute__ (( packed ));
+
+/** Code for the TCP SACK-permitted option */
+#define TCP_OPTION_SACK_PERMITTED 4
+
+/** TCP SACK option */
+struct tcp_sack_option {
+	uint8_t kind;
+	uint8_t length;
+} __attribute__ (( packed ));
+
+/** Padded TCP SACK option (used for sending) */
+struct tcp_sack_padded_option {
+	uint8_t nop[2];
+	struct tcp_sack_option sackopt;
+} __attribute__ (( packed ));
+
+/** A TCP SACK block */
+struct tcp_sack_block {
+	/** Left edge of block */
+	uint32_t left;
+	/** Right edge of block */
+	uint32_t right;
+} __attribute__ (( packed ));
+
+/** Code for the TCP SACK option */
+#define TCP_OPTION_SACK 5
+
+/** Maximum number of SACK blocks that we will send
+ *
+ * This is the maximum number of blocks that will fit within the
+ * available TCP option space alongside a timestamp option.
+ */
+#define TCP_SACK_MAX 3
+
 /** TCP timestamp option */
 struct tcp_timestamp_option {
 	uint8_t kind;
@@ -75,6 +143,10 @@ struct tcp_timestamp_padded_option {
 struct tcp_options {
 	/** MSS option, if present */
 	const struct tcp_mss_option *mssopt;
+	/** Window scale option, if present */
+	const struct tcp_window_scale_option *wsopt;
+	/** SACK-permitted option, if present */
+	const struct tcp_sack_permitted_option *spopt;
 	/** Timestampe option, if present */
 	const struct tcp_timestamp_option *tsopt;
 };
@@ -260,48 +332,94 @@ struct tcp_options {
 /**
  * Maxmimum advertised TCP window size
  *
- * We estimate the TCP window size as the amount of free memory we
- * have.  This is not strictly accurate (since it ignores any space
- * already allocated as RX buffers), but it will do for now.
- *
- * Since we don't store out-of-order received packets, the
- * retransmission penalty is that the whole window contents must be
- * resent.  This suggests keeping the window size small, but bear in
- * mind that the maximum bandwidth on any link is limited to
+ * The maximum bandwidth on any link is limited by
  *
  *    max_bandwidth = ( tcp_window / round_trip_time )
  *
- * With a 48kB window, which probably accurately reflects our amount
- * of free memory, and a WAN RTT of say 200ms, this gives a maximum
- * bandwidth of 240kB/s.  This is sufficiently close to realistic that
- * we will need to be careful that our advertised window doesn't end
- * up limiting WAN download speeds.
+ * Some rough expectations for achievable bandwidths over various
+ * links are:
+ *
+ *    a) Gigabit LAN: expected bandwidth 125MB/s, typical RTT 0.5ms,
+ *       minimum required window 64kB
+ *
+ *    b) 10 Gigabit LAN: expected bandwidth 1.25GB/s, typical RTT
+ *       1ms, minimum required window 1.25MB
+ *
+ *    c) WAN: expected bandwidth 2MB/s, typical RTT 100ms, minimum
+ *       required window 200kB.
  *
- * Finally, since the window goes into a 16-bit field and we cannot
- * actually use 65536, we use a window size of (65536-4) to ensure
- * that payloads remain dword-aligned.
+ * Anything above 64kB requires the use of window scaling (RFC 1323).
+ * The window that we actually advertise is further limited by the
+ * amount of free memory available to hold received packets (see
+ * tcp_xmit()), since any data received out of order must be held in
+ * the receive queue until the gap is filled.  It is advisable to keep
+ * the window no larger than necessary, since in the event of a lost
+ * packet the window size represents the maximum amount that may need
+ * to be retransmitted.
+ *
+ * We therefore choose a maximum window size of 256kB.
  */
-//#define TCP_MAX_WINDOW_SIZE	( 65536 - 4 )
-#define TCP_MAX_WINDOW_SIZE	8192
+#define TCP_MAX_WINDOW_SIZE	( 256 * 1024 )
 
 /**
- * Path MTU
+ * Advertised TCP window scale
  *
- * We really ought to implement Path MTU discovery.  Until we do,
- * anything with a path MTU greater than this may fail.
+ * Set to the smallest value that will allow us to advertise our
+ * maximum window size.
+ */
+#define TCP_RX_WINDOW_SCALE 3
+
+/**
+ * Maximum TCP send window size
+ *
+ * This limits the total amount of data that we will allow to be
+ * outstanding (i.e. sent but not yet acknowledged, or accepted from
+ * the application but not yet sent) at any one time, regardless of
+ * the window advertised by the peer.  All outstanding data must be
+ * held in the transmit queue until it has been acknowledged, so this
+ * places an upper bound on the memory used by each connection's
+ * transmit queue.
  */
-#define TCP_PATH_MTU 1460
+#define TCP_MAX_SEND_WINDOW_SIZE ( 64 * 1024 )
 
 /**
- * Advertised TCP MSS
+ * Default TCP MSS
  *
- * We currently hardcode this to a reasonable value and hope that the
- * sender uses path MTU discovery.  The alternative is breaking the
- * abstraction layer so that we can find out the MTU from the IP layer
- * (which would have to find out from the net device layer).
+ * Used as the sender maximum segment size if the peer does not
+ * include an MSS option in its SYN, as per RFC 1122 section 4.2.2.6.
+ * Also used as the advertised MSS if the maximum transmission unit
+ * for the route to the peer is too small to carry a larger segment.
+ */
+#define TCP_DEFAULT_MSS 536
+
+/**
+ * Advertised TCP MSS when the maximum transmission unit is unknown
+ *
+ * Used if the network layer cannot determine the maximum
+ * transmission unit for the route to the peer.  This is a reasonable
+ * value for Ethernet; we hope that the sender uses path MTU
+ * discovery.
  */
 #define TCP_MSS 1460
 
+/**
+ * Minimum TCP MSS
+ *
+ * An MSS option smaller than this is raised to this value.  This
+ * must leave room for data after the largest set of TCP options
+ * that we may send, and ensures that the congestion window is never
+ * zero.
+ */
+#define TCP_MIN_MSS 64
+
+/**
+ * TCP duplicate ACK threshold
+ *
+ * The number of duplicate ACKs that will trigger a fast
+ * retransmission, as per RFC 5681 section 3.2.
+ */
+#define TCP_DUPACK_THRESHOLD 3
+
 /** TCP maximum segment lifetime
  *
  * Currently set to 2 minutes, as per RFC 793.
@@ -316,7 +434,11 @@ struct tcp_options {
 	( MAX_LL_NET_HEADER_LEN +				\
 	  sizeof ( struct tcp_header ) +			\
 	  sizeof ( struct tcp_mss_option ) +			\
-	  sizeof ( struct tcp_timestamp_padded_option ) )
+	  sizeof ( struct tcp_window_scale_padded_option ) +	\
+	  sizeof ( struct tcp_sack_permitted_padded_option ) +	\
+	  sizeof ( struct tcp_timestamp_padded_option ) +	\
+	  sizeof ( struct tcp_sack_padded_option ) +		\
+	  ( TCP_SACK_MAX * sizeof ( struct tcp_sack_block ) ) )
 
 /**
  * Compare TCP sequence numbers
@@ -347,6 +469,23 @@ static inline int tcp_in_window ( uint32_t seq, uint32_t start,
 	return ( ( seq - start ) < len );
 }
 
+/** TCP statistics
+ *
+ * Each connection maintains its own statistics; the same events are
+ * also accumulated over all connections in @c tcp_stats.
+ */
+struct tcp_statistics {
+	/** Number of segments retransmitted */
+	unsigned int retransmits;
+	/** Number of fast retransmissions */
+	unsigned int fast_retransmits;
+	/** Number of retransmission timeouts */
+	unsigned int timeouts;
+	/** Number of duplicate ACKs received */
+	unsigned int dupacks;
+};
+
 extern struct tcpip_protocol tcp_protocol __tcpip_protocol;
+extern struct tcp_statistics tcp_stats;
 
 #endif /* _IPXE_TCP_H */
@@ -54,6 +54,7 @@ struct tcpip_protocol {
          * Process received packet
          *
          * @v iobuf		I/O buffer
+	 * @v netdev		Network device
 	 * @v st_src		Partially-filled source address
 	 * @v st_dest		Partially-filled destination address
 	 * @v pshdr_csum	Pseudo-header checksum
@@ -61,8 +62,23 @@ struct tcpip_protocol {
          *
          * This method takes ownership of the I/O buffer.
          */
-        int ( * rx ) ( struct io_buffer *iobuf, struct sockaddr_tcpip *st_src,
+        int ( * rx ) ( struct io_buffer *iobuf, struct net_device *netdev,
+		       struct sockaddr_tcpip *st_src,
 		       struct sockaddr_tcpip *st_dest, uint16_t pshdr_csum );
+	/**
+	 * Handle reduction in path MTU
+	 *
+	 * @v st_src		Source address of original packet
+	 * @v st_dest		Destination address of original packet
+	 * @v mtu		New maximum transport-layer packet length
+	 *
+	 * This method may be NULL if the protocol does not support
+	 * path MTU discovery.  Packets for protocols that do support
+	 * path MTU discovery will be transmitted with the network
+	 * layer's "don't fragment" indication set.
+	 */
+	void ( * pmtu ) ( struct sockaddr_tcpip *st_src,
+			  struct sockaddr_tcpip *st_dest, size_t mtu );
         /** 
 	 * Transport-layer protocol number
 	 *
@@ -98,6 +114,17 @@ struct tcpip_net_protocol {
 		       struct sockaddr_tcpip *st_dest,
 		       struct net_device *netdev,
 		       uint16_t *trans_csum );
+	/**
+	 * Determine maximum transmission unit
+	 *
+	 * @v st_dest		Destination address
+	 * @ret mtu		Maximum transport-layer packet length, or zero
+	 *
+	 * This method may be NULL if the maximum transmission unit
+	 * is unknown.  A return value of zero indicates that there
+	 * is no route to the destination.
+	 */
+	size_t ( * mtu ) ( struct sockaddr_tcpip *st_dest );
 };
 
 /** TCP/IP transport-layer protocol table */
@@ -113,16 +140,25 @@ struct tcpip_net_protocol {
 /** Declare a TCP/IP network-layer protocol */
 #define __tcpip_net_protocol __table_entry ( TCPIP_NET_PROTOCOLS, 01 )
 
-extern int tcpip_rx ( struct io_buffer *iobuf, uint8_t tcpip_proto,
-		      struct sockaddr_tcpip *st_src,
+extern int tcpip_rx ( struct io_buffer *iobuf, struct net_device *netdev,
+		      uint8_t tcpip_proto, struct sockaddr_tcpip *st_src,
 		      struct sockaddr_tcpip *st_dest, uint16_t pshdr_csum );
 extern int tcpip_tx ( struct io_buffer *iobuf, struct tcpip_protocol *tcpip,
 		      struct sockaddr_tcpip *st_src,
 		      struct sockaddr_tcpip *st_dest,
 		      struct net_device *netdev,
 		      uint16_t *trans_csum );
-extern uint16_t tcpip_continue_chksum ( uint16_t partial,
-					const void *data, size_t len );
+extern uint16_t tcpip_tx_chksum ( struct io_buffer *iobuf,
+				  struct net_device *netdev, uint16_t csum );
+extern size_t tcpip_mtu ( struct sockaddr_tcpip *st_dest );
+extern void tcpip_pmtu ( uint8_t tcpip_proto, struct sockaddr_tcpip *st_src,
+			 struct sockaddr_tcpip *st_dest, size_t mtu );
+extern uint16_t generic_tcpip_continue_chksum ( uint16_t partial,
+						const void *data, size_t len );
+extern uint16_t generic_tcpip_copy_chksum ( uint16_t partial, void *dest,
+					    const void *src, size_t len );
 extern uint16_t tcpip_chksum ( const void *data, size_t len );
 
+#include <bits/tcpip.h>
+
 #endif /* _IPXE_TCPIP_H */
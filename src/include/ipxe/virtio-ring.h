@@ -23,6 +23,13 @@
 
 #define VRING_USED_F_NO_NOTIFY     1
 
+/* The Guest publishes the used index for which it expects an interrupt
+ * at the end of the avail ring.  Host should ignore the avail->flags field.
+ * The Host publishes the avail index for which it expects a kick
+ * at the end of the used ring.  Guest should ignore the used->flags field.
+ */
+#define VIRTIO_RING_F_EVENT_IDX    29
+
 struct vring_desc
 {
    u64 addr;
@@ -60,9 +67,16 @@ struct vring {
 
 #define vring_size(num) \
    (((((sizeof(struct vring_desc) * num) + \
-      (sizeof(struct vring_avail) + sizeof(u16) * num)) \
+      (sizeof(struct vring_avail) + sizeof(u16) * (num + 1))) \
          + PAGE_MASK) & ~PAGE_MASK) + \
-         (sizeof(struct vring_used) + sizeof(struct vring_used_elem) * num))
+         (sizeof(struct vring_used) + sizeof(struct vring_used_elem) * num) + \
+         sizeof(u16))
+
+/* Used index for which the guest expects an interrupt (EVENT_IDX) */
+#define vring_used_event(vr) ((vr)->avail->ring[(vr)->num])
+
+/* Avail index for which the host expects a kick (EVENT_IDX) */
+#define vring_avail_event(vr) (*vring_avail_event_ptr(vr))
 
 typedef unsigned char virtio_queue_t[PAGE_MASK + vring_size(MAX_QUEUE_NUM)];
 
@@ -71,6 +85,10 @@ struct vring_virtqueue {
    struct vring vring;
    u16 free_head;
    u16 last_used_idx;
+   /* Number of free descriptors */
+   unsigned int num_free;
+   /* VIRTIO_RING_F_EVENT_IDX has been negotiated */
+   int event_idx;
    void *vdata[MAX_QUEUE_NUM];
    /* PCI */
    int queue_index;
@@ -81,6 +99,11 @@ struct vring_list {
   unsigned int length;
 };
 
+static inline volatile u16 *vring_avail_event_ptr(struct vring *vr)
+{
+   return (volatile u16 *)&vr->used->ring[vr->num];
+}
+
 static inline void vring_init(struct vring *vr,
                          unsigned int num, unsigned char *queue)
 {
@@ -111,11 +134,42 @@ static inline void vring_init(struct vring *vr,
 static inline void vring_enable_cb(struct vring_virtqueue *vq)
 {
    vq->vring.avail->flags &= ~VRING_AVAIL_F_NO_INTERRUPT;
+   /* Request an interrupt for the next used buffer */
+   if (vq->event_idx)
+           vring_used_event(&vq->vring) = vq->last_used_idx;
 }
 
 static inline void vring_disable_cb(struct vring_virtqueue *vq)
 {
    vq->vring.avail->flags |= VRING_AVAIL_F_NO_INTERRUPT;
+   /* Request an interrupt only after the used index wraps */
+   if (vq->event_idx)
+           vring_used_event(&vq->vring) = vq->last_used_idx - 1;
+}
+
+/*
+ * vring_need_event
+ *
+ * has the other side's event index been passed since it was last
+ * notified ?
+ *
+ */
+
+static inline int vring_need_event(u16 event_idx, u16 new_idx, u16 old_idx)
+{
+   return (u16)(new_idx - event_idx - 1) < (u16)(new_idx - old_idx);
+}
+
+/*
+ * vring_has_free
+ *
+ * are there enough free descriptors for a buffer ?
+ *
+ */
+
+static inline int vring_has_free(struct vring_virtqueue *vq, unsigned int num)
+{
+   return (vq->num_free >= num);
 }
 
 
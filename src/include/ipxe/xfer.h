@@ -77,6 +77,10 @@ extern void xfer_window_changed ( struct interface *intf );
 #define xfer_window_changed_TYPE( object_type ) \
 	typeof ( void ( object_type ) )
 
+extern int xfer_range ( struct interface *intf, size_t offset, size_t len );
+#define xfer_range_TYPE( object_type ) \
+	typeof ( int ( object_type, size_t offset, size_t len ) )
+
 extern struct io_buffer * xfer_alloc_iob ( struct interface *intf,
 					   size_t len );
 #define xfer_alloc_iob_TYPE( object_type ) \
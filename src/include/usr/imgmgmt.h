@@ -21,6 +21,14 @@ extern int imgdownload ( struct uri *uri, const char *name, const char *cmdline,
 extern int imgdownload_string ( const char *uri_string, const char *name,
 				const char *cmdline,
 				int ( * action ) ( struct image *image ) );
+extern int imgdownload_background ( struct uri *uri, const char *name,
+				    const char *cmdline,
+				    int ( * action ) ( struct image *image ) );
+extern int imgdownload_background_string ( const char *uri_string,
+					   const char *name,
+					   const char *cmdline,
+					   int ( * action ) ( struct image *image ) );
+extern int imgwait ( void );
 extern void imgstat ( struct image *image );
 extern void imgfree ( struct image *image );
 
@@ -0,0 +1,14 @@
+#ifndef _USR_NEIGHMGMT_H
+#define _USR_NEIGHMGMT_H
+
+/** @file
+ *
+ * Neighbour cache management
+ *
+ */
+
+FILE_LICENCE ( GPL2_OR_LATER );
+
+extern void neighbour_stat ( void );
+
+#endif /* _USR_NEIGHMGMT_H */
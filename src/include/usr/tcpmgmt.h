@@ -0,0 +1,14 @@
+#ifndef _USR_TCPMGMT_H
+#define _USR_TCPMGMT_H
+
+/** @file
+ *
+ * TCP management
+ *
+ */
+
+FILE_LICENCE ( GPL2_OR_LATER );
+
+extern void tcp_stat ( void );
+
+#endif /* _USR_TCPMGMT_H */
@@ -26,6 +26,7 @@ FILE_LICENCE ( GPL2_OR_LATER );
 #include <ipxe/if_arp.h>
 #include <ipxe/iobuf.h>
 #include <ipxe/netdevice.h>
+#include <ipxe/neighbour.h>
 #include <ipxe/arp.h>
 
 /** @file
@@ -38,98 +39,24 @@ FILE_LICENCE ( GPL2_OR_LATER );
  *
  */
 
-/** An ARP cache entry */
-struct arp_entry {
-	/** Network-layer protocol */
-	struct net_protocol *net_protocol;
-	/** Link-layer protocol */
-	struct ll_protocol *ll_protocol;
-	/** Network-layer address */
-	uint8_t net_addr[MAX_NET_ADDR_LEN];
-	/** Link-layer address */
-	uint8_t ll_addr[MAX_LL_ADDR_LEN];
-};
-
-/** Number of entries in the ARP cache
- *
- * This is a global cache, covering all network interfaces,
- * network-layer protocols and link-layer protocols.
- */
-#define NUM_ARP_ENTRIES 4
-
-/** The ARP cache */
-static struct arp_entry arp_table[NUM_ARP_ENTRIES];
-#define arp_table_end &arp_table[NUM_ARP_ENTRIES]
-
-static unsigned int next_new_arp_entry = 0;
-
 struct net_protocol arp_protocol __net_protocol;
 
 /**
- * Find entry in the ARP cache
- *
- * @v ll_protocol	Link-layer protocol
- * @v net_protocol	Network-layer protocol
- * @v net_addr		Network-layer address
- * @ret arp		ARP cache entry, or NULL if not found
- *
- */
-static struct arp_entry *
-arp_find_entry ( struct ll_protocol *ll_protocol,
-		 struct net_protocol *net_protocol,
-		 const void *net_addr ) {
-	struct arp_entry *arp;
-
-	for ( arp = arp_table ; arp < arp_table_end ; arp++ ) {
-		if ( ( arp->ll_protocol == ll_protocol ) &&
-		     ( arp->net_protocol == net_protocol ) &&
-		     ( memcmp ( arp->net_addr, net_addr,
-				net_protocol->net_addr_len ) == 0 ) )
-			return arp;
-	}
-	return NULL;
-}
-
-/**
- * Look up media-specific link-layer address in the ARP cache
+ * Transmit ARP request
  *
  * @v netdev		Network device
  * @v net_protocol	Network-layer protocol
  * @v dest_net_addr	Destination network-layer address
  * @v source_net_addr	Source network-layer address
- * @ret dest_ll_addr	Destination link layer address
  * @ret rc		Return status code
- *
- * This function will use the ARP cache to look up the link-layer
- * address for the link-layer protocol associated with the network
- * device and the given network-layer protocol and addresses.  If
- * found, the destination link-layer address will be filled in in @c
- * dest_ll_addr.
- *
- * If no address is found in the ARP cache, an ARP request will be
- * transmitted on the specified network device and -ENOENT will be
- * returned.
  */
-int arp_resolve ( struct net_device *netdev, struct net_protocol *net_protocol,
-		  const void *dest_net_addr, const void *source_net_addr,
-		  void *dest_ll_addr ) {
+static int arp_request ( struct net_device *netdev,
+			 struct net_protocol *net_protocol,
+			 const void *dest_net_addr,
+			 const void *source_net_addr ) {
 	struct ll_protocol *ll_protocol = netdev->ll_protocol;
-	const struct arp_entry *arp;
 	struct io_buffer *iobuf;
 	struct arphdr *arphdr;
-	int rc;
-
-	/* Look for existing entry in ARP table */
-	arp = arp_find_entry ( ll_protocol, net_protocol, dest_net_addr );
-	if ( arp ) {
-		DBG ( "ARP cache hit: %s %s => %s %s\n",
-		      net_protocol->name, net_protocol->ntoa ( arp->net_addr ),
-		      ll_protocol->name, ll_protocol->ntoa ( arp->ll_addr ) );
-		memcpy ( dest_ll_addr, arp->ll_addr, ll_protocol->ll_addr_len);
-		return 0;
-	}
-	DBG ( "ARP cache miss: %s %s\n", net_protocol->name,
-	      net_protocol->ntoa ( dest_net_addr ) );
 
 	/* Allocate ARP packet */
 	iobuf = alloc_iob ( MAX_LL_HEADER_LEN + sizeof ( *arphdr ) +
@@ -155,11 +82,36 @@ int arp_resolve ( struct net_device *netdev, struct net_protocol *net_protocol,
 		 dest_net_addr, net_protocol->net_addr_len );
 
 	/* Transmit ARP request */
-	if ( ( rc = net_tx ( iobuf, netdev, &arp_protocol,
-			     netdev->ll_broadcast, netdev->ll_addr ) ) != 0 )
-		return rc;
+	return net_tx ( iobuf, netdev, &arp_protocol,
+			netdev->ll_broadcast, netdev->ll_addr );
+}
+
+/** ARP neighbour discovery protocol */
+static struct neighbour_discovery arp_discovery = {
+	.name = "ARP",
+	.tx_request = arp_request,
+};
+
+/**
+ * Transmit packet, resolving link-layer address via ARP
+ *
+ * @v iobuf		I/O buffer
+ * @v netdev		Network device
+ * @v net_protocol	Network-layer protocol
+ * @v dest_net_addr	Destination network-layer address
+ * @v source_net_addr	Source network-layer address
+ * @ret rc		Return status code
+ *
+ * The packet will be queued in the neighbour cache if the
+ * destination link-layer address is not yet known.  This function
+ * takes ownership of the I/O buffer.
+ */
+int arp_tx ( struct io_buffer *iobuf, struct net_device *netdev,
+	     struct net_protocol *net_protocol, const void *dest_net_addr,
+	     const void *source_net_addr ) {
 
-	return -ENOENT;
+	return neighbour_tx ( iobuf, netdev, net_protocol, dest_net_addr,
+			      source_net_addr, &arp_discovery );
 }
 
 /**
@@ -203,8 +155,7 @@ static int arp_rx ( struct io_buffer *iobuf, struct net_device *netdev,
 	struct arp_net_protocol *arp_net_protocol;
 	struct net_protocol *net_protocol;
 	struct ll_protocol *ll_protocol;
-	struct arp_entry *arp;
-	int merge = 0;
+	int merge;
 
 	/* Identify network-layer and link-layer protocols */
 	arp_net_protocol = arp_find_protocol ( arphdr->ar_pro );
@@ -220,33 +171,19 @@ static int arp_rx ( struct io_buffer *iobuf, struct net_device *netdev,
 		goto done;
 
 	/* See if we have an entry for this sender, and update it if so */
-	arp = arp_find_entry ( ll_protocol, net_protocol,
-			       arp_sender_pa ( arphdr ) );
-	if ( arp ) {
-		memcpy ( arp->ll_addr, arp_sender_ha ( arphdr ),
-			 arphdr->ar_hln );
-		merge = 1;
-		DBG ( "ARP cache update: %s %s => %s %s\n",
-		      net_protocol->name, net_protocol->ntoa ( arp->net_addr ),
-		      ll_protocol->name, ll_protocol->ntoa ( arp->ll_addr ) );
-	}
+	merge = ( neighbour_update ( netdev, net_protocol,
+				     arp_sender_pa ( arphdr ),
+				     arp_sender_ha ( arphdr ) ) == 0 );
 
 	/* See if we own the target protocol address */
 	if ( arp_net_protocol->check ( netdev, arp_target_pa ( arphdr ) ) != 0)
 		goto done;
-	
-	/* Create new ARP table entry if necessary */
-	if ( ( arphdr->ar_op == htons ( ARPOP_REPLY ) ) && (! merge ) ) {
-		arp = &arp_table[next_new_arp_entry++ % NUM_ARP_ENTRIES];
-		arp->ll_protocol = ll_protocol;
-		arp->net_protocol = net_protocol;
-		memcpy ( arp->ll_addr, arp_sender_ha ( arphdr ),
-			 arphdr->ar_hln );
-		memcpy ( arp->net_addr, arp_sender_pa ( arphdr ),
-			 arphdr->ar_pln);
-		DBG ( "ARP cache add: %s %s => %s %s\n",
-		      net_protocol->name, net_protocol->ntoa ( arp->net_addr ),
-		      ll_protocol->name, ll_protocol->ntoa ( arp->ll_addr ) );
+
+	/* Create new neighbour cache entry if necessary */
+	if ( ! merge ) {
+		neighbour_define ( netdev, net_protocol,
+				   arp_sender_pa ( arphdr ),
+				   arp_sender_ha ( arphdr ) );
 	}
 
 	/* If it's not a request, there's nothing more to do */
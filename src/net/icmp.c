@@ -20,8 +20,10 @@ FILE_LICENCE ( GPL2_OR_LATER );
 
 #include <string.h>
 #include <errno.h>
+#include <byteswap.h>
 #include <ipxe/iobuf.h>
 #include <ipxe/in.h>
+#include <ipxe/ip.h>
 #include <ipxe/tcpip.h>
 #include <ipxe/icmp.h>
 
@@ -33,16 +35,108 @@ FILE_LICENCE ( GPL2_OR_LATER );
 
 struct tcpip_protocol icmp_protocol __tcpip_protocol;
 
+/**
+ * MTU plateaus
+ *
+ * Used to estimate the next-hop MTU for routers that predate RFC
+ * 1191 and so do not report it, as described in RFC 1191 section 7.
+ */
+static const uint16_t icmp_mtu_plateaus[] = {
+	32000, 17914, 8166, 4352, 2002, 1492, 1006, 508, 296, ICMP_MIN_MTU
+};
+
+/**
+ * Estimate next-hop MTU from original datagram length
+ *
+ * @v len		Length of original datagram
+ * @ret mtu		Estimated next-hop MTU
+ */
+static size_t icmp_mtu_plateau ( size_t len ) {
+	unsigned int i;
+
+	for ( i = 0 ; i < ( sizeof ( icmp_mtu_plateaus ) /
+			    sizeof ( icmp_mtu_plateaus[0] ) ) ; i++ ) {
+		if ( icmp_mtu_plateaus[i] < len )
+			return icmp_mtu_plateaus[i];
+	}
+	return ICMP_MIN_MTU;
+}
+
+/**
+ * Process a received "fragmentation needed" message
+ *
+ * @v iobuf		I/O buffer
+ * @ret rc		Return status code
+ *
+ * The message contains the IPv4 header and the first eight bytes of
+ * the transport-layer header of the packet that was too large; this
+ * is sufficient to identify the transport-layer ports.
+ */
+static int icmp_rx_frag_needed ( struct io_buffer *iobuf ) {
+	struct icmp_unreachable *unreach = iobuf->data;
+	struct iphdr *iphdr = ( iobuf->data + sizeof ( *unreach ) );
+	size_t len = iob_len ( iobuf );
+	struct sockaddr_in sin_src;
+	struct sockaddr_in sin_dest;
+	uint16_t *ports;
+	size_t hdrlen;
+	size_t mtu;
+
+	/* Sanity checks */
+	if ( len < ( sizeof ( *unreach ) + sizeof ( *iphdr ) ) ) {
+		DBG ( "ICMP fragmentation needed too short at %zd bytes\n",
+		      len );
+		return -EINVAL;
+	}
+	hdrlen = ( ( iphdr->verhdrlen & IP_MASK_HLEN ) * 4 );
+	if ( ( ( iphdr->verhdrlen & IP_MASK_VER ) != IP_VER ) ||
+	     ( hdrlen < sizeof ( *iphdr ) ) ||
+	     ( len < ( sizeof ( *unreach ) + hdrlen + 2 * sizeof ( *ports ))) ){
+		DBG ( "ICMP fragmentation needed has malformed original "
+		      "header\n" );
+		return -EINVAL;
+	}
+	ports = ( ( ( void * ) iphdr ) + hdrlen );
+
+	/* Determine new MTU, estimating it if not provided */
+	mtu = ntohs ( unreach->mtu );
+	if ( ! mtu )
+		mtu = icmp_mtu_plateau ( ntohs ( iphdr->len ) );
+	if ( mtu < ICMP_MIN_MTU ) {
+		DBG ( "ICMP ignoring implausible MTU %zd\n", mtu );
+		return -EINVAL;
+	}
+	DBG ( "ICMP fragmentation needed for %s (MTU %zd)\n",
+	      inet_ntoa ( iphdr->dest ), mtu );
+
+	/* Pass to transport-layer protocol */
+	memset ( &sin_src, 0, sizeof ( sin_src ) );
+	sin_src.sin_family = AF_INET;
+	sin_src.sin_addr = iphdr->src;
+	sin_src.sin_port = ports[0];
+	memset ( &sin_dest, 0, sizeof ( sin_dest ) );
+	sin_dest.sin_family = AF_INET;
+	sin_dest.sin_addr = iphdr->dest;
+	sin_dest.sin_port = ports[1];
+	tcpip_pmtu ( iphdr->protocol, ( struct sockaddr_tcpip * ) &sin_src,
+		     ( struct sockaddr_tcpip * ) &sin_dest, ( mtu - hdrlen ) );
+
+	return 0;
+}
+
 /**
  * Process a received packet
  *
  * @v iobuf		I/O buffer
+ * @v netdev		Network device
  * @v st_src		Partially-filled source address
  * @v st_dest		Partially-filled destination address
  * @v pshdr_csum	Pseudo-header checksum
  * @ret rc		Return status code
  */
-static int icmp_rx ( struct io_buffer *iobuf, struct sockaddr_tcpip *st_src,
+static int icmp_rx ( struct io_buffer *iobuf,
+		     struct net_device *netdev __unused,
+		     struct sockaddr_tcpip *st_src,
 		     struct sockaddr_tcpip *st_dest,
 		     uint16_t pshdr_csum __unused ) {
 	struct icmp_header *icmp = iobuf->data;
@@ -68,6 +162,13 @@ static int icmp_rx ( struct io_buffer *iobuf, struct sockaddr_tcpip *st_src,
 		goto done;
 	}
 
+	/* Handle path MTU discovery */
+	if ( ( icmp->type == ICMP_DESTINATION_UNREACHABLE ) &&
+	     ( icmp->code == ICMP_FRAGMENTATION_NEEDED ) ) {
+		rc = icmp_rx_frag_needed ( iobuf );
+		goto done;
+	}
+
 	/* We respond only to pings */
         /* Don't bother responding to ping, it's above what most do and the neighbor table is preciously small here */
 	/* if ( icmp->type != ICMP_ECHO_REQUEST ) { */
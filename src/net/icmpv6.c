@@ -66,10 +66,12 @@ int icmp6_send_solicit ( struct net_device *netdev, struct in6_addr *src __unuse
  * Process ICMP6 headers
  *
  * @v iobuf	I/O buffer
+ * @v netdev	Network device
  * @v st_src	Source address
  * @v st_dest	Destination address
  */
-static int icmp6_rx ( struct io_buffer *iobuf, struct sockaddr_tcpip *st_src,
+static int icmp6_rx ( struct io_buffer *iobuf, struct net_device *netdev,
+		      struct sockaddr_tcpip *st_src,
 		      struct sockaddr_tcpip *st_dest, __unused uint16_t pshdr_csum ) {
 	struct icmp6_header *icmp6hdr = iobuf->data;
 
@@ -85,7 +87,7 @@ static int icmp6_rx ( struct io_buffer *iobuf, struct sockaddr_tcpip *st_src,
 	/* Process the ICMP header */
 	switch ( icmp6hdr->type ) {
 	case ICMP6_NADVERT:
-		return ndp_process_advert ( iobuf, st_src, st_dest );
+		return ndp_process_advert ( iobuf, netdev, st_src, st_dest );
 	}
 	return -ENOSYS;
 }
@@ -30,12 +30,31 @@ static uint8_t next_ident_high = 0;
 /** List of IPv4 miniroutes */
 struct list_head ipv4_miniroutes = LIST_HEAD_INIT ( ipv4_miniroutes );
 
-/** List of fragment reassembly buffers */
+/** List of fragment reassembly buffers, most recently created first */
 static LIST_HEAD ( ipv4_fragments );
 
+/** Number of fragment reassembly buffers */
+static unsigned int ipv4_fragment_count;
+
+/** Maximum number of datagrams under reassembly at any one time
+ *
+ * This is enough for a full TFTP window of fragmented blocks.  Each
+ * reassembly buffer may occupy up to 64kB, so a flood of unrelated
+ * fragments must not be allowed to create an unbounded number.
+ */
+#define IP_FRAG_MAX 16
+
 /** Fragment reassembly timeout */
 #define IP_FRAG_TIMEOUT ( TICKS_PER_SEC / 2 )
 
+/** Minimum initial fragment reassembly buffer length
+ *
+ * The total length of a fragmented datagram is not known until the
+ * final fragment arrives.  This is large enough to hold an 8kB TFTP
+ * block without needing to enlarge the buffer.
+ */
+#define IP_FRAG_MIN_ALLOC 16384
+
 /**
  * Add IPv4 minirouting table entry
  *
@@ -132,6 +151,26 @@ static struct ipv4_miniroute * ipv4_route ( struct in_addr *dest ) {
 	return NULL;
 }
 
+/**
+ * Free fragment reassembly buffer
+ *
+ * @v frag		Fragment reassembly buffer
+ */
+static void ipv4_fragment_free ( struct ipv4_fragment *frag ) {
+	struct ipv4_hole *hole;
+	struct ipv4_hole *tmp;
+
+	stop_timer ( &frag->timer );
+	list_for_each_entry_safe ( hole, tmp, &frag->holes, list ) {
+		list_del ( &hole->list );
+		free ( hole );
+	}
+	free_iob ( frag->iobuf );
+	list_del ( &frag->list );
+	ipv4_fragment_count--;
+	free ( frag );
+}
+
 /**
  * Expire fragment reassembly buffer
  *
@@ -142,13 +181,11 @@ static void ipv4_fragment_expired ( struct retry_timer *timer,
 				    int fail __unused ) {
 	struct ipv4_fragment *frag =
 		container_of ( timer, struct ipv4_fragment, timer );
-	struct iphdr *iphdr = frag->iobuf->data;
+	struct iphdr *iphdr = &frag->hdr.iphdr;
 
 	DBGC ( iphdr->src, "IPv4 fragment %04x expired\n",
 	       ntohs ( iphdr->ident ) );
-	free_iob ( frag->iobuf );
-	list_del ( &frag->list );
-	free ( frag );
+	ipv4_fragment_free ( frag );
 }
 
 /**
@@ -162,10 +199,12 @@ static struct ipv4_fragment * ipv4_fragment ( struct iphdr *iphdr ) {
 	struct iphdr *frag_iphdr;
 
 	list_for_each_entry ( frag, &ipv4_fragments, list ) {
-		frag_iphdr = frag->iobuf->data;
+		frag_iphdr = &frag->hdr.iphdr;
 
 		if ( ( iphdr->src.s_addr == frag_iphdr->src.s_addr ) &&
-		     ( iphdr->ident == frag_iphdr->ident ) ) {
+		     ( iphdr->dest.s_addr == frag_iphdr->dest.s_addr ) &&
+		     ( iphdr->ident == frag_iphdr->ident ) &&
+		     ( iphdr->protocol == frag_iphdr->protocol ) ) {
 			return frag;
 		}
 	}
@@ -174,88 +213,162 @@ static struct ipv4_fragment * ipv4_fragment ( struct iphdr *iphdr ) {
 }
 
 /**
- * Fragment reassembler
+ * Create fragment reassembly buffer
  *
- * @v iobuf		I/O buffer
- * @ret iobuf		Reassembled packet, or NULL
+ * @v iphdr		IPv4 header of first received fragment
+ * @v hdrlen		Length of IPv4 header
+ * @v alloc_len		Initial payload buffer length
+ * @ret frag		Fragment reassembly buffer, or NULL
+ *
+ * The oldest reassembly buffer will be discarded if too many
+ * datagrams are already under reassembly.
  */
-static struct io_buffer * ipv4_reassemble ( struct io_buffer *iobuf ) {
-	struct iphdr *iphdr = iobuf->data;
-	size_t offset = ( ( ntohs ( iphdr->frags ) & IP_MASK_OFFSET ) << 3 );
-	unsigned int more_frags = ( iphdr->frags & htons ( IP_MASK_MOREFRAGS ));
-	size_t hdrlen = ( ( iphdr->verhdrlen & IP_MASK_HLEN ) * 4 );
+static struct ipv4_fragment * ipv4_fragment_create ( struct iphdr *iphdr,
+						     size_t hdrlen,
+						     size_t alloc_len ) {
 	struct ipv4_fragment *frag;
-	size_t expected_offset;
+	struct ipv4_hole *hole;
+
+	/* Discard oldest reassembly buffer if there are too many */
+	if ( ipv4_fragment_count >= IP_FRAG_MAX ) {
+		frag = list_entry ( ipv4_fragments.prev, struct ipv4_fragment,
+				    list );
+		DBGC ( frag->hdr.iphdr.src, "IPv4 discarding fragment %04x "
+		       "to make room\n", ntohs ( frag->hdr.iphdr.ident ) );
+		ipv4_fragment_free ( frag );
+	}
+
+	/* Allocate and initialise structure */
+	frag = zalloc ( sizeof ( *frag ) );
+	if ( ! frag )
+		goto err_frag;
+	memcpy ( &frag->hdr, iphdr, hdrlen );
+	frag->hdrlen = hdrlen;
+	INIT_LIST_HEAD ( &frag->holes );
+	frag->csum = TCPIP_EMPTY_CSUM;
+	timer_init ( &frag->timer, ipv4_fragment_expired, NULL );
+
+	/* Allocate payload buffer, leaving room for the IPv4 header */
+	frag->iobuf = alloc_iob ( IP_MAX_HLEN + alloc_len );
+	if ( ! frag->iobuf )
+		goto err_iobuf;
+	iob_reserve ( frag->iobuf, IP_MAX_HLEN );
+
+	/* Initially, the whole datagram is missing */
+	hole = malloc ( sizeof ( *hole ) );
+	if ( ! hole )
+		goto err_hole;
+	hole->first = 0;
+	hole->last = IP_MAX_LEN;
+	list_add ( &hole->list, &frag->holes );
+
+	list_add ( &frag->list, &ipv4_fragments );
+	ipv4_fragment_count++;
+	return frag;
+
+ err_hole:
+	free_iob ( frag->iobuf );
+ err_iobuf:
+	free ( frag );
+ err_frag:
+	return NULL;
+}
+
+/**
+ * Enlarge fragment reassembly buffer
+ *
+ * @v frag		Fragment reassembly buffer
+ * @v alloc_len		New payload buffer length
+ * @ret rc		Return status code
+ */
+static int ipv4_fragment_resize ( struct ipv4_fragment *frag,
+				  size_t alloc_len ) {
 	struct io_buffer *new_iobuf;
 
-	/* Find matching fragment reassembly buffer, if any */
-	frag = ipv4_fragment ( iphdr );
+	new_iobuf = alloc_iob ( IP_MAX_HLEN + alloc_len );
+	if ( ! new_iobuf )
+		return -ENOMEM;
+	iob_reserve ( new_iobuf, IP_MAX_HLEN );
+	memcpy ( new_iobuf->data, frag->iobuf->data,
+		 iob_tailroom ( frag->iobuf ) );
+	free_iob ( frag->iobuf );
+	frag->iobuf = new_iobuf;
+	return 0;
+}
 
-	/* Drop out-of-order fragments */
-	expected_offset = ( frag ? frag->offset : 0 );
-	if ( offset != expected_offset ) {
-		DBGC ( iphdr->src, "IPv4 dropping out-of-sequence fragment "
-		       "%04x (%zd+%zd, expected %zd)\n",
-		       ntohs ( iphdr->ident ), offset,
-		      ( iob_len ( iobuf ) - hdrlen ), expected_offset );
-		goto drop;
-	}
+/**
+ * Check whether a received fragment lies entirely within a hole
+ *
+ * @v frag		Fragment reassembly buffer
+ * @v first		Offset of first byte in fragment
+ * @v last		Offset of last byte in fragment
+ * @ret is_new		Fragment contains only previously missing data
+ */
+static int ipv4_fragment_is_new ( struct ipv4_fragment *frag, size_t first,
+				  size_t last ) {
+	struct ipv4_hole *hole;
 
-	/* Create or extend fragment reassembly buffer as applicable */
-	if ( frag == NULL ) {
+	list_for_each_entry ( hole, &frag->holes, list ) {
+		if ( ( first >= hole->first ) && ( last <= hole->last ) )
+			return 1;
+	}
+	return 0;
+}
 
-		/* Create new fragment reassembly buffer */
-		frag = zalloc ( sizeof ( *frag ) );
-		if ( ! frag )
-			goto drop;
-		list_add ( &frag->list, &ipv4_fragments );
-		frag->iobuf = iobuf;
-		frag->offset = ( iob_len ( iobuf ) - hdrlen );
-		timer_init ( &frag->timer, ipv4_fragment_expired, NULL );
+/**
+ * Update hole list for a received fragment
+ *
+ * @v frag		Fragment reassembly buffer
+ * @v first		Offset of first byte in fragment
+ * @v last		Offset of last byte in fragment
+ * @v more_frags	More fragments follow this fragment
+ * @ret rc		Return status code
+ *
+ * This is the hole-filling algorithm described in RFC 815.
+ */
+static int ipv4_fragment_fill ( struct ipv4_fragment *frag, size_t first,
+				size_t last, int more_frags ) {
+	struct ipv4_hole *hole;
+	struct ipv4_hole *tmp;
+	struct ipv4_hole *upper;
+
+	list_for_each_entry_safe ( hole, tmp, &frag->holes, list ) {
+
+		/* Nothing beyond the final fragment can be missing */
+		if ( ( ! more_frags ) && ( hole->first > last ) ) {
+			list_del ( &hole->list );
+			free ( hole );
+			continue;
+		}
 
-	} else {
+		/* Skip holes not touched by this fragment */
+		if ( ( first > hole->last ) || ( last < hole->first ) )
+			continue;
 
-		/* Extend reassembly buffer */
-		iob_pull ( iobuf, hdrlen );
-		new_iobuf = alloc_iob ( iob_len ( frag->iobuf ) +
-					iob_len ( iobuf ) );
-		if ( ! new_iobuf ) {
-			DBGC ( iphdr->src, "IPv4 could not extend reassembly "
-			       "buffer to %zd bytes\n",
-			       iob_len ( frag->iobuf ) + iob_len ( iobuf ) );
-			goto drop;
+		/* Create a new hole for any part of the existing hole
+		 * above this fragment.
+		 */
+		if ( ( last < hole->last ) && more_frags ) {
+			upper = malloc ( sizeof ( *upper ) );
+			if ( ! upper )
+				return -ENOMEM;
+			upper->first = ( last + 1 );
+			upper->last = hole->last;
+			list_add ( &upper->list, &hole->list );
 		}
-		memcpy ( iob_put ( new_iobuf, iob_len ( frag->iobuf ) ),
-			 frag->iobuf->data, iob_len ( frag->iobuf ) );
-		memcpy ( iob_put ( new_iobuf, iob_len ( iobuf ) ),
-			 iobuf->data, iob_len ( iobuf ) );
-		free_iob ( frag->iobuf );
-		frag->iobuf = new_iobuf;
-		frag->offset += iob_len ( iobuf );
-		free_iob ( iobuf );
-		iphdr = frag->iobuf->data;
-		iphdr->len = ntohs ( iob_len ( frag->iobuf ) );
-
-		/* Stop fragment reassembly timer */
-		stop_timer ( &frag->timer );
-
-		/* If this is the final fragment, return it */
-		if ( ! more_frags ) {
-			iobuf = frag->iobuf;
-			list_del ( &frag->list );
-			free ( frag );
-			return iobuf;
+
+		/* Retain the existing hole for any part below this
+		 * fragment, otherwise delete it.
+		 */
+		if ( first > hole->first ) {
+			hole->last = ( first - 1 );
+		} else {
+			list_del ( &hole->list );
+			free ( hole );
 		}
 	}
 
-	/* (Re)start fragment reassembly timer */
-	start_timer_fixed ( &frag->timer, IP_FRAG_TIMEOUT );
-
-	return NULL;
-
- drop:
-	free_iob ( iobuf );
-	return NULL;
+	return 0;
 }
 
 /**
@@ -282,31 +395,169 @@ static uint16_t ipv4_pshdr_chksum ( struct io_buffer *iobuf, uint16_t csum ) {
 }
 
 /**
- * Determine link-layer address
+ * Fragment reassembler
+ *
+ * @v iobuf		I/O buffer
+ * @ret iobuf		Reassembled packet, or NULL
+ *
+ * Fragments may arrive in any order, and several datagrams may be
+ * under reassembly at once.  Each fragment's payload is copied
+ * directly to its final position within a single reassembly buffer.
+ *
+ * The payload checksum is calculated as each fragment is copied.
+ * Fragment offsets are always multiples of eight bytes, so the
+ * partial checksums may be summed in any order.  If no fragments
+ * overlapped, the transport-layer checksum of a TCP or UDP datagram
+ * is verified here and the transport layer need not read the
+ * payload again.
+ */
+static struct io_buffer * ipv4_reassemble ( struct io_buffer *iobuf ) {
+	struct iphdr *iphdr = iobuf->data;
+	size_t offset = ( ( ntohs ( iphdr->frags ) & IP_MASK_OFFSET ) << 3 );
+	unsigned int more_frags = ( iphdr->frags & htons ( IP_MASK_MOREFRAGS ));
+	size_t hdrlen = ( ( iphdr->verhdrlen & IP_MASK_HLEN ) * 4 );
+	size_t len = ( iob_len ( iobuf ) - hdrlen );
+	size_t end = ( offset + len );
+	struct ipv4_fragment *frag;
+	size_t alloc_len;
+	int is_new;
+
+	/* Sanity checks.  All but the final fragment must contain a
+	 * multiple of eight bytes.
+	 */
+	if ( ( len == 0 ) || ( more_frags && ( len & 7 ) ) ||
+	     ( ( end + hdrlen ) > IP_MAX_LEN ) ) {
+		DBGC ( iphdr->src, "IPv4 dropping malformed fragment %04x "
+		       "(%zd+%zd)\n", ntohs ( iphdr->ident ), offset, len );
+		goto drop;
+	}
+
+	/* Find or create fragment reassembly buffer */
+	frag = ipv4_fragment ( iphdr );
+	if ( ! frag ) {
+		alloc_len = ( more_frags ?
+			      ( ( end > IP_FRAG_MIN_ALLOC ) ?
+				end : IP_FRAG_MIN_ALLOC ) : end );
+		frag = ipv4_fragment_create ( iphdr, hdrlen, alloc_len );
+		if ( ! frag )
+			goto drop;
+	}
+
+	/* Check consistency with any known total length */
+	if ( ( frag->len && ( end > frag->len ) ) ||
+	     ( frag->len && ( ! more_frags ) && ( end != frag->len ) ) ) {
+		DBGC ( iphdr->src, "IPv4 dropping inconsistent fragment %04x "
+		       "(%zd+%zd, total %zd)\n", ntohs ( iphdr->ident ),
+		       offset, len, frag->len );
+		goto drop;
+	}
+	if ( ! more_frags )
+		frag->len = end;
+
+	/* Record header from the first fragment */
+	if ( offset == 0 ) {
+		memcpy ( &frag->hdr, iphdr, hdrlen );
+		frag->hdrlen = hdrlen;
+	}
+
+	/* Enlarge reassembly buffer if necessary.  If the total
+	 * length is not yet known, grow geometrically to avoid
+	 * repeated copying.
+	 */
+	if ( end > iob_tailroom ( frag->iobuf ) ) {
+		alloc_len = ( 2 * iob_tailroom ( frag->iobuf ) );
+		if ( alloc_len < end )
+			alloc_len = end;
+		if ( alloc_len > IP_MAX_LEN )
+			alloc_len = IP_MAX_LEN;
+		if ( frag->len )
+			alloc_len = frag->len;
+		if ( ipv4_fragment_resize ( frag, alloc_len ) != 0 ) {
+			DBGC ( iphdr->src, "IPv4 could not extend reassembly "
+			       "buffer to %zd bytes\n", alloc_len );
+			goto drop_frag;
+		}
+	}
+
+	/* Fill in hole list and copy payload into place, accumulating
+	 * the payload checksum unless this fragment overlaps data
+	 * already received.
+	 */
+	is_new = ipv4_fragment_is_new ( frag, offset, ( end - 1 ) );
+	if ( ipv4_fragment_fill ( frag, offset, ( end - 1 ),
+				  more_frags ) != 0 ) {
+		DBGC ( iphdr->src, "IPv4 could not track holes in fragment "
+		       "%04x\n", ntohs ( iphdr->ident ) );
+		goto drop_frag;
+	}
+	if ( is_new && ! frag->overlapped ) {
+		frag->csum = tcpip_copy_chksum ( frag->csum,
+						 ( frag->iobuf->data + offset ),
+						 ( iobuf->data + hdrlen ), len );
+	} else {
+		memcpy ( ( frag->iobuf->data + offset ),
+			 ( iobuf->data + hdrlen ), len );
+		frag->overlapped = 1;
+	}
+	free_iob ( iobuf );
+
+	/* If the datagram is not yet complete, (re)start fragment
+	 * reassembly timer and wait for more fragments.
+	 */
+	if ( ! list_empty ( &frag->holes ) ) {
+		start_timer_fixed ( &frag->timer, IP_FRAG_TIMEOUT );
+		return NULL;
+	}
+
+	/* Construct complete datagram */
+	iobuf = frag->iobuf;
+	frag->iobuf = NULL;
+	iob_put ( iobuf, frag->len );
+	iphdr = iob_push ( iobuf, frag->hdrlen );
+	memcpy ( iphdr, &frag->hdr, frag->hdrlen );
+	iphdr->len = htons ( iob_len ( iobuf ) );
+	iphdr->frags = 0;
+	iphdr->chksum = 0;
+	iphdr->chksum = tcpip_chksum ( iphdr, frag->hdrlen );
+
+	/* Verify transport-layer checksum using the payload checksum
+	 * accumulated during reassembly, if possible.
+	 */
+	if ( ( ! frag->overlapped ) &&
+	     ( ( iphdr->protocol == IP_TCP ) ||
+	       ( iphdr->protocol == IP_UDP ) ) &&
+	     ( ipv4_pshdr_chksum ( iobuf, frag->csum ) == 0 ) ) {
+		iobuf->flags |= IOB_FL_CSUM_VALID;
+	}
+
+	ipv4_fragment_free ( frag );
+	return iobuf;
+
+ drop_frag:
+	ipv4_fragment_free ( frag );
+ drop:
+	free_iob ( iobuf );
+	return NULL;
+}
+
+/**
+ * Determine link-layer address for broadcast or multicast packet
  *
  * @v dest		IPv4 destination address
- * @v src		IPv4 source address
- * @v netmask		IPv4 subnet mask
  * @v netdev		Network device
  * @v ll_dest		Link-layer destination address buffer
  * @ret rc		Return status code
  */
-static int ipv4_ll_addr ( struct in_addr dest, struct in_addr src,
-			  struct in_addr netmask, struct net_device *netdev,
+static int ipv4_ll_addr ( struct in_addr dest, struct net_device *netdev,
 			  uint8_t *ll_dest ) {
 	struct ll_protocol *ll_protocol = netdev->ll_protocol;
 
-	if ( ( ( dest.s_addr ^ INADDR_BROADCAST ) & ~netmask.s_addr ) == 0 ) {
-		/* Broadcast address */
+	if ( IN_MULTICAST ( ntohl ( dest.s_addr ) ) ) {
+		return ll_protocol->mc_hash ( AF_INET, &dest, ll_dest );
+	} else {
 		memcpy ( ll_dest, netdev->ll_broadcast,
 			 ll_protocol->ll_addr_len );
 		return 0;
-	} else if ( IN_MULTICAST ( ntohl ( dest.s_addr ) ) ) {
-		return ll_protocol->mc_hash ( AF_INET, &dest, ll_dest );
-	} else {
-		/* Unicast address: resolve via ARP */
-		return arp_resolve ( netdev, &ipv4_protocol, &dest,
-				     &src, ll_dest );
 	}
 }
 
@@ -336,6 +587,7 @@ static int ipv4_tx ( struct io_buffer *iobuf,
 	struct in_addr next_hop;
 	struct in_addr netmask = { .s_addr = 0 };
 	uint8_t ll_dest[MAX_LL_ADDR_LEN];
+	uint16_t csum;
 	int rc;
 
 	/* Fill up the IP header, except source address */
@@ -345,6 +597,8 @@ static int ipv4_tx ( struct io_buffer *iobuf,
 	iphdr->len = htons ( iob_len ( iobuf ) );	
 	iphdr->ttl = IP_TTL;
 	iphdr->protocol = tcpip_protocol->tcpip_proto;
+	if ( tcpip_protocol->pmtu )
+		iphdr->frags = htons ( IP_MASK_DONOTFRAG );
 	iphdr->dest = sin_dest->sin_addr;
 
 	/* Use routing table to identify next hop and transmitting netdev */
@@ -373,19 +627,16 @@ static int ipv4_tx ( struct io_buffer *iobuf,
 			       ( ( netdev->rx_stats.bad & 0xf ) << 4 ) |
 			       ( ( netdev->rx_stats.good & 0xf ) << 0 ) );
 
-	/* Determine link-layer destination address */
-	if ( ( rc = ipv4_ll_addr ( next_hop, iphdr->src, netmask, netdev,
-				   ll_dest ) ) != 0 ) {
-		DBGC ( sin_dest->sin_addr, "IPv4 has no link-layer address for "
-		       "%s: %s\n", inet_ntoa ( next_hop ), strerror ( rc ) );
-		/* Record error for diagnosis */
-		netdev_tx_err ( netdev, iob_disown ( iobuf ), rc );
-		goto err;
+	/* Fix up checksums.  If the transport-layer checksum is to
+	 * be calculated by the hardware, then the checksum field must
+	 * contain the (uncomplemented) pseudo-header checksum.
+	 */
+	if ( trans_csum ) {
+		csum = tcpip_tx_chksum ( iobuf, netdev, *trans_csum );
+		*trans_csum = ipv4_pshdr_chksum ( iobuf, csum );
+		if ( iobuf->flags & IOB_FL_CSUM_PARTIAL )
+			*trans_csum = ~( *trans_csum );
 	}
-
-	/* Fix up checksums */
-	if ( trans_csum )
-		*trans_csum = ipv4_pshdr_chksum ( iobuf, *trans_csum );
 	iphdr->chksum = tcpip_chksum ( iphdr, sizeof ( *iphdr ) );
 
 	/* Print IP4 header for debugging */
@@ -395,9 +646,28 @@ static int ipv4_tx ( struct io_buffer *iobuf,
 		iphdr->protocol, ntohs ( iphdr->ident ),
 		ntohs ( iphdr->chksum ) );
 
-	/* Hand off to link layer */
-	if ( ( rc = net_tx ( iobuf, netdev, &ipv4_protocol, ll_dest,
-			     netdev->ll_addr ) ) != 0 ) {
+	/* Hand off to link layer.  Unicast packets are handed to
+	 * ARP, which will hold them until the next hop is resolved.
+	 */
+	if ( ( ( ( next_hop.s_addr ^ INADDR_BROADCAST ) &
+		 ~netmask.s_addr ) == 0 ) ||
+	     IN_MULTICAST ( ntohl ( next_hop.s_addr ) ) ) {
+		if ( ( rc = ipv4_ll_addr ( next_hop, netdev,
+					   ll_dest ) ) != 0 ) {
+			DBGC ( sin_dest->sin_addr, "IPv4 has no link-layer "
+			       "address for %s: %s\n",
+			       inet_ntoa ( next_hop ), strerror ( rc ) );
+			/* Record error for diagnosis */
+			netdev_tx_err ( netdev, iob_disown ( iobuf ), rc );
+			goto err;
+		}
+		rc = net_tx ( iobuf, netdev, &ipv4_protocol, ll_dest,
+			      netdev->ll_addr );
+	} else {
+		rc = arp_tx ( iobuf, netdev, &ipv4_protocol, &next_hop,
+			      &iphdr->src );
+	}
+	if ( rc != 0 ) {
 		DBGC ( sin_dest->sin_addr, "IPv4 could not transmit packet "
 		       "via %s: %s\n", netdev->name, strerror ( rc ) );
 		return rc;
@@ -410,6 +680,32 @@ static int ipv4_tx ( struct io_buffer *iobuf,
 	return rc;
 }
 
+/**
+ * Determine maximum transmission unit
+ *
+ * @v st_dest		Destination address
+ * @ret mtu		Maximum transport-layer packet length, or zero
+ *
+ * The MTU is determined from the network device used to reach the
+ * next hop.  Any reduction in the path MTU beyond the next hop is
+ * reported via tcpip_pmtu().
+ */
+static size_t ipv4_mtu ( struct sockaddr_tcpip *st_dest ) {
+	struct sockaddr_in *sin_dest = ( ( struct sockaddr_in * ) st_dest );
+	struct in_addr next_hop = sin_dest->sin_addr;
+	struct ipv4_miniroute *miniroute;
+	struct net_device *netdev;
+
+	/* Identify transmitting network device */
+	miniroute = ipv4_route ( &next_hop );
+	if ( ! miniroute )
+		return 0;
+	netdev = miniroute->netdev;
+
+	return ( netdev->max_pkt_len - netdev->ll_protocol->ll_header_len -
+		 sizeof ( struct iphdr ) );
+}
+
 /**
  * Check if network device has any IPv4 address
  *
@@ -555,7 +851,7 @@ static int ipv4_rx ( struct io_buffer *iobuf,
 	dest.sin.sin_addr = iphdr->dest;
 	pshdr_csum = ipv4_pshdr_chksum ( iobuf, TCPIP_EMPTY_CSUM );
 	iob_pull ( iobuf, hdrlen );
-	if ( ( rc = tcpip_rx ( iobuf, iphdr->protocol, &src.st,
+	if ( ( rc = tcpip_rx ( iobuf, netdev, iphdr->protocol, &src.st,
 			       &dest.st, pshdr_csum ) ) != 0 ) {
 		DBGC ( src.sin.sin_addr, "IPv4 received packet rejected by "
 		       "stack: %s\n", strerror ( rc ) );
@@ -624,6 +920,7 @@ struct tcpip_net_protocol ipv4_tcpip_protocol __tcpip_net_protocol = {
 	.name = "IPv4",
 	.sa_family = AF_INET,
 	.tx = ipv4_tx,
+	.mtu = ipv4_mtu,
 };
 
 /** IPv4 ARP protocol */
@@ -183,6 +183,7 @@ static int ipv6_tx ( struct io_buffer *iobuf,
 	struct ipv6_miniroute *miniroute;
 	uint8_t ll_dest_buf[MAX_LL_ADDR_LEN];
 	const uint8_t *ll_dest = ll_dest_buf;
+	uint16_t csum;
 	int rc;
 
 	/* Construct the IPv6 packet */
@@ -218,8 +219,12 @@ static int ipv6_tx ( struct io_buffer *iobuf,
 	}
 
 	/* Complete the transport layer checksum */
-	if ( trans_csum )
-		*trans_csum = ipv6_tx_csum ( iobuf, *trans_csum );
+	if ( trans_csum ) {
+		csum = tcpip_tx_chksum ( iobuf, netdev, *trans_csum );
+		*trans_csum = ipv6_tx_csum ( iobuf, csum );
+		if ( iobuf->flags & IOB_FL_CSUM_PARTIAL )
+			*trans_csum = ~( *trans_csum );
+	}
 
 	/* Print IPv6 header */
 	ipv6_dump ( ip6hdr );
@@ -234,11 +239,7 @@ static int ipv6_tx ( struct io_buffer *iobuf,
 		ll_dest_buf[5] = next_hop.in6_u.u6_addr8[15];
 	} else {
 		/* Unicast address needs to be resolved by NDP */
-		if ( ( rc = ndp_resolve ( netdev, &next_hop, &ip6hdr->src,
-					  ll_dest_buf ) ) != 0 ) {
-			DBG ( "No entry for %s\n", inet6_ntoa ( next_hop ) );
-			goto err;
-		}
+		return ndp_tx ( iobuf, netdev, &next_hop, &ip6hdr->src );
 	}
 
 	/* Transmit packet */
@@ -254,13 +255,15 @@ static int ipv6_tx ( struct io_buffer *iobuf,
  * Process next IP6 header
  *
  * @v iobuf	I/O buffer
+ * @v netdev	Network device
  * @v nxt_hdr	Next header number
  * @v src	Source socket address
  * @v dest	Destination socket address
  *
  * Refer http://www.iana.org/assignments/ipv6-parameters for the numbers
  */
-static int ipv6_process_nxt_hdr ( struct io_buffer *iobuf, uint8_t nxt_hdr,
+static int ipv6_process_nxt_hdr ( struct io_buffer *iobuf,
+				  struct net_device *netdev, uint8_t nxt_hdr,
 		struct sockaddr_tcpip *src, struct sockaddr_tcpip *dest ) {
 	switch ( nxt_hdr ) {
 	case IP6_HOPBYHOP: 
@@ -278,7 +281,7 @@ static int ipv6_process_nxt_hdr ( struct io_buffer *iobuf, uint8_t nxt_hdr,
 		return 0;
 	}
 	/* Next header is not a IPv6 extension header */
-	return tcpip_rx ( iobuf, nxt_hdr, src, dest, 0 /* fixme */ );
+	return tcpip_rx ( iobuf, netdev, nxt_hdr, src, dest, 0 /* fixme */ );
 }
 
 /**
@@ -293,7 +296,7 @@ static int ipv6_process_nxt_hdr ( struct io_buffer *iobuf, uint8_t nxt_hdr,
  * This function processes a IPv6 packet
  */
 static int ipv6_rx ( struct io_buffer *iobuf,
-		     __unused struct net_device *netdev,
+		     struct net_device *netdev,
 		     __unused const void *ll_dest,
 		     __unused const void *ll_source,
 		     __unused unsigned int flags ) {
@@ -344,7 +347,8 @@ static int ipv6_rx ( struct io_buffer *iobuf,
 	iob_pull ( iobuf, sizeof ( *ip6hdr ) );
 
 	/* Send it to the transport layer */
-	return ipv6_process_nxt_hdr ( iobuf, ip6hdr->nxt_hdr, &src.st, &dest.st );
+	return ipv6_process_nxt_hdr ( iobuf, netdev, ip6hdr->nxt_hdr,
+				      &src.st, &dest.st );
 
   drop:
 	DBG ( "Packet dropped\n" );
@@ -363,6 +367,33 @@ char * inet6_ntoa ( struct in6_addr in6 ) {
 	return buf;
 }
 
+/**
+ * Determine maximum transmission unit
+ *
+ * @v st_dest		Destination address
+ * @ret mtu		Maximum transport-layer packet length, or zero
+ *
+ * The MTU is determined from the network device that ipv6_tx() would
+ * use to reach the destination.
+ */
+static size_t ipv6_mtu ( struct sockaddr_tcpip *st_dest ) {
+	struct sockaddr_in6 *dest = ( ( struct sockaddr_in6 * ) st_dest );
+	struct ipv6_miniroute *miniroute;
+	struct net_device *netdev;
+
+	list_for_each_entry ( miniroute, &miniroutes, list ) {
+		if ( ( memcmp ( &dest->sin6_addr, &miniroute->prefix,
+				miniroute->prefix_len ) == 0 ) ||
+		     ( IP6_EQUAL ( miniroute->gateway, ip6_none ) ) ) {
+			netdev = miniroute->netdev;
+			return ( netdev->max_pkt_len -
+				 netdev->ll_protocol->ll_header_len -
+				 sizeof ( struct ip6_header ) );
+		}
+	}
+	return 0;
+}
+
 static const char * ipv6_ntoa ( const void *net_addr ) {
 	return inet6_ntoa ( * ( ( struct in6_addr * ) net_addr ) );
 }
@@ -381,4 +412,5 @@ struct tcpip_net_protocol ipv6_tcpip_protocol __tcpip_net_protocol = {
 	.name = "IPv6",
 	.sa_family = AF_INET6,
 	.tx = ipv6_tx,
+	.mtu = ipv6_mtu,
 };
@@ -0,0 +1,470 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+FILE_LICENCE ( GPL2_OR_LATER );
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ipxe/iobuf.h>
+#include <ipxe/netdevice.h>
+#include <ipxe/neighbour.h>
+#include <config/general.h>
+
+/** @file
+ *
+ * Neighbour cache
+ *
+ * This is a protocol-independent cache of link-layer addresses,
+ * shared by all neighbour discovery protocols (ARP and NDP).  Each
+ * entry is keyed by network device, network-layer protocol and
+ * network-layer address.  Entries are located via a small hash
+ * table, and are evicted in least-recently-used order once the
+ * cache reaches NEIGHBOUR_CACHE_SIZE entries.
+ *
+ * Packets transmitted to an address that is not yet resolved are
+ * queued on the cache entry until the address is resolved or the
+ * resolution times out.  Resolved entries are trusted for
+ * NEIGHBOUR_REACHABLE_TIMEOUT; after this, the entry continues to be
+ * used while a fresh discovery request is sent to reconfirm it.
+ */
+
+/** Number of neighbour cache hash chains (must be a power of two) */
+#define NEIGHBOUR_HASH_SIZE 16
+
+/** List of neighbour cache entries */
+struct list_head neighbours = LIST_HEAD_INIT ( neighbours );
+
+/** Neighbour cache hash chains */
+static struct neighbour *neighbour_hash[NEIGHBOUR_HASH_SIZE];
+
+/** Number of neighbour cache entries */
+static unsigned int neighbour_count;
+
+/** Neighbour cache statistics */
+struct neighbour_statistics neighbour_stats;
+
+/**
+ * Calculate neighbour cache hash chain
+ *
+ * @v net_protocol	Network-layer protocol
+ * @v net_dest		Network-layer address
+ * @ret chain		Hash chain head
+ */
+static struct neighbour ** neighbour_chain ( struct net_protocol *net_protocol,
+					     const void *net_dest ) {
+	const uint8_t *bytes = net_dest;
+	unsigned int hash = net_protocol->net_proto;
+	unsigned int i;
+
+	for ( i = 0 ; i < net_protocol->net_addr_len ; i++ )
+		hash = ( ( hash * 31 ) + bytes[i] );
+	hash ^= ( hash >> 8 );
+	return &neighbour_hash[ hash & ( NEIGHBOUR_HASH_SIZE - 1 ) ];
+}
+
+/**
+ * Find neighbour cache entry
+ *
+ * @v netdev		Network device, or NULL to match any device
+ * @v net_protocol	Network-layer protocol
+ * @v net_dest		Network-layer address
+ * @ret neighbour	Neighbour cache entry, or NULL if not found
+ */
+static struct neighbour * neighbour_find ( struct net_device *netdev,
+					   struct net_protocol *net_protocol,
+					   const void *net_dest ) {
+	struct neighbour *neighbour;
+
+	for ( neighbour = *neighbour_chain ( net_protocol, net_dest ) ;
+	      neighbour ; neighbour = neighbour->hash_next ) {
+		if ( ( ( neighbour->netdev == netdev ) || ( ! netdev ) ) &&
+		     ( neighbour->net_protocol == net_protocol ) &&
+		     ( memcmp ( neighbour->net_addr, net_dest,
+				net_protocol->net_addr_len ) == 0 ) )
+			return neighbour;
+	}
+	return NULL;
+}
+
+/**
+ * Destroy neighbour cache entry
+ *
+ * @v neighbour		Neighbour cache entry
+ * @v rc		Reason for destruction
+ *
+ * Any packets still awaiting address resolution are discarded.
+ */
+static void neighbour_destroy ( struct neighbour *neighbour, int rc ) {
+	struct net_device *netdev = neighbour->netdev;
+	struct net_protocol *net_protocol = neighbour->net_protocol;
+	struct neighbour **prev;
+	struct io_buffer *iobuf;
+	struct io_buffer *tmp;
+
+	DBGC ( neighbour, "NEIGHBOUR %s %s %s destroyed: %s\n", netdev->name,
+	       net_protocol->name, net_protocol->ntoa ( neighbour->net_addr ),
+	       strerror ( rc ) );
+
+	/* Stop timer */
+	stop_timer ( &neighbour->timer );
+
+	/* Discard any queued packets */
+	list_for_each_entry_safe ( iobuf, tmp, &neighbour->tx_queue, list ) {
+		list_del ( &iobuf->list );
+		neighbour_stats.drops++;
+		netdev_tx_err ( netdev, iobuf, rc );
+	}
+
+	/* Remove from hash chain and list of entries */
+	for ( prev = neighbour_chain ( net_protocol, neighbour->net_addr ) ;
+	      *prev != neighbour ; prev = &(*prev)->hash_next ) {}
+	*prev = neighbour->hash_next;
+	list_del ( &neighbour->list );
+	neighbour_count--;
+
+	/* Free entry */
+	netdev_put ( netdev );
+	free ( neighbour );
+}
+
+/**
+ * Transmit neighbour discovery request
+ *
+ * @v neighbour		Neighbour cache entry
+ */
+static void neighbour_discover ( struct neighbour *neighbour ) {
+	struct net_device *netdev = neighbour->netdev;
+	struct net_protocol *net_protocol = neighbour->net_protocol;
+	int rc;
+
+	/* Transmit request.  Failures are handled by the
+	 * retransmission timer.
+	 */
+	if ( ( rc = neighbour->discovery->tx_request ( netdev, net_protocol,
+						       neighbour->net_addr,
+						       neighbour->net_source ) )
+	     != 0 ) {
+		DBGC ( neighbour, "NEIGHBOUR %s %s %s could not transmit %s "
+		       "request: %s\n", netdev->name, net_protocol->name,
+		       net_protocol->ntoa ( neighbour->net_addr ),
+		       neighbour->discovery->name, strerror ( rc ) );
+	}
+	neighbour->requests++;
+	start_timer_fixed ( &neighbour->timer, NEIGHBOUR_REQUEST_TIMEOUT );
+}
+
+/**
+ * Handle neighbour discovery retransmission timer expiry
+ *
+ * @v timer		Retransmission timer
+ * @v fail		Failure indicator
+ */
+static void neighbour_expired ( struct retry_timer *timer,
+				int fail __unused ) {
+	struct neighbour *neighbour =
+		container_of ( timer, struct neighbour, timer );
+
+	/* Retransmit request, unless we have already sent enough */
+	if ( neighbour->requests < NEIGHBOUR_MAX_REQUESTS ) {
+		neighbour_discover ( neighbour );
+		return;
+	}
+
+	/* Give up.  An unresolved entry is a failed resolution; a
+	 * stale entry is simply no longer trusted.
+	 */
+	if ( neighbour->state == NEIGHBOUR_INCOMPLETE )
+		neighbour_stats.failures++;
+	neighbour_destroy ( neighbour, -ETIMEDOUT );
+}
+
+/**
+ * Create neighbour cache entry
+ *
+ * @v netdev		Network device
+ * @v net_protocol	Network-layer protocol
+ * @v net_dest		Network-layer address
+ * @ret neighbour	Neighbour cache entry, or NULL on allocation failure
+ *
+ * The least recently used entry will be evicted if the cache is full.
+ */
+static struct neighbour * neighbour_create ( struct net_device *netdev,
+					     struct net_protocol *net_protocol,
+					     const void *net_dest ) {
+	struct neighbour **chain;
+	struct neighbour *neighbour;
+
+	/* Evict least recently used entry if cache is full */
+	if ( neighbour_count >= NEIGHBOUR_CACHE_SIZE ) {
+		neighbour = list_entry ( neighbours.prev, struct neighbour,
+					 list );
+		neighbour_stats.evictions++;
+		neighbour_destroy ( neighbour, -ENOBUFS );
+	}
+
+	/* Allocate and initialise entry */
+	neighbour = zalloc ( sizeof ( *neighbour ) );
+	if ( ! neighbour )
+		return NULL;
+	neighbour->netdev = netdev_get ( netdev );
+	neighbour->net_protocol = net_protocol;
+	memcpy ( neighbour->net_addr, net_dest, net_protocol->net_addr_len );
+	neighbour->state = NEIGHBOUR_INCOMPLETE;
+	INIT_LIST_HEAD ( &neighbour->tx_queue );
+	timer_init ( &neighbour->timer, neighbour_expired, NULL );
+
+	/* Add to hash chain and list of entries */
+	chain = neighbour_chain ( net_protocol, net_dest );
+	neighbour->hash_next = *chain;
+	*chain = neighbour;
+	list_add ( &neighbour->list, &neighbours );
+	neighbour_count++;
+
+	return neighbour;
+}
+
+/**
+ * Record resolved link-layer address
+ *
+ * @v neighbour		Neighbour cache entry
+ * @v ll_dest		Link-layer address
+ *
+ * Any packets awaiting address resolution are transmitted.
+ */
+static void neighbour_resolved ( struct neighbour *neighbour,
+				 const void *ll_dest ) {
+	struct net_device *netdev = neighbour->netdev;
+	struct ll_protocol *ll_protocol = netdev->ll_protocol;
+	struct net_protocol *net_protocol = neighbour->net_protocol;
+	struct io_buffer *iobuf;
+	struct io_buffer *tmp;
+
+	/* Record address and mark as reachable */
+	memcpy ( neighbour->ll_addr, ll_dest, ll_protocol->ll_addr_len );
+	neighbour->state = NEIGHBOUR_REACHABLE;
+	neighbour->confirmed = currticks();
+	neighbour->requests = 0;
+	stop_timer ( &neighbour->timer );
+	DBGC ( neighbour, "NEIGHBOUR %s %s %s => %s %s\n", netdev->name,
+	       net_protocol->name, net_protocol->ntoa ( neighbour->net_addr ),
+	       ll_protocol->name, ll_protocol->ntoa ( neighbour->ll_addr ) );
+
+	/* Transmit any queued packets */
+	list_for_each_entry_safe ( iobuf, tmp, &neighbour->tx_queue, list ) {
+		list_del ( &iobuf->list );
+		neighbour->tx_count--;
+		net_tx ( iobuf, netdev, net_protocol, neighbour->ll_addr,
+			 netdev->ll_addr );
+	}
+}
+
+/**
+ * Transmit packet, resolving link-layer address via neighbour cache
+ *
+ * @v iobuf		I/O buffer
+ * @v netdev		Network device
+ * @v net_protocol	Network-layer protocol
+ * @v net_dest		Destination network-layer address
+ * @v net_source	Source network-layer address
+ * @v discovery		Neighbour discovery protocol
+ * @ret rc		Return status code
+ *
+ * If the destination link-layer address is known, the packet is
+ * transmitted immediately.  Otherwise, a discovery request is
+ * transmitted and the packet is queued until the address is resolved
+ * (or the resolution times out).  At most NEIGHBOUR_MAX_QUEUE
+ * packets are held for each unresolved address; the oldest packet is
+ * discarded to make room for new packets.
+ *
+ * This function takes ownership of the I/O buffer.
+ */
+int neighbour_tx ( struct io_buffer *iobuf, struct net_device *netdev,
+		   struct net_protocol *net_protocol, const void *net_dest,
+		   const void *net_source,
+		   struct neighbour_discovery *discovery ) {
+	struct neighbour *neighbour;
+	struct io_buffer *oldest;
+	int rc;
+
+	/* Find or create neighbour cache entry */
+	neighbour = neighbour_find ( netdev, net_protocol, net_dest );
+	if ( ! neighbour ) {
+		neighbour = neighbour_create ( netdev, net_protocol, net_dest );
+		if ( ! neighbour ) {
+			rc = -ENOMEM;
+			goto err_create;
+		}
+	}
+	neighbour->discovery = discovery;
+	memcpy ( neighbour->net_source, net_source,
+		 net_protocol->net_addr_len );
+
+	/* Mark as most recently used */
+	list_del ( &neighbour->list );
+	list_add ( &neighbour->list, &neighbours );
+
+	/* Transmit immediately if address is known */
+	if ( neighbour->state != NEIGHBOUR_INCOMPLETE ) {
+		neighbour_stats.hits++;
+
+		/* Start reconfirming address if it has aged out */
+		if ( ( neighbour->state == NEIGHBOUR_REACHABLE ) &&
+		     ( ( currticks() - neighbour->confirmed ) >
+		       NEIGHBOUR_REACHABLE_TIMEOUT ) ) {
+			DBGC ( neighbour, "NEIGHBOUR %s %s %s is stale\n",
+			       netdev->name, net_protocol->name,
+			       net_protocol->ntoa ( net_dest ) );
+			neighbour->state = NEIGHBOUR_STALE;
+			neighbour_discover ( neighbour );
+		}
+
+		return net_tx ( iobuf, netdev, net_protocol,
+				neighbour->ll_addr, netdev->ll_addr );
+	}
+	neighbour_stats.misses++;
+
+	/* Start address resolution, if not already in progress */
+	if ( ! timer_running ( &neighbour->timer ) )
+		neighbour_discover ( neighbour );
+
+	/* Discard oldest queued packet if queue is full */
+	if ( neighbour->tx_count >= NEIGHBOUR_MAX_QUEUE ) {
+		oldest = list_first_entry ( &neighbour->tx_queue,
+					    struct io_buffer, list );
+		list_del ( &oldest->list );
+		neighbour->tx_count--;
+		neighbour_stats.drops++;
+		netdev_tx_err ( netdev, oldest, -ENOBUFS );
+	}
+
+	/* Queue packet */
+	list_add_tail ( &iobuf->list, &neighbour->tx_queue );
+	neighbour->tx_count++;
+
+	return 0;
+
+ err_create:
+	netdev_tx_err ( netdev, iobuf, rc );
+	return rc;
+}
+
+/**
+ * Update existing neighbour cache entry
+ *
+ * @v netdev		Network device, or NULL to match any device
+ * @v net_protocol	Network-layer protocol
+ * @v net_dest		Network-layer address
+ * @v ll_dest		Link-layer address
+ * @ret rc		Return status code
+ *
+ * Returns -ENOENT if there is no existing entry for this address.
+ */
+int neighbour_update ( struct net_device *netdev,
+		       struct net_protocol *net_protocol,
+		       const void *net_dest, const void *ll_dest ) {
+	struct neighbour *neighbour;
+
+	neighbour = neighbour_find ( netdev, net_protocol, net_dest );
+	if ( ! neighbour )
+		return -ENOENT;
+	neighbour_resolved ( neighbour, ll_dest );
+	return 0;
+}
+
+/**
+ * Define neighbour cache entry
+ *
+ * @v netdev		Network device
+ * @v net_protocol	Network-layer protocol
+ * @v net_dest		Network-layer address
+ * @v ll_dest		Link-layer address
+ * @ret rc		Return status code
+ *
+ * The entry will be created if it does not already exist.
+ */
+int neighbour_define ( struct net_device *netdev,
+		       struct net_protocol *net_protocol,
+		       const void *net_dest, const void *ll_dest ) {
+	struct neighbour *neighbour;
+
+	neighbour = neighbour_find ( netdev, net_protocol, net_dest );
+	if ( ! neighbour ) {
+		neighbour = neighbour_create ( netdev, net_protocol, net_dest );
+		if ( ! neighbour )
+			return -ENOMEM;
+	}
+	neighbour_resolved ( neighbour, ll_dest );
+	return 0;
+}
+
+/**
+ * Destroy all neighbour cache entries for a network device
+ *
+ * @v netdev		Network device
+ * @v rc		Reason for destruction
+ */
+static void neighbour_flush ( struct net_device *netdev, int rc ) {
+	struct neighbour *neighbour;
+	struct neighbour *tmp;
+
+	list_for_each_entry_safe ( neighbour, tmp, &neighbours, list ) {
+		if ( neighbour->netdev == netdev )
+			neighbour_destroy ( neighbour, rc );
+	}
+}
+
+/**
+ * Probe device for neighbour cache
+ *
+ * @v netdev		Network device
+ * @ret rc		Return status code
+ */
+static int neighbour_probe ( struct net_device *netdev __unused ) {
+	return 0;
+}
+
+/**
+ * Handle device or link state change for neighbour cache
+ *
+ * @v netdev		Network device
+ */
+static void neighbour_notify ( struct net_device *netdev ) {
+
+	/* Discard all entries for a closed device */
+	if ( ! netdev_is_open ( netdev ) )
+		neighbour_flush ( netdev, -ENODEV );
+}
+
+/**
+ * Remove device from neighbour cache
+ *
+ * @v netdev		Network device
+ */
+static void neighbour_remove ( struct net_device *netdev ) {
+	neighbour_flush ( netdev, -ENODEV );
+}
+
+/** Neighbour cache driver */
+struct net_driver neighbour_driver __net_driver = {
+	.name = "Neighbour",
+	.probe = neighbour_probe,
+	.notify = neighbour_notify,
+	.remove = neighbour_remove,
+};
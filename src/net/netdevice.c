@@ -165,6 +165,8 @@ int netdev_tx ( struct net_device *netdev, struct io_buffer *iobuf ) {
 
 	DBGC2 ( netdev, "NETDEV %s transmitting %p (%p+%zx)\n",
 		netdev->name, iobuf, iobuf->data, iob_len ( iobuf ) );
+	assert ( ( netdev->features & NETDEV_TX_CSUM ) ||
+		 ! ( iobuf->flags & IOB_FL_CSUM_PARTIAL ) );
 
 	/* Enqueue packet */
 	list_add_tail ( &iobuf->list, &netdev->tx_queue );
@@ -291,6 +293,12 @@ void netdev_rx ( struct net_device *netdev, struct io_buffer *iobuf ) {
 		return;
 	}
 
+	/* Ignore checksum validation from devices not claiming to
+	 * support it.
+	 */
+	if ( ! ( netdev->features & NETDEV_RX_CSUM ) )
+		iobuf->flags &= ~IOB_FL_CSUM_VALID;
+
 	/* Enqueue packet */
 	list_add_tail ( &iobuf->list, &netdev->rx_queue );
 
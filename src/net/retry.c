@@ -32,15 +32,16 @@ FILE_LICENCE ( GPL2_OR_LATER );
  * A retry timer is a binary exponential backoff timer.  It can be
  * used to build automatic retransmission into network protocols.
  *
- * This implementation of the timer is designed to satisfy RFC 2988
+ * This implementation of the timer is designed to satisfy RFC 6298
  * and therefore be usable as a TCP retransmission timer.
  *
  * 
  */
 
-/* The theoretical minimum that the algorithm in stop_timer() can
- * adjust the timeout back down to is seven ticks, so set the minimum
- * timeout to at least that value for the sake of consistency.
+/* The round-trip time estimator in timer_rtt_sample() can adjust the
+ * timeout down to a single tick, which is too close to the timer
+ * granularity to be useful.  Set an absolute minimum timeout of seven
+ * ticks.
  */
 #define MIN_TIMEOUT 7
 
@@ -92,56 +93,131 @@ void start_timer_fixed ( struct retry_timer *timer, unsigned long timeout ) {
 }
 
 /**
- * Stop timer
+ * Update timer with a round-trip time sample
  *
  * @v timer		Retry timer
+ * @v rtt		Round-trip time sample (in ticks)
  *
- * This stops the timer and updates the timer's timeout value.
+ * This updates the smoothed round-trip time and round-trip time
+ * variation as per RFC 6298 section 2, and recalculates the timeout
+ * value from them.  The caller is responsible for ensuring that the
+ * sample does not relate to a retransmitted packet (Karn's
+ * algorithm).
  */
-void stop_timer ( struct retry_timer *timer ) {
+void timer_rtt_sample ( struct retry_timer *timer, unsigned long rtt ) {
 	unsigned long old_timeout = timer->timeout;
+	long delta;
+
+	/* Update estimators.  Variables are:
+	 *
+	 *   R  = round-trip time sample (i.e. rtt)
+	 *   S  = smoothed round-trip time (i.e. timer->srtt / 8)
+	 *   V  = round-trip time variation (i.e. timer->rttvar / 4)
+	 *
+	 * On the first sample, S := R and V := R / 2.  Thereafter
+	 *
+	 *   V := ( 3 V / 4 ) + ( | S - R | / 4 )
+	 *   S := ( 7 S / 8 ) + ( R / 8 )
+	 *
+	 * Keeping S and V in scaled form allows these to be
+	 * calculated without loss of precision using only additions
+	 * and shifts.
+	 */
+	if ( ( timer->srtt == 0 ) && ( timer->rttvar == 0 ) ) {
+		timer->srtt = ( rtt << 3 );
+		timer->rttvar = ( rtt << 1 );
+	} else {
+		delta = ( rtt - ( timer->srtt >> 3 ) );
+		timer->srtt += delta;
+		if ( delta < 0 )
+			delta = -delta;
+		delta -= ( timer->rttvar >> 2 );
+		timer->rttvar += delta;
+	}
+
+	/* Calculate timeout as T := S + max ( G, 4 V ), where G is
+	 * the clock granularity (i.e. one tick).
+	 */
+	timer->timeout = ( ( timer->srtt >> 3 ) +
+			   ( timer->rttvar ? timer->rttvar : 1 ) );
+	if ( timer->timeout != old_timeout ) {
+		DBG ( "Timer %p timeout updated to %ld (srtt %ld/8 rttvar "
+		      "%ld/4)\n", timer, timer->timeout, timer->srtt,
+		      timer->rttvar );
+	}
+}
+
+/**
+ * Remove running timer from list of running timers
+ *
+ * @v timer		Retry timer
+ * @ret runtime		Time for which timer was running (in ticks)
+ *
+ * The caller must drop the timer's reference.
+ */
+static unsigned long timer_halt ( struct retry_timer *timer ) {
 	unsigned long now = currticks();
 	unsigned long runtime;
 
-	/* If timer was already stopped, do nothing */
-	if ( ! timer->running )
-		return;
-
 	list_del ( &timer->list );
 	runtime = ( now - timer->start );
 	timer->running = 0;
 	DBG2 ( "Timer %p stopped at time %ld (ran for %ld)\n",
 	       timer, now, runtime );
 
-	/* Update timer.  Variables are:
-	 *
-	 *   r = round-trip time estimate (i.e. runtime)
-	 *   t = timeout value (i.e. timer->timeout)
-	 *   s = smoothed round-trip time
-	 *
-	 * By choice, we set t = 4s, i.e. allow for four times the
-	 * normal round-trip time to pass before retransmitting.
-	 *
-	 * We want to smooth according to s := ( 7 s + r ) / 8
-	 *
-	 * Since we don't actually store s, this reduces to
-	 * t := ( 7 t / 8 ) + ( r / 2 )
-	 *
+	return runtime;
+}
+
+/**
+ * Stop timer
+ *
+ * @v timer		Retry timer
+ *
+ * This stops the timer and updates the timer's timeout value, using
+ * the time for which the timer was running as a round-trip time
+ * sample.
+ */
+void stop_timer ( struct retry_timer *timer ) {
+	unsigned long runtime;
+
+	/* If timer was already stopped, do nothing */
+	if ( ! timer->running )
+		return;
+
+	runtime = timer_halt ( timer );
+
+	/* Update timer, ignoring samples for any packets that have
+	 * been retransmitted.
 	 */
 	if ( timer->count ) {
 		timer->count--;
 	} else {
-		timer->timeout -= ( timer->timeout >> 3 );
-		timer->timeout += ( runtime >> 1 );
-		if ( timer->timeout != old_timeout ) {
-			DBG ( "Timer %p timeout updated to %ld\n",
-			      timer, timer->timeout );
-		}
+		timer_rtt_sample ( timer, runtime );
 	}
 
 	ref_put ( timer->refcnt );
 }
 
+/**
+ * Stop timer without updating timeout
+ *
+ * @v timer		Retry timer
+ *
+ * This stops the timer without treating the time for which it was
+ * running as a round-trip time sample.  It may be used by protocols
+ * that obtain their own round-trip time samples, which should be
+ * passed to timer_rtt_sample().
+ */
+void stop_timer_nosample ( struct retry_timer *timer ) {
+
+	/* If timer was already stopped, do nothing */
+	if ( ! timer->running )
+		return;
+
+	timer_halt ( timer );
+	ref_put ( timer->refcnt );
+}
+
 /**
  * Handle expired timer
  *
@@ -12,6 +12,7 @@
 #include <ipxe/xfer.h>
 #include <ipxe/open.h>
 #include <ipxe/uri.h>
+#include <ipxe/in.h>
 #include <ipxe/netdevice.h>
 #include <ipxe/tcpip.h>
 #include <ipxe/tcp.h>
@@ -64,6 +65,18 @@ struct tcp_connection {
 	 * Equivalent to SND.WND in RFC 793 terminology
 	 */
 	uint32_t snd_win;
+	/** Send window scale
+	 *
+	 * Equivalent to Snd.Wind.Scale in RFC 1323 terminology
+	 */
+	uint8_t snd_win_scale;
+	/** Sender maximum segment size
+	 *
+	 * Equivalent to SMSS in RFC 5681 terminology.  Initially
+	 * derived from the peer's MSS option and the MTU of the
+	 * route to the peer, and reduced by path MTU discovery.
+	 */
+	size_t mss;
 	/** Current acknowledgement number
 	 *
 	 * Equivalent to RCV.NXT in RFC 793 terminology.
@@ -74,6 +87,11 @@ struct tcp_connection {
 	 * Equivalent to RCV.WND in RFC 793 terminology.
 	 */
 	uint32_t rcv_win;
+	/** Receive window scale
+	 *
+	 * Equivalent to Rcv.Wind.Scale in RFC 1323 terminology
+	 */
+	uint8_t rcv_win_scale;
 	/** Received timestamp value
 	 *
 	 * Updated when a packet is received; copied to ts_recent when
@@ -85,6 +103,51 @@ struct tcp_connection {
 	 * Equivalent to TS.Recent in RFC 1323 terminology.
 	 */
 	uint32_t ts_recent;
+	/** Received timestamp echo reply
+	 *
+	 * Updated when a packet is received; zero if the packet did
+	 * not contain a timestamp option.
+	 */
+	uint32_t ts_ecr;
+	/** Round-trip time measurement start time (in ticks)
+	 *
+	 * Used only if timestamps are not enabled.
+	 */
+	unsigned long rtt_start;
+	/** Round-trip time measurement sequence number
+	 *
+	 * The acknowledgement number that will complete the current
+	 * round-trip time measurement.
+	 */
+	uint32_t rtt_seq;
+	/** Most recently received out-of-order SEQ value
+	 *
+	 * Used to choose the first block to report in a SACK option,
+	 * as per RFC 2018 section 4.
+	 */
+	uint32_t sack_seq;
+
+	/** Congestion window
+	 *
+	 * Equivalent to cwnd in RFC 5681 terminology.
+	 */
+	uint32_t cwnd;
+	/** Slow start threshold
+	 *
+	 * Equivalent to ssthresh in RFC 5681 terminology.
+	 */
+	uint32_t ssthresh;
+	/** Number of consecutive duplicate ACKs received */
+	unsigned int dupacks;
+	/** Recovery point
+	 *
+	 * Equivalent to "recover" in RFC 6582 terminology, i.e. the
+	 * highest sequence number transmitted at the time that loss
+	 * recovery was started.
+	 */
+	uint32_t recover;
+	/** Connection statistics */
+	struct tcp_statistics stats;
 
 	/** Transmit queue */
 	struct list_head tx_queue;
@@ -104,6 +167,14 @@ enum tcp_flags {
 	TCP_TS_ENABLED = 0x0002,
 	/** TCP acknowledgement is pending */
 	TCP_ACK_PENDING = 0x0004,
+	/** TCP is in fast recovery following a fast retransmission */
+	TCP_FAST_RECOVERY = 0x0008,
+	/** TCP is recovering from a retransmission timeout */
+	TCP_LOSS_RECOVERY = 0x0010,
+	/** TCP selective acknowledgements are enabled */
+	TCP_SACK_ENABLED = 0x0020,
+	/** TCP round-trip time measurement is in progress */
+	TCP_RTT_TIMING = 0x0040,
 };
 
 /** TCP internal header
@@ -134,12 +205,15 @@ struct tcp_rx_queued_header {
  */
 static LIST_HEAD ( tcp_conns );
 
+/** TCP statistics accumulated over all connections */
+struct tcp_statistics tcp_stats;
+
 /* Forward declarations */
 static struct interface_descriptor tcp_xfer_desc;
 static void tcp_expired ( struct retry_timer *timer, int over );
 static void tcp_wait_expired ( struct retry_timer *timer, int over );
 static int tcp_rx_ack ( struct tcp_connection *tcp, uint32_t ack,
-			uint32_t win );
+			uint32_t win, uint32_t seq_len );
 
 /**
  * Name TCP state
@@ -249,6 +323,23 @@ static int tcp_bind ( struct tcp_connection *tcp, unsigned int port ) {
 	return 0;
 }
 
+/**
+ * Calculate initial congestion window
+ *
+ * @v mss		Sender maximum segment size
+ * @ret cwnd		Initial congestion window
+ *
+ * As per RFC 5681 section 3.1.
+ */
+static uint32_t tcp_initial_cwnd ( size_t mss ) {
+
+	if ( mss > 2190 )
+		return ( 2 * mss );
+	if ( mss > 1095 )
+		return ( 3 * mss );
+	return ( 4 * mss );
+}
+
 /**
  * Open a TCP connection
  *
@@ -278,6 +369,10 @@ static int tcp_open ( struct interface *xfer, struct sockaddr *peer,
 	tcp->tcp_state = TCP_STATE_SENT ( TCP_SYN );
 	tcp_dump_state ( tcp );
 	tcp->snd_seq = random();
+	tcp->mss = TCP_DEFAULT_MSS;
+	tcp->cwnd = tcp_initial_cwnd ( tcp->mss );
+	tcp->ssthresh = TCP_MAX_SEND_WINDOW_SIZE;
+	tcp->recover = tcp->snd_seq;
 	INIT_LIST_HEAD ( &tcp->tx_queue );
 	INIT_LIST_HEAD ( &tcp->rx_queue );
 	memcpy ( &tcp->peer, st_peer, sizeof ( tcp->peer ) );
@@ -345,6 +440,10 @@ static void tcp_close ( struct tcp_connection *tcp, int rc ) {
 		stop_timer ( &tcp->timer );
 		list_del ( &tcp->list );
 		ref_put ( &tcp->refcnt );
+		DBGC ( tcp, "TCP %p retransmitted %d segments (%d fast, %d "
+		       "timeouts), received %d duplicate ACKs, final cwnd %d\n",
+		       tcp, tcp->stats.retransmits, tcp->stats.fast_retransmits,
+		       tcp->stats.timeouts, tcp->stats.dupacks, tcp->cwnd );
 		DBGC ( tcp, "TCP %p connection deleted\n", tcp );
 		return;
 	}
@@ -354,7 +453,7 @@ static void tcp_close ( struct tcp_connection *tcp, int rc ) {
 	 * can send a FIN without breaking things.
 	 */
 	if ( ! ( tcp->tcp_state & TCP_STATE_ACKED ( TCP_SYN ) ) )
-		tcp_rx_ack ( tcp, ( tcp->snd_seq + 1 ), 0 );
+		tcp_rx_ack ( tcp, ( tcp->snd_seq + 1 ), 0, 0 );
 
 	/* If we have no data remaining to send, start sending FIN */
 	if ( list_empty ( &tcp->tx_queue ) ) {
@@ -374,7 +473,10 @@ static void tcp_close ( struct tcp_connection *tcp, int rc ) {
  * Calculate transmission window
  *
  * @v tcp		TCP connection
- * @ret len		Maximum length that can be sent in a single packet
+ * @ret len		Maximum length of data that may be outstanding
+ *
+ * This is the total amount of data (sent but unacknowledged, or not
+ * yet sent) that may be in flight at any one time.
  */
 static size_t tcp_xmit_win ( struct tcp_connection *tcp ) {
 	size_t len;
@@ -383,61 +485,103 @@ static size_t tcp_xmit_win ( struct tcp_connection *tcp ) {
 	if ( ! TCP_CAN_SEND_DATA ( tcp->tcp_state ) )
 		return 0;
 
-	/* Length is the minimum of the receiver's window and the path MTU */
+	/* Length is the minimum of the receiver's window and our own
+	 * maximum send window.
+	 */
 	len = tcp->snd_win;
-	if ( len > TCP_PATH_MTU )
-		len = TCP_PATH_MTU;
+	if ( len > TCP_MAX_SEND_WINDOW_SIZE )
+		len = TCP_MAX_SEND_WINDOW_SIZE;
 
 	return len;
 }
 
 /**
- * Check data-transfer flow control window
+ * Calculate advertised maximum segment size
  *
  * @v tcp		TCP connection
- * @ret len		Length of window
+ * @ret mss		Maximum segment size
+ *
+ * The MSS is derived from the maximum transmission unit of the
+ * route to the peer, so that jumbo frames may be used where
+ * available.
  */
-static size_t tcp_xfer_window ( struct tcp_connection *tcp ) {
-
-	/* Not ready if data queue is non-empty.  This imposes a limit
-	 * of only one unACKed packet in the TX queue at any time; we
-	 * do this to conserve memory usage.
-	 */
-	if ( ! list_empty ( &tcp->tx_queue ) )
-		return 0;
+static size_t tcp_advertised_mss ( struct tcp_connection *tcp ) {
+	size_t mtu;
+
+	mtu = tcpip_mtu ( &tcp->peer );
+	if ( ! mtu )
+		return TCP_MSS;
+	if ( mtu <= ( sizeof ( struct tcp_header ) + TCP_DEFAULT_MSS ) )
+		return TCP_DEFAULT_MSS;
+	return ( mtu - sizeof ( struct tcp_header ) );
+}
 
-	/* Return TCP window length */
-	return tcp_xmit_win ( tcp );
+/**
+ * Calculate maximum segment data length
+ *
+ * @v tcp		TCP connection
+ * @ret len		Maximum length of data in a single segment
+ *
+ * The sender maximum segment size excludes TCP options, so we must
+ * allow for any options that we will be sending, as per RFC 6691.
+ */
+static size_t tcp_xmit_mss ( struct tcp_connection *tcp ) {
+	size_t overhead = 0;
+
+	if ( tcp->flags & TCP_TS_ENABLED )
+		overhead += sizeof ( struct tcp_timestamp_padded_option );
+	if ( ( tcp->flags & TCP_SACK_ENABLED ) &&
+	     ( ! list_empty ( &tcp->rx_queue ) ) ) {
+		overhead += ( sizeof ( struct tcp_sack_padded_option ) +
+			      ( TCP_SACK_MAX *
+				sizeof ( struct tcp_sack_block ) ) );
+	}
+	return ( tcp->mss - overhead );
 }
 
 /**
  * Process TCP transmit queue
  *
  * @v tcp		TCP connection
+ * @v offset		Offset within transmit queue at which to start
  * @v max_len		Maximum length to process
  * @v dest		I/O buffer to fill with data, or NULL
  * @v remove		Remove data from queue
  * @ret len		Length of data processed
  *
  * This processes at most @c max_len bytes from the TCP connection's
- * transmit queue.  Data will be copied into the @c dest I/O buffer
- * (if provided) and, if @c remove is true, removed from the transmit
- * queue.
+ * transmit queue, starting @c offset bytes into the queue.  Data will
+ * be copied into the @c dest I/O buffer (if provided) and, if @c
+ * remove is true, removed from the transmit queue.  Data may be
+ * removed only from the start of the queue (i.e. @c offset must be
+ * zero if @c remove is true).
  */
-static size_t tcp_process_tx_queue ( struct tcp_connection *tcp, size_t max_len,
-				     struct io_buffer *dest, int remove ) {
+static size_t tcp_process_tx_queue ( struct tcp_connection *tcp, size_t offset,
+				     size_t max_len, struct io_buffer *dest,
+				     int remove ) {
 	struct io_buffer *iobuf;
 	struct io_buffer *tmp;
 	size_t frag_len;
 	size_t len = 0;
 
+	assert ( ! ( remove && offset ) );
+
 	list_for_each_entry_safe ( iobuf, tmp, &tcp->tx_queue, list ) {
 		frag_len = iob_len ( iobuf );
+		/* Skip data already processed, but never skip an
+		 * empty I/O buffer at the start of the region, so
+		 * that it can still be removed from the queue.
+		 */
+		if ( offset && ( offset >= frag_len ) ) {
+			offset -= frag_len;
+			continue;
+		}
+		frag_len -= offset;
 		if ( frag_len > max_len )
 			frag_len = max_len;
 		if ( dest ) {
-			memcpy ( iob_put ( dest, frag_len ), iobuf->data,
-				 frag_len );
+			memcpy ( iob_put ( dest, frag_len ),
+				 ( iobuf->data + offset ), frag_len );
 		}
 		if ( remove ) {
 			iob_pull ( iobuf, frag_len );
@@ -446,6 +590,7 @@ static size_t tcp_process_tx_queue ( struct tcp_connection *tcp, size_t max_len,
 				free_iob ( iobuf );
 			}
 		}
+		offset = 0;
 		len += frag_len;
 		max_len -= frag_len;
 	}
@@ -453,81 +598,181 @@ static size_t tcp_process_tx_queue ( struct tcp_connection *tcp, size_t max_len,
 }
 
 /**
- * Transmit any outstanding data
+ * Check data-transfer flow control window
  *
  * @v tcp		TCP connection
- * 
- * Transmits any outstanding data on the connection.
+ * @ret len		Length of window
+ */
+static size_t tcp_xfer_window ( struct tcp_connection *tcp ) {
+	size_t win;
+	size_t queued;
+
+	/* Calculate space remaining in the transmission window.  Any
+	 * data already in the transmit queue (whether sent or
+	 * unsent) occupies part of the window; bounding the amount
+	 * of queued data in this way limits our memory usage.
+	 */
+	win = tcp_xmit_win ( tcp );
+	queued = tcp_process_tx_queue ( tcp, 0, win, NULL, 0 );
+	return ( win - queued );
+}
+
+/**
+ * Add block to SACK block list
  *
- * Note that even if an error is returned, the retransmission timer
- * will have been started if necessary, and so the stack will
- * eventually attempt to retransmit the failed packet.
+ * @v tcp		TCP connection
+ * @v blocks		SACK block list
+ * @v count		Number of blocks in list
+ * @v left		Left edge of new block
+ * @v right		Right edge of new block
+ * @ret count		Updated number of blocks in list
+ *
+ * The block containing the most recently received out-of-order
+ * segment is always reported first, as required by RFC 2018.  Other
+ * blocks are reported in order of increasing sequence number, for as
+ * long as space remains.
  */
-static int tcp_xmit ( struct tcp_connection *tcp ) {
+static unsigned int tcp_sack_add ( struct tcp_connection *tcp,
+				   struct tcp_sack_block *blocks,
+				   unsigned int count, uint32_t left,
+				   uint32_t right ) {
+	unsigned int i;
+
+	if ( tcp_in_window ( tcp->sack_seq, left, ( right - left ) ) ) {
+		/* Insert at start of list, discarding last block if
+		 * the list is already full.
+		 */
+		if ( count == TCP_SACK_MAX )
+			count--;
+		for ( i = count ; i > 0 ; i-- )
+			blocks[i] = blocks[ i - 1 ];
+		i = 0;
+	} else {
+		/* Append to list, if space remains */
+		if ( count == TCP_SACK_MAX )
+			return count;
+		i = count;
+	}
+	blocks[i].left = htonl ( left );
+	blocks[i].right = htonl ( right );
+	return ( count + 1 );
+}
+
+/**
+ * Construct SACK blocks describing receive queue
+ *
+ * @v tcp		TCP connection
+ * @v blocks		SACK block list to fill in
+ * @ret count		Number of blocks in list
+ *
+ * The receive queue holds only data lying beyond the first gap in the
+ * received sequence space, in order of increasing sequence number.
+ * Adjacent and overlapping packets are coalesced into single blocks.
+ */
+static unsigned int tcp_sack ( struct tcp_connection *tcp,
+			       struct tcp_sack_block *blocks ) {
+	struct io_buffer *iobuf;
+	struct tcp_rx_queued_header *tcpqhdr;
+	uint32_t left = 0;
+	uint32_t right = 0;
+	uint32_t start;
+	uint32_t end;
+	unsigned int count = 0;
+	int have_block = 0;
+
+	list_for_each_entry ( iobuf, &tcp->rx_queue, list ) {
+		tcpqhdr = iobuf->data;
+		start = tcpqhdr->seq;
+		end = ( start + iob_len ( iobuf ) - sizeof ( *tcpqhdr ) +
+			( ( tcpqhdr->flags & TCP_FIN ) ? 1 : 0 ) );
+		if ( have_block && ( tcp_cmp ( start, right ) <= 0 ) ) {
+			/* Extend current block */
+			if ( tcp_cmp ( end, right ) > 0 )
+				right = end;
+			continue;
+		}
+		if ( have_block )
+			count = tcp_sack_add ( tcp, blocks, count, left, right );
+		left = start;
+		right = end;
+		have_block = 1;
+	}
+	if ( have_block )
+		count = tcp_sack_add ( tcp, blocks, count, left, right );
+
+	return count;
+}
+
+/**
+ * Transmit a single segment
+ *
+ * @v tcp		TCP connection
+ * @v offset		Offset of segment from start of unacknowledged data
+ * @v len		Length of data payload
+ * @v flags		TCP flags
+ * @ret rc		Return status code
+ *
+ * The payload is taken from the transmit queue, starting at @c
+ * offset.  SYN and FIN are never sent together with data, so the
+ * offset within the transmit queue is the same as the offset within
+ * the sequence space.
+ */
+static int tcp_xmit_segment ( struct tcp_connection *tcp, uint32_t offset,
+			      size_t len, unsigned int flags ) {
 	struct io_buffer *iobuf;
 	struct tcp_header *tcphdr;
 	struct tcp_mss_option *mssopt;
+	struct tcp_window_scale_padded_option *wsopt;
+	struct tcp_sack_permitted_padded_option *spopt;
 	struct tcp_timestamp_padded_option *tsopt;
+	struct tcp_sack_padded_option *sackopt;
+	struct tcp_sack_block blocks[TCP_SACK_MAX];
+	unsigned int sack_count;
+	size_t sack_len;
 	void *payload;
-	unsigned int flags;
-	size_t len = 0;
+	uint32_t seq = ( tcp->snd_seq + offset );
 	uint32_t seq_len;
 	uint32_t app_win;
 	uint32_t max_rcv_win;
+	uint32_t max_representable_win;
 	int rc;
 
-	/* If retransmission timer is already running, do nothing */
-	if ( timer_running ( &tcp->timer ) )
-		return 0;
-
-	/* Calculate both the actual (payload) and sequence space
-	 * lengths that we wish to transmit.
-	 */
-	if ( TCP_CAN_SEND_DATA ( tcp->tcp_state ) ) {
-		len = tcp_process_tx_queue ( tcp, tcp_xmit_win ( tcp ),
-					     NULL, 0 );
-	}
+	/* Calculate sequence space length */
 	seq_len = len;
-	flags = TCP_FLAGS_SENDING ( tcp->tcp_state );
 	if ( flags & ( TCP_SYN | TCP_FIN ) ) {
 		/* SYN or FIN consume one byte, and we can never send both */
 		assert ( ! ( ( flags & TCP_SYN ) && ( flags & TCP_FIN ) ) );
+		assert ( len == 0 );
 		seq_len++;
 	}
-	tcp->snd_sent = seq_len;
-
-	/* If we have nothing to transmit, stop now */
-	if ( ( seq_len == 0 ) && ! ( tcp->flags & TCP_ACK_PENDING ) )
-		return 0;
-
-	/* If we are transmitting anything that requires
-	 * acknowledgement (i.e. consumes sequence space), start the
-	 * retransmission timer.  Do this before attempting to
-	 * allocate the I/O buffer, in case allocation itself fails.
-	 */
-	if ( seq_len )
-		start_timer ( &tcp->timer );
 
 	/* Allocate I/O buffer */
 	iobuf = alloc_iob ( len + TCP_MAX_HEADER_LEN );
 	if ( ! iobuf ) {
 		DBGC ( tcp, "TCP %p could not allocate iobuf for %08x..%08x "
-		       "%08x\n", tcp, tcp->snd_seq, ( tcp->snd_seq + seq_len ),
-		       tcp->rcv_ack );
+		       "%08x\n", tcp, seq, ( seq + seq_len ), tcp->rcv_ack );
 		return -ENOMEM;
 	}
 	iob_reserve ( iobuf, TCP_MAX_HEADER_LEN );
 
 	/* Fill data payload from transmit queue */
-	tcp_process_tx_queue ( tcp, len, iobuf, 0 );
+	tcp_process_tx_queue ( tcp, offset, len, iobuf, 0 );
 
-	/* Expand receive window if possible */
+	/* Expand receive window if possible.  The window is limited
+	 * by the amount of free memory available for holding received
+	 * packets, by the application's own window, and by the
+	 * largest value that can be represented using the negotiated
+	 * window scale.
+	 */
 	max_rcv_win = ( ( freemem * 3 ) / 4 );
 	if ( max_rcv_win > TCP_MAX_WINDOW_SIZE )
 		max_rcv_win = TCP_MAX_WINDOW_SIZE;
 	app_win = xfer_window ( &tcp->xfer );
 	if ( max_rcv_win > app_win )
 		max_rcv_win = app_win;
+	max_representable_win = ( 0xffff << tcp->rcv_win_scale );
+	if ( max_rcv_win > max_representable_win )
+		max_rcv_win = max_representable_win;
 	max_rcv_win &= ~0x03; /* Keep everything dword-aligned */
 	if ( tcp->rcv_win < max_rcv_win )
 		tcp->rcv_win = max_rcv_win;
@@ -538,7 +783,16 @@ static int tcp_xmit ( struct tcp_connection *tcp ) {
 		mssopt = iob_push ( iobuf, sizeof ( *mssopt ) );
 		mssopt->kind = TCP_OPTION_MSS;
 		mssopt->length = sizeof ( *mssopt );
-		mssopt->mss = htons ( TCP_MSS );
+		mssopt->mss = htons ( tcp_advertised_mss ( tcp ) );
+		wsopt = iob_push ( iobuf, sizeof ( *wsopt ) );
+		wsopt->nop[0] = TCP_OPTION_NOP;
+		wsopt->wsopt.kind = TCP_OPTION_WS;
+		wsopt->wsopt.length = sizeof ( wsopt->wsopt );
+		wsopt->wsopt.scale = TCP_RX_WINDOW_SCALE;
+		spopt = iob_push ( iobuf, sizeof ( *spopt ) );
+		memset ( spopt->nop, TCP_OPTION_NOP, sizeof ( spopt->nop ) );
+		spopt->spopt.kind = TCP_OPTION_SACK_PERMITTED;
+		spopt->spopt.length = sizeof ( spopt->spopt );
 	}
 	if ( ( flags & TCP_SYN ) || ( tcp->flags & TCP_TS_ENABLED ) ) {
 		tsopt = iob_push ( iobuf, sizeof ( *tsopt ) );
@@ -548,18 +802,36 @@ static int tcp_xmit ( struct tcp_connection *tcp ) {
 		tsopt->tsopt.tsval = htonl ( currticks() );
 		tsopt->tsopt.tsecr = htonl ( tcp->ts_recent );
 	}
+	if ( ( tcp->flags & TCP_SACK_ENABLED ) &&
+	     ( ! list_empty ( &tcp->rx_queue ) ) &&
+	     ( ! ( flags & TCP_SYN ) ) ) {
+		sack_count = tcp_sack ( tcp, blocks );
+		sack_len = ( sack_count * sizeof ( blocks[0] ) );
+		memcpy ( iob_push ( iobuf, sack_len ), blocks, sack_len );
+		sackopt = iob_push ( iobuf, sizeof ( *sackopt ) );
+		memset ( sackopt->nop, TCP_OPTION_NOP, sizeof ( sackopt->nop ) );
+		sackopt->sackopt.kind = TCP_OPTION_SACK;
+		sackopt->sackopt.length =
+			( sizeof ( sackopt->sackopt ) + sack_len );
+	}
 	if ( len != 0 )
 		flags |= TCP_PSH;
 	tcphdr = iob_push ( iobuf, sizeof ( *tcphdr ) );
 	memset ( tcphdr, 0, sizeof ( *tcphdr ) );
 	tcphdr->src = htons ( tcp->local_port );
 	tcphdr->dest = tcp->peer.st_port;
-	tcphdr->seq = htonl ( tcp->snd_seq );
+	tcphdr->seq = htonl ( seq );
 	tcphdr->ack = htonl ( tcp->rcv_ack );
 	tcphdr->hlen = ( ( payload - iobuf->data ) << 2 );
 	tcphdr->flags = flags;
-	tcphdr->win = htons ( tcp->rcv_win );
-	tcphdr->csum = tcpip_chksum ( iobuf->data, iob_len ( iobuf ) );
+	tcphdr->win = htons ( tcp->rcv_win >> tcp->rcv_win_scale );
+
+	/* Defer checksum calculation to the network layer, which
+	 * will offload it to the hardware if possible.
+	 */
+	iobuf->flags |= IOB_FL_CSUM_PARTIAL;
+	iobuf->csum_start = tcphdr;
+	iobuf->csum_offset = offsetof ( typeof ( *tcphdr ), csum );
 
 	/* Dump header */
 	DBGC2 ( tcp, "TCP %p TX %d->%d %08x..%08x           %08x %4zd",
@@ -573,8 +845,8 @@ static int tcp_xmit ( struct tcp_connection *tcp ) {
 	if ( ( rc = tcpip_tx ( iobuf, &tcp_protocol, NULL, &tcp->peer, NULL,
 			       &tcphdr->csum ) ) != 0 ) {
 		DBGC ( tcp, "TCP %p could not transmit %08x..%08x %08x: %s\n",
-		       tcp, tcp->snd_seq, ( tcp->snd_seq + tcp->snd_sent ),
-		       tcp->rcv_ack, strerror ( rc ) );
+		       tcp, seq, ( seq + seq_len ), tcp->rcv_ack,
+		       strerror ( rc ) );
 		return rc;
 	}
 
@@ -584,6 +856,140 @@ static int tcp_xmit ( struct tcp_connection *tcp ) {
 	return 0;
 }
 
+/**
+ * Transmit any outstanding data
+ *
+ * @v tcp		TCP connection
+ * 
+ * Transmits as many new segments as the transmission window allows,
+ * or a bare ACK if an acknowledgement is pending and there is no new
+ * data to send.
+ *
+ * Note that even if an error is returned, the retransmission timer
+ * will have been started if necessary, and so the stack will
+ * eventually attempt to retransmit the failed packet.
+ */
+static int tcp_xmit ( struct tcp_connection *tcp ) {
+	unsigned int flags;
+	uint32_t offset;
+	size_t win;
+	size_t len;
+	uint32_t seq_len;
+	int rc;
+
+	do {
+		/* Calculate both the actual (payload) and sequence
+		 * space lengths that we wish to transmit, starting
+		 * from the first unsent sequence number.
+		 */
+		offset = tcp->snd_sent;
+		len = 0;
+		win = tcp_xmit_win ( tcp );
+		if ( win > tcp->cwnd )
+			win = tcp->cwnd;
+		if ( win > offset ) {
+			win -= offset;
+			if ( win > tcp_xmit_mss ( tcp ) )
+				win = tcp_xmit_mss ( tcp );
+			len = tcp_process_tx_queue ( tcp, offset, win,
+						     NULL, 0 );
+		}
+		flags = TCP_FLAGS_SENDING ( tcp->tcp_state );
+		if ( offset ) {
+			/* Any SYN or FIN has already been sent */
+			flags &= ~( TCP_SYN | TCP_FIN );
+		}
+		seq_len = len;
+		if ( flags & ( TCP_SYN | TCP_FIN ) )
+			seq_len++;
+
+		/* If we have nothing to transmit, stop now */
+		if ( ( seq_len == 0 ) && ! ( tcp->flags & TCP_ACK_PENDING ) )
+			return 0;
+
+		/* If we are transmitting anything that requires
+		 * acknowledgement (i.e. consumes sequence space),
+		 * record it as sent and start the retransmission
+		 * timer.  Do this before attempting to transmit, in
+		 * case transmission itself fails.
+		 */
+		tcp->snd_sent += seq_len;
+		if ( seq_len && ! timer_running ( &tcp->timer ) )
+			start_timer ( &tcp->timer );
+
+		/* Start a round-trip time measurement if applicable.
+		 * If timestamps are enabled, then every ACK provides
+		 * a measurement.
+		 */
+		if ( seq_len &&
+		     ! ( tcp->flags & ( TCP_TS_ENABLED | TCP_RTT_TIMING ) ) ) {
+			tcp->rtt_start = currticks();
+			tcp->rtt_seq = ( tcp->snd_seq + tcp->snd_sent );
+			tcp->flags |= TCP_RTT_TIMING;
+		}
+
+		/* Transmit segment */
+		if ( ( rc = tcp_xmit_segment ( tcp, offset, len, flags ) ) != 0 )
+			return rc;
+
+	} while ( seq_len );
+
+	return 0;
+}
+
+/**
+ * Retransmit first unacknowledged segment
+ *
+ * @v tcp		TCP connection
+ * @ret rc		Return status code
+ */
+static int tcp_retransmit ( struct tcp_connection *tcp ) {
+	unsigned int flags = TCP_FLAGS_SENDING ( tcp->tcp_state );
+	size_t len = 0;
+
+	/* If nothing has yet been sent (e.g. the initial SYN), then
+	 * just transmit normally.
+	 */
+	if ( ! tcp->snd_sent )
+		return tcp_xmit ( tcp );
+
+	/* Determine length of first unacknowledged segment.  SYN and
+	 * FIN are never sent together with data.
+	 */
+	if ( ! ( flags & ( TCP_SYN | TCP_FIN ) ) ) {
+		len = tcp->snd_sent;
+		if ( len > tcp_xmit_mss ( tcp ) )
+			len = tcp_xmit_mss ( tcp );
+	}
+
+	/* Abandon any round-trip time measurement, since the
+	 * measurement would be ambiguous (Karn's algorithm).
+	 */
+	tcp->flags &= ~TCP_RTT_TIMING;
+
+	/* Restart retransmission timer and retransmit segment */
+	tcp->stats.retransmits++;
+	tcp_stats.retransmits++;
+	start_timer ( &tcp->timer );
+	return tcp_xmit_segment ( tcp, 0, len, flags );
+}
+
+/**
+ * Record loss of a segment for congestion control
+ *
+ * @v tcp		TCP connection
+ *
+ * Reduces the slow start threshold as per RFC 5681 equation (4), and
+ * records the current recovery point.
+ */
+static void tcp_cc_loss ( struct tcp_connection *tcp ) {
+
+	tcp->ssthresh = ( tcp->snd_sent / 2 );
+	if ( tcp->ssthresh < ( 2 * tcp->mss ) )
+		tcp->ssthresh = ( 2 * tcp->mss );
+	tcp->recover = ( tcp->snd_seq + tcp->snd_sent );
+}
+
 /**
  * Retransmission timer expired
  *
@@ -613,8 +1019,22 @@ static void tcp_expired ( struct retry_timer *timer, int over ) {
 		tcp_dump_state ( tcp );
 		tcp_close ( tcp, -ETIMEDOUT );
 	} else {
-		/* Otherwise, retransmit the packet */
-		tcp_xmit ( tcp );
+		/* Otherwise, collapse the congestion window (as per
+		 * RFC 5681 section 3.1) and retransmit the first
+		 * unacknowledged segment
+		 */
+		if ( tcp->snd_sent ) {
+			tcp->stats.timeouts++;
+			tcp_stats.timeouts++;
+			tcp_cc_loss ( tcp );
+			tcp->cwnd = tcp->mss;
+			tcp->dupacks = 0;
+			tcp->flags &= ~TCP_FAST_RECOVERY;
+			tcp->flags |= TCP_LOSS_RECOVERY;
+			DBGC ( tcp, "TCP %p ssthresh %d cwnd %d after timeout\n",
+			       tcp, tcp->ssthresh, tcp->cwnd );
+		}
+		tcp_retransmit ( tcp );
 	}
 }
 
@@ -671,7 +1091,7 @@ static int tcp_xmit_reset ( struct tcp_connection *tcp,
 	tcphdr->ack = in_tcphdr->seq;
 	tcphdr->hlen = ( ( sizeof ( *tcphdr ) / 4 ) << 4 );
 	tcphdr->flags = ( TCP_RST | TCP_ACK );
-	tcphdr->win = htons ( TCP_MAX_WINDOW_SIZE );
+	tcphdr->win = htons ( 0 );
 	tcphdr->csum = tcpip_chksum ( iobuf->data, iob_len ( iobuf ) );
 
 	/* Dump header */
@@ -746,6 +1166,15 @@ static void tcp_rx_opts ( struct tcp_connection *tcp, const void *data,
 		case TCP_OPTION_MSS:
 			options->mssopt = data;
 			break;
+		case TCP_OPTION_WS:
+			options->wsopt = data;
+			break;
+		case TCP_OPTION_SACK_PERMITTED:
+			options->spopt = data;
+			break;
+		case TCP_OPTION_SACK:
+			/* We do not use received SACK blocks */
+			break;
 		case TCP_OPTION_TS:
 			options->tsopt = data;
 			break;
@@ -802,6 +1231,22 @@ static int tcp_rx_syn ( struct tcp_connection *tcp, uint32_t seq,
 		tcp->rcv_ack = seq;
 		if ( options->tsopt )
 			tcp->flags |= TCP_TS_ENABLED;
+		if ( options->spopt )
+			tcp->flags |= TCP_SACK_ENABLED;
+		if ( options->wsopt ) {
+			tcp->snd_win_scale = options->wsopt->scale;
+			if ( tcp->snd_win_scale > TCP_MAX_WINDOW_SCALE )
+				tcp->snd_win_scale = TCP_MAX_WINDOW_SCALE;
+			tcp->rcv_win_scale = TCP_RX_WINDOW_SCALE;
+		}
+		tcp->mss = ( options->mssopt ?
+			     ntohs ( options->mssopt->mss ) : TCP_DEFAULT_MSS );
+		if ( tcp->mss < TCP_MIN_MSS )
+			tcp->mss = TCP_MIN_MSS;
+		if ( tcp->mss > tcp_advertised_mss ( tcp ) )
+			tcp->mss = tcp_advertised_mss ( tcp );
+		tcp->cwnd = tcp_initial_cwnd ( tcp->mss );
+		DBGC ( tcp, "TCP %p using MSS %zd\n", tcp, tcp->mss );
 	}
 
 	/* Ignore duplicate SYN */
@@ -818,16 +1263,143 @@ static int tcp_rx_syn ( struct tcp_connection *tcp, uint32_t seq,
 	return 0;
 }
 
+/**
+ * Handle TCP received duplicate ACK
+ *
+ * @v tcp		TCP connection
+ *
+ * Implements fast retransmit and fast recovery as per RFC 5681
+ * section 3.2, with the NewReno modification described in RFC 6582.
+ */
+static void tcp_rx_dupack ( struct tcp_connection *tcp ) {
+
+	tcp->dupacks++;
+	tcp->stats.dupacks++;
+	tcp_stats.dupacks++;
+
+	if ( tcp->flags & TCP_FAST_RECOVERY ) {
+
+		/* Inflate the congestion window to reflect the
+		 * additional segment that has left the network.
+		 */
+		tcp->cwnd += tcp->mss;
+
+	} else if ( ( tcp->dupacks == TCP_DUPACK_THRESHOLD ) &&
+		    ( ! ( tcp->flags & TCP_LOSS_RECOVERY ) ) &&
+		    ( tcp_cmp ( tcp->snd_seq, tcp->recover ) > 0 ) ) {
+
+		/* Enter fast recovery and retransmit the (presumably)
+		 * lost segment.
+		 */
+		tcp_cc_loss ( tcp );
+		tcp->cwnd = ( tcp->ssthresh +
+			      ( TCP_DUPACK_THRESHOLD * tcp->mss ) );
+		tcp->flags |= TCP_FAST_RECOVERY;
+		tcp->stats.fast_retransmits++;
+		tcp_stats.fast_retransmits++;
+		DBGC ( tcp, "TCP %p fast retransmit of %08x with ssthresh %d "
+		       "cwnd %d\n", tcp, tcp->snd_seq, tcp->ssthresh,
+		       tcp->cwnd );
+		tcp_retransmit ( tcp );
+	}
+}
+
+/**
+ * Update congestion window for newly acknowledged data
+ *
+ * @v tcp		TCP connection
+ * @v len		Length of newly acknowledged data
+ */
+static void tcp_cc_ack ( struct tcp_connection *tcp, size_t len ) {
+	uint32_t incr;
+
+	/* Any new ACK terminates a run of duplicate ACKs */
+	tcp->dupacks = 0;
+
+	/* Handle fast recovery.  A partial acknowledgement indicates
+	 * that the first unacknowledged segment has also been lost.
+	 */
+	if ( tcp->flags & TCP_FAST_RECOVERY ) {
+		if ( tcp_cmp ( tcp->snd_seq, tcp->recover ) >= 0 ) {
+			/* Full acknowledgement: deflate the window */
+			tcp->cwnd = ( tcp->snd_sent + tcp->mss );
+			if ( tcp->cwnd > tcp->ssthresh )
+				tcp->cwnd = tcp->ssthresh;
+			tcp->flags &= ~TCP_FAST_RECOVERY;
+		} else {
+			/* Partial acknowledgement: retransmit, and
+			 * deflate by the amount of data acknowledged
+			 */
+			tcp_retransmit ( tcp );
+			tcp->cwnd -= ( ( len < tcp->cwnd ) ? len : tcp->cwnd );
+			tcp->cwnd += tcp->mss;
+		}
+		return;
+	}
+
+	/* Handle recovery from a retransmission timeout.  Partial
+	 * acknowledgements are treated as in fast recovery, but the
+	 * congestion window continues to grow via slow start.
+	 */
+	if ( tcp->flags & TCP_LOSS_RECOVERY ) {
+		if ( tcp_cmp ( tcp->snd_seq, tcp->recover ) >= 0 ) {
+			tcp->flags &= ~TCP_LOSS_RECOVERY;
+		} else {
+			tcp_retransmit ( tcp );
+		}
+	}
+
+	/* Grow congestion window via slow start or congestion
+	 * avoidance, as per RFC 5681 section 3.1.
+	 */
+	if ( tcp->cwnd < tcp->ssthresh ) {
+		incr = ( ( len < tcp->mss ) ? len : tcp->mss );
+	} else {
+		incr = ( ( tcp->mss * tcp->mss ) / tcp->cwnd );
+		if ( ! incr )
+			incr = 1;
+	}
+	tcp->cwnd += incr;
+	if ( tcp->cwnd > TCP_MAX_SEND_WINDOW_SIZE )
+		tcp->cwnd = TCP_MAX_SEND_WINDOW_SIZE;
+}
+
+/**
+ * Update round-trip time estimate
+ *
+ * @v tcp		TCP connection
+ * @v ack		ACK value (in host-endian order)
+ *
+ * If timestamps are enabled, the echoed timestamp provides an
+ * accurate measurement for every ACK (including ACKs of retransmitted
+ * segments), as per RFC 1323 section 4.  Otherwise, a single segment
+ * at a time is timed, and no measurement is taken if it is
+ * retransmitted.
+ */
+static void tcp_rx_rtt ( struct tcp_connection *tcp, uint32_t ack ) {
+	unsigned long now = currticks();
+
+	if ( ( tcp->flags & TCP_TS_ENABLED ) && tcp->ts_ecr ) {
+		timer_rtt_sample ( &tcp->timer,
+				   ( ( ( uint32_t ) now ) - tcp->ts_ecr ) );
+	} else if ( ( tcp->flags & TCP_RTT_TIMING ) &&
+		    ( tcp_cmp ( ack, tcp->rtt_seq ) >= 0 ) ) {
+		timer_rtt_sample ( &tcp->timer, ( now - tcp->rtt_start ) );
+		tcp->flags &= ~TCP_RTT_TIMING;
+	}
+}
+
 /**
  * Handle TCP received ACK
  *
  * @v tcp		TCP connection
  * @v ack		ACK value (in host-endian order)
  * @v win		WIN value (in host-endian order)
+ * @v seq_len		Sequence space length of received segment
  * @ret rc		Return status code
  */
 static int tcp_rx_ack ( struct tcp_connection *tcp, uint32_t ack,
-			uint32_t win ) {
+			uint32_t win, uint32_t seq_len ) {
 	uint32_t ack_len = ( ack - tcp->snd_seq );
 	size_t len;
 	unsigned int acked_flags;
@@ -857,11 +1429,25 @@ static int tcp_rx_ack ( struct tcp_connection *tcp, uint32_t ack,
 	 * duplicate ACK is received and we still have data in our
 	 * transmit queue.)
 	 */
-	if ( ack_len == 0 )
+	if ( ack_len == 0 ) {
+		/* A segment carrying no data and no window update
+		 * while we have data outstanding is a duplicate ACK
+		 * (as defined in RFC 5681).
+		 */
+		if ( tcp->snd_sent && ( seq_len == 0 ) &&
+		     ( win == tcp->snd_win ) ) {
+			tcp_rx_dupack ( tcp );
+		}
+		/* Accept any window update, though */
+		tcp->snd_win = win;
 		return 0;
+	}
 
-	/* Stop the retransmission timer */
-	stop_timer ( &tcp->timer );
+	/* Stop the retransmission timer and update the round-trip
+	 * time estimate
+	 */
+	stop_timer_nosample ( &tcp->timer );
+	tcp_rx_rtt ( tcp, ack );
 
 	/* Determine acknowledged flags and data length */
 	len = ack_len;
@@ -872,11 +1458,17 @@ static int tcp_rx_ack ( struct tcp_connection *tcp, uint32_t ack,
 
 	/* Update SEQ and sent counters, and window size */
 	tcp->snd_seq = ack;
-	tcp->snd_sent = 0;
+	tcp->snd_sent -= ack_len;
 	tcp->snd_win = win;
 
 	/* Remove any acknowledged data from transmit queue */
-	tcp_process_tx_queue ( tcp, len, NULL, 1 );
+	tcp_process_tx_queue ( tcp, 0, len, NULL, 1 );
+
+	/* Restart the retransmission timer if any data remains
+	 * unacknowledged.
+	 */
+	if ( tcp->snd_sent )
+		start_timer ( &tcp->timer );
 		
 	/* Mark SYN/FIN as acknowledged if applicable. */
 	if ( acked_flags )
@@ -886,6 +1478,9 @@ static int tcp_rx_ack ( struct tcp_connection *tcp, uint32_t ack,
 	if ( list_empty ( &tcp->tx_queue ) && ( tcp->flags & TCP_XFER_CLOSED ) )
 		tcp->tcp_state |= TCP_STATE_SENT ( TCP_FIN );
 
+	/* Update congestion control state */
+	tcp_cc_ack ( tcp, len );
+
 	return 0;
 }
 
@@ -1033,6 +1628,9 @@ static void tcp_rx_enqueue ( struct tcp_connection *tcp, uint32_t seq,
 			break;
 	}
 	list_add_tail ( &iobuf->list, &queued->list );
+
+	/* Record SEQ for use in any subsequent SACK option */
+	tcp->sack_seq = seq;
 }
 
 /**
@@ -1083,12 +1681,14 @@ static void tcp_process_rx_queue ( struct tcp_connection *tcp ) {
  * Process received packet
  *
  * @v iobuf		I/O buffer
+ * @v netdev		Network device
  * @v st_src		Partially-filled source address
  * @v st_dest		Partially-filled destination address
  * @v pshdr_csum	Pseudo-header checksum
  * @ret rc		Return status code
   */
 static int tcp_rx ( struct io_buffer *iobuf,
+		    struct net_device *netdev __unused,
 		    struct sockaddr_tcpip *st_src,
 		    struct sockaddr_tcpip *st_dest __unused,
 		    uint16_t pshdr_csum ) {
@@ -1126,8 +1726,9 @@ static int tcp_rx ( struct io_buffer *iobuf,
 		rc = -EINVAL;
 		goto discard;
 	}
-	csum = tcpip_continue_chksum ( pshdr_csum, iobuf->data,
-				       iob_len ( iobuf ) );
+	csum = ( ( iobuf->flags & IOB_FL_CSUM_VALID ) ? 0 :
+		 tcpip_continue_chksum ( pshdr_csum, iobuf->data,
+					 iob_len ( iobuf ) ) );
 	if ( csum != 0 ) {
 		DBG ( "TCP checksum incorrect (is %04x including checksum "
 		      "field, should be 0000)\n", csum );
@@ -1143,8 +1744,6 @@ static int tcp_rx ( struct io_buffer *iobuf,
 	flags = tcphdr->flags;
 	tcp_rx_opts ( tcp, ( ( ( void * ) tcphdr ) + sizeof ( *tcphdr ) ),
 		      ( hlen - sizeof ( *tcphdr ) ), &options );
-	if ( options.tsopt )
-		tcp->ts_val = ntohl ( options.tsopt->tsval );
 	iob_pull ( iobuf, hlen );
 	len = iob_len ( iobuf );
 	seq_len = ( len + ( ( flags & TCP_SYN ) ? 1 : 0 ) +
@@ -1166,12 +1765,21 @@ static int tcp_rx ( struct io_buffer *iobuf,
 		goto discard;
 	}
 
+	/* Record timestamps, if present */
+	if ( options.tsopt )
+		tcp->ts_val = ntohl ( options.tsopt->tsval );
+	tcp->ts_ecr = ( options.tsopt ? ntohl ( options.tsopt->tsecr ) : 0 );
+
+	/* Scale advertised window (which is never scaled in a SYN) */
+	if ( ! ( flags & TCP_SYN ) )
+		win <<= tcp->snd_win_scale;
+
 	/* Record old data-transfer window */
 	old_xfer_window = tcp_xfer_window ( tcp );
 
 	/* Handle ACK, if present */
 	if ( flags & TCP_ACK ) {
-		if ( ( rc = tcp_rx_ack ( tcp, ack, win ) ) != 0 ) {
+		if ( ( rc = tcp_rx_ack ( tcp, ack, win, seq_len ) ) != 0 ) {
 			tcp_xmit_reset ( tcp, st_src, tcphdr );
 			goto discard;
 		}
@@ -1227,10 +1835,65 @@ static int tcp_rx ( struct io_buffer *iobuf,
 	return rc;
 }
 
+/**
+ * Handle reduction in path MTU
+ *
+ * @v st_src		Source address of original packet
+ * @v st_dest		Destination address of original packet
+ * @v mtu		New maximum transport-layer packet length
+ */
+static void tcp_pmtu ( struct sockaddr_tcpip *st_src,
+		       struct sockaddr_tcpip *st_dest, size_t mtu ) {
+	struct sockaddr_in *sin_peer;
+	struct sockaddr_in *sin_dest;
+	struct tcp_connection *tcp;
+	size_t mss;
+
+	/* Identify connection.  The original packet must have been
+	 * sent to this connection's peer, otherwise a forged or stray
+	 * report could shrink the MSS of an unrelated connection.
+	 */
+	tcp = tcp_demux ( ntohs ( st_src->st_port ) );
+	if ( ( ! tcp ) || ( tcp->peer.st_family != st_dest->st_family ) ||
+	     ( tcp->peer.st_port != st_dest->st_port ) )
+		return;
+	sin_peer = ( ( struct sockaddr_in * ) &tcp->peer );
+	sin_dest = ( ( struct sockaddr_in * ) st_dest );
+	if ( ( st_dest->st_family != AF_INET ) ||
+	     ( sin_peer->sin_addr.s_addr != sin_dest->sin_addr.s_addr ) )
+		return;
+
+	/* Ignore anything that would not reduce the MSS, or that
+	 * would leave no room for data after allowing for options.
+	 */
+	if ( mtu <= ( TCP_MAX_HEADER_LEN - MAX_LL_NET_HEADER_LEN ) )
+		return;
+	mss = ( mtu - sizeof ( struct tcp_header ) );
+	if ( mss >= tcp->mss )
+		return;
+	DBGC ( tcp, "TCP %p reducing MSS from %zd to %zd\n",
+	       tcp, tcp->mss, mss );
+	tcp->mss = mss;
+
+	/* Retransmit the segment that was too large.  This is not a
+	 * congestion event, so the congestion window is left
+	 * untouched; the recovery point ensures that any further
+	 * oversized segments are retransmitted as they are exposed
+	 * by partial acknowledgements.
+	 */
+	if ( tcp->snd_sent ) {
+		tcp->recover = ( tcp->snd_seq + tcp->snd_sent );
+		if ( ! ( tcp->flags & TCP_FAST_RECOVERY ) )
+			tcp->flags |= TCP_LOSS_RECOVERY;
+		tcp_retransmit ( tcp );
+	}
+}
+
 /** TCP protocol */
 struct tcpip_protocol tcp_protocol __tcpip_protocol = {
 	.name = "TCP",
 	.rx = tcp_rx,
+	.pmtu = tcp_pmtu,
 	.tcpip_proto = IP_TCP,
 };
 
@@ -35,12 +35,16 @@ FILE_LICENCE ( GPL2_OR_LATER );
 #include <assert.h>
 #include <ipxe/uri.h>
 #include <ipxe/refcnt.h>
+#include <ipxe/list.h>
 #include <ipxe/iobuf.h>
 #include <ipxe/xfer.h>
 #include <ipxe/open.h>
 #include <ipxe/socket.h>
 #include <ipxe/tcpip.h>
 #include <ipxe/process.h>
+#include <ipxe/retry.h>
+#include <ipxe/timer.h>
+#include <ipxe/init.h>
 #include <ipxe/linebuf.h>
 #include <ipxe/features.h>
 #include <ipxe/base64.h>
@@ -53,6 +57,17 @@ FEATURE ( FEATURE_PROTOCOL, "HTTP", DHCP_EB_FEATURE_HTTP, 1 );
 /** Block size used for HTTP block device request */
 #define HTTP_BLKSIZE 512
 
+/** Maximum number of idle connections held in the connection pool */
+#define HTTP_POOL_MAX 4
+
+/** Time for which an idle connection is held in the connection pool
+ *
+ * This should be shorter than the keep-alive timeout used by typical
+ * servers, to minimise the chance of reusing a connection that the
+ * server is about to close.
+ */
+#define HTTP_POOL_TIMEOUT ( 5 * TICKS_PER_SEC )
+
 /** HTTP flags */
 enum http_flags {
 	/** Request is waiting to be transmitted */
@@ -61,6 +76,14 @@ enum http_flags {
 	HTTP_HEAD_ONLY = 0x0002,
 	/** Keep connection alive */
 	HTTP_KEEPALIVE = 0x0004,
+	/** Server permits connection to be reused */
+	HTTP_PERSISTENT = 0x0008,
+	/** Connection was reused from the connection pool */
+	HTTP_REUSED = 0x0010,
+	/** Fetch byte range only */
+	HTTP_RANGE = 0x0020,
+	/** Response contains the requested byte range */
+	HTTP_RANGE_OK = 0x0040,
 };
 
 /** HTTP receive state */
@@ -88,6 +111,10 @@ struct http_request {
 
 	/** URI being fetched */
 	struct uri *uri;
+	/** Default port number */
+	unsigned int default_port;
+	/** Filter to apply to socket, or NULL */
+	int ( * filter ) ( struct interface *xfer, struct interface **next );
 	/** Transport layer interface */
 	struct interface socket;
 
@@ -117,6 +144,213 @@ struct http_request {
 	userptr_t rx_buffer;
 };
 
+/**
+ * An idle HTTP connection
+ *
+ * A transport-layer connection (including any TLS session) which has
+ * completed a request and which the server has agreed to keep open
+ * is held in the connection pool, so that a subsequent request to the
+ * same scheme, host and port can avoid the cost of a new TCP
+ * handshake, TLS handshake and slow start.
+ */
+struct http_connection {
+	/** Reference count */
+	struct refcnt refcnt;
+	/** List of idle connections, most recently used first */
+	struct list_head list;
+	/** Transport layer interface */
+	struct interface socket;
+	/** URI from which connection was established */
+	struct uri *uri;
+	/** Port number */
+	unsigned int port;
+	/** Idle timer */
+	struct retry_timer timer;
+};
+
+/** Idle HTTP connection pool */
+static LIST_HEAD ( http_connections );
+
+/**
+ * Move transport-layer connection to a new interface
+ *
+ * @v from		Interface currently attached to connection
+ * @v to		Interface to attach to connection
+ */
+static void http_socket_move ( struct interface *from,
+			       struct interface *to ) {
+
+	intf_plug_plug ( to, from->dest );
+	intf_unplug ( from );
+}
+
+/**
+ * Free idle HTTP connection
+ *
+ * @v refcnt		Reference counter
+ */
+static void http_conn_free ( struct refcnt *refcnt ) {
+	struct http_connection *conn =
+		container_of ( refcnt, struct http_connection, refcnt );
+
+	uri_put ( conn->uri );
+	free ( conn );
+}
+
+/**
+ * Close idle HTTP connection
+ *
+ * @v conn		Idle HTTP connection
+ * @v rc		Reason for close
+ */
+static void http_conn_close ( struct http_connection *conn, int rc ) {
+
+	DBGC ( conn, "HTTPCONN %p closed: %s\n", conn, strerror ( rc ) );
+
+	/* Stop idle timer and shut down connection */
+	stop_timer ( &conn->timer );
+	intf_shutdown ( &conn->socket, rc );
+
+	/* Remove from pool, dropping the pool's reference */
+	if ( ! list_empty ( &conn->list ) ) {
+		list_del ( &conn->list );
+		INIT_LIST_HEAD ( &conn->list );
+		ref_put ( &conn->refcnt );
+	}
+}
+
+/**
+ * Handle data received on idle HTTP connection
+ *
+ * @v conn		Idle HTTP connection
+ * @v iobuf		I/O buffer
+ * @v meta		Data transfer metadata
+ * @ret rc		Return status code
+ */
+static int http_conn_deliver ( struct http_connection *conn,
+			       struct io_buffer *iobuf,
+			       struct xfer_metadata *meta __unused ) {
+
+	/* Any data received on an idle connection is unsolicited */
+	DBGC ( conn, "HTTPCONN %p received %zd bytes while idle\n",
+	       conn, iob_len ( iobuf ) );
+	free_iob ( iobuf );
+	http_conn_close ( conn, -EPROTO );
+	return -EPROTO;
+}
+
+/**
+ * Handle idle HTTP connection timer expiry
+ *
+ * @v timer		Idle timer
+ * @v fail		Failure indicator
+ */
+static void http_conn_expired ( struct retry_timer *timer, int fail __unused ){
+	struct http_connection *conn =
+		container_of ( timer, struct http_connection, timer );
+
+	http_conn_close ( conn, 0 );
+}
+
+/** Idle HTTP connection socket interface operations */
+static struct interface_operation http_conn_socket_operations[] = {
+	INTF_OP ( xfer_deliver, struct http_connection *, http_conn_deliver ),
+	INTF_OP ( intf_close, struct http_connection *, http_conn_close ),
+};
+
+/** Idle HTTP connection socket interface descriptor */
+static struct interface_descriptor http_conn_socket_desc =
+	INTF_DESC ( struct http_connection, socket,
+		    http_conn_socket_operations );
+
+/**
+ * Add HTTP request's connection to the connection pool
+ *
+ * @v http		HTTP request
+ */
+static void http_conn_recycle ( struct http_request *http ) {
+	struct http_connection *conn;
+	struct http_connection *oldest;
+	unsigned int count = 0;
+
+	/* Allocate and initialise idle connection */
+	conn = zalloc ( sizeof ( *conn ) );
+	if ( ! conn )
+		return;
+	ref_init ( &conn->refcnt, http_conn_free );
+	intf_init ( &conn->socket, &http_conn_socket_desc, &conn->refcnt );
+	timer_init ( &conn->timer, http_conn_expired, &conn->refcnt );
+	conn->uri = uri_get ( http->uri );
+	conn->port = uri_port ( http->uri, http->default_port );
+
+	/* Take over transport-layer connection */
+	http_socket_move ( &http->socket, &conn->socket );
+	DBGC ( conn, "HTTPCONN %p holding connection to %s:%d from HTTP %p\n",
+	       conn, conn->uri->host, conn->port, http );
+
+	/* Discard least recently used connection if pool is full */
+	list_for_each_entry ( oldest, &http_connections, list )
+		count++;
+	if ( count >= HTTP_POOL_MAX ) {
+		oldest = list_entry ( http_connections.prev,
+				      struct http_connection, list );
+		http_conn_close ( oldest, 0 );
+	}
+
+	/* Add to pool, transferring our reference to the pool */
+	list_add ( &conn->list, &http_connections );
+	start_timer_fixed ( &conn->timer, HTTP_POOL_TIMEOUT );
+}
+
+/**
+ * Attach HTTP request to an idle connection, if available
+ *
+ * @v http		HTTP request
+ * @ret reused		Connection was reused
+ */
+static int http_conn_reuse ( struct http_request *http ) {
+	struct http_connection *conn;
+	unsigned int port = uri_port ( http->uri, http->default_port );
+
+	list_for_each_entry ( conn, &http_connections, list ) {
+
+		/* Match scheme, host and port */
+		if ( strcmp ( conn->uri->scheme, http->uri->scheme ) != 0 )
+			continue;
+		if ( strcasecmp ( conn->uri->host, http->uri->host ) != 0 )
+			continue;
+		if ( conn->port != port )
+			continue;
+
+		/* Hand over transport-layer connection */
+		DBGC ( conn, "HTTPCONN %p reused by HTTP %p\n", conn, http );
+		http_socket_move ( &conn->socket, &http->socket );
+		http->flags |= HTTP_REUSED;
+		http_conn_close ( conn, 0 );
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Close all idle HTTP connections
+ *
+ * @v booting		System is shutting down for OS boot
+ */
+static void http_conn_shutdown ( int booting __unused ) {
+	struct http_connection *conn;
+	struct http_connection *tmp;
+
+	list_for_each_entry_safe ( conn, tmp, &http_connections, list )
+		http_conn_close ( conn, 0 );
+}
+
+/** Idle HTTP connection pool shutdown function */
+struct startup_fn http_conn_startup_fn __startup_fn ( STARTUP_LATE ) = {
+	.shutdown = http_conn_shutdown,
+};
+
 /**
  * Free HTTP request
  *
@@ -187,8 +421,14 @@ static void http_done ( struct http_request *http ) {
 	intf_restart ( &http->partial, 0 );
 
 	/* Close everything unless we are keeping the connection alive */
-	if ( ! ( http->flags & HTTP_KEEPALIVE ) )
+	if ( ! ( http->flags & HTTP_KEEPALIVE ) ) {
+
+		/* Return connection to the pool, if permitted */
+		if ( http->flags & HTTP_PERSISTENT )
+			http_conn_recycle ( http );
+
 		http_close ( http, 0 );
+	}
 }
 
 /**
@@ -233,6 +473,13 @@ static int http_rx_response ( struct http_request *http, char *response ) {
 	if ( strncmp ( response, "HTTP/", 5 ) != 0 )
 		return -EIO;
 
+	/* HTTP/1.1 connections are persistent unless stated otherwise */
+	if ( strncmp ( response, "HTTP/1.0", 8 ) == 0 ) {
+		http->flags &= ~HTTP_PERSISTENT;
+	} else {
+		http->flags |= HTTP_PERSISTENT;
+	}
+
 	/* Locate and check response code */
 	spc = strchr ( response, ' ' );
 	if ( ! spc )
@@ -240,6 +487,13 @@ static int http_rx_response ( struct http_request *http, char *response ) {
 	code = strtoul ( spc, NULL, 10 );
 	if ( ( rc = http_response_to_rc ( code ) ) != 0 )
 		return rc;
+	http->flags &= ~HTTP_RANGE_OK;
+
+	/* A byte range request must receive only the requested range */
+	if ( ( http->flags & HTTP_RANGE ) && ( code != 206 ) ) {
+		DBGC ( http, "HTTP %p server does not support ranges\n", http );
+		return -ENOTSUP;
+	}
 
 	/* Move to received headers */
 	http->rx_state = HTTP_RX_HEADER;
@@ -314,6 +568,40 @@ static int http_rx_content_length ( struct http_request *http,
 	return 0;
 }
 
+/**
+ * Handle HTTP Content-Range header
+ *
+ * @v http		HTTP request
+ * @v value		HTTP header value
+ * @ret rc		Return status code
+ */
+static int http_rx_content_range ( struct http_request *http,
+				   const char *value ) {
+	unsigned long start;
+	char *endp;
+
+	/* Ignore unless we requested a byte range */
+	if ( ! ( ( http->flags & HTTP_RANGE ) || http->partial_len ) )
+		return 0;
+
+	/* Check that the range starts where we asked it to */
+	if ( strncmp ( value, "bytes ", 6 ) != 0 ) {
+		DBGC ( http, "HTTP %p invalid Content-Range \"%s\"\n",
+		       http, value );
+		return -EIO;
+	}
+	start = strtoul ( ( value + 6 ), &endp, 10 );
+	if ( ( *endp != '-' ) || ( start != http->partial_start ) ) {
+		DBGC ( http, "HTTP %p received range \"%s\" but requested "
+		       "%zd+%zd\n", http, value, http->partial_start,
+		       http->partial_len );
+		return -EIO;
+	}
+	http->flags |= HTTP_RANGE_OK;
+
+	return 0;
+}
+
 /**
  * Handle HTTP Transfer-Encoding header
  *
@@ -332,6 +620,27 @@ static int http_rx_transfer_encoding ( struct http_request *http,
 	return 0;
 }
 
+/**
+ * Handle HTTP Connection header
+ *
+ * @v http		HTTP request
+ * @v value		HTTP header value
+ * @ret rc		Return status code
+ */
+static int http_rx_connection ( struct http_request *http,
+				const char *value ) {
+
+	if ( strcasecmp ( value, "close" ) == 0 ) {
+		/* Server will close connection after this response */
+		http->flags &= ~HTTP_PERSISTENT;
+	} else if ( strcasecmp ( value, "keep-alive" ) == 0 ) {
+		/* Server will keep (HTTP/1.0) connection open */
+		http->flags |= HTTP_PERSISTENT;
+	}
+
+	return 0;
+}
+
 /** An HTTP header handler */
 struct http_header_handler {
 	/** Name (e.g. "Content-Length") */
@@ -357,10 +666,18 @@ static struct http_header_handler http_header_handlers[] = {
 		.header = "Content-Length",
 		.rx = http_rx_content_length,
 	},
+	{
+		.header = "Content-Range",
+		.rx = http_rx_content_range,
+	},
 	{
 		.header = "Transfer-Encoding",
 		.rx = http_rx_transfer_encoding,
 	},
+	{
+		.header = "Connection",
+		.rx = http_rx_connection,
+	},
 	{ NULL, NULL }
 };
 
@@ -382,6 +699,13 @@ static int http_rx_header ( struct http_request *http, char *header ) {
 		empty_line_buffer ( &http->linebuf );
 		if ( ( http->rx_state == HTTP_RX_HEADER ) &&
 		     ( ! ( http->flags & HTTP_HEAD_ONLY ) ) ) {
+			/* A byte range response must state its range */
+			if ( ( http->flags & HTTP_RANGE ) &&
+			     ! ( http->flags & HTTP_RANGE_OK ) ) {
+				DBGC ( http, "HTTP %p response has no "
+				       "Content-Range\n", http );
+				return -EIO;
+			}
 			DBGC ( http, "HTTP %p start of data\n", http );
 			http->rx_state = ( http->chunked ?
 					   HTTP_RX_CHUNK_LEN : HTTP_RX_DATA );
@@ -651,9 +975,16 @@ static void http_step ( struct http_request *http ) {
 	}
 
 	/* Determine type of request */
-	partial = ( http->partial_len != 0 );
-	snprintf ( range, sizeof ( range ), "%zd-%zd", http->partial_start,
-		   ( http->partial_start + http->partial_len - 1 ) );
+	partial = ( ( http->partial_len != 0 ) ||
+		    ( http->flags & HTTP_RANGE ) );
+	if ( http->partial_len ) {
+		snprintf ( range, sizeof ( range ), "%zd-%zd",
+			   http->partial_start,
+			   ( http->partial_start + http->partial_len - 1 ) );
+	} else {
+		snprintf ( range, sizeof ( range ), "%zd-",
+			   http->partial_start );
+	}
 
 	/* Mark request as transmitted */
 	http->flags &= ~HTTP_TX_PENDING;
@@ -673,8 +1004,7 @@ static void http_step ( struct http_request *http ) {
 				    ":" : "" ),
 				  ( http->uri->port ?
 				    http->uri->port : "" ),
-				  ( ( http->flags & HTTP_KEEPALIVE ) ?
-				    "Connection: Keep-Alive\r\n" : "" ),
+				  "Connection: Keep-Alive\r\n",
 				  ( partial ? "Range: bytes=" : "" ),
 				  ( partial ? range : "" ),
 				  ( partial ? "\r\n" : "" ),
@@ -698,6 +1028,30 @@ static size_t http_xfer_window ( struct http_request *http ) {
 	return ( ( http->rx_state == HTTP_RX_IDLE ) ? 1 : 0 );
 }
 
+/**
+ * Restrict HTTP request to a byte range
+ *
+ * @v http		HTTP request
+ * @v offset		Starting offset
+ * @v len		Length of range, or zero to continue to end of file
+ * @ret rc		Return status code
+ */
+static int http_xfer_range ( struct http_request *http, size_t offset,
+			     size_t len ) {
+
+	/* Range may be specified only before request is transmitted */
+	if ( ! ( http->flags & HTTP_TX_PENDING ) )
+		return -EBUSY;
+
+	DBGC ( http, "HTTP %p requesting range %zd+%zd\n", http, offset, len );
+	http->partial_start = offset;
+	http->partial_len = len;
+	http->remaining = len;
+	http->flags |= HTTP_RANGE;
+
+	return 0;
+}
+
 /**
  * Initiate HTTP partial read
  *
@@ -787,12 +1141,72 @@ static int http_acpi_describe ( struct http_request *http,
 	return 0;
 }
 
+/**
+ * Open HTTP transport-layer connection
+ *
+ * @v http		HTTP request
+ * @ret rc		Return status code
+ */
+static int http_socket_open ( struct http_request *http ) {
+	struct sockaddr_tcpip server;
+	struct interface *socket;
+	int rc;
+
+	/* Reuse an idle connection, if available */
+	if ( http_conn_reuse ( http ) )
+		return 0;
+
+	/* Open socket */
+	memset ( &server, 0, sizeof ( server ) );
+	server.st_port = htons ( uri_port ( http->uri, http->default_port ) );
+	socket = &http->socket;
+	if ( http->filter ) {
+		if ( ( rc = http->filter ( socket, &socket ) ) != 0 )
+			return rc;
+	}
+	if ( ( rc = xfer_open_named_socket ( socket, SOCK_STREAM,
+					     ( struct sockaddr * ) &server,
+					     http->uri->host, NULL ) ) != 0 )
+		return rc;
+
+	return 0;
+}
+
+/**
+ * Handle closure of HTTP transport-layer connection
+ *
+ * @v http		HTTP request
+ * @v rc		Reason for close
+ */
+static void http_socket_close ( struct http_request *http, int rc ) {
+
+	/* A server may close an idle connection at any time.  If a
+	 * reused connection is closed before any part of the
+	 * response has been received, retry using a new connection.
+	 */
+	if ( ( http->flags & HTTP_REUSED ) &&
+	     ( http->rx_state == HTTP_RX_RESPONSE ) &&
+	     ( http->linebuf.len == 0 ) ) {
+		DBGC ( http, "HTTP %p reused connection closed (%s); "
+		       "reconnecting\n", http, strerror ( rc ) );
+		http->flags &= ~HTTP_REUSED;
+		http->flags |= HTTP_TX_PENDING;
+		intf_restart ( &http->socket, rc );
+		if ( ( rc = http_socket_open ( http ) ) == 0 ) {
+			process_add ( &http->process );
+			return;
+		}
+	}
+
+	http_close ( http, rc );
+}
+
 /** HTTP socket interface operations */
 static struct interface_operation http_socket_operations[] = {
 	INTF_OP ( xfer_window, struct http_request *, http_socket_window ),
 	INTF_OP ( xfer_deliver, struct http_request *, http_socket_deliver ),
 	INTF_OP ( xfer_window_changed, struct http_request *, http_step ),
-	INTF_OP ( intf_close, struct http_request *, http_close ),
+	INTF_OP ( intf_close, struct http_request *, http_socket_close ),
 };
 
 /** HTTP socket interface descriptor */
@@ -812,6 +1226,7 @@ static struct interface_descriptor http_partial_desc =
 /** HTTP data transfer interface operations */
 static struct interface_operation http_xfer_operations[] = {
 	INTF_OP ( xfer_window, struct http_request *, http_xfer_window ),
+	INTF_OP ( xfer_range, struct http_request *, http_xfer_range ),
 	INTF_OP ( block_read, struct http_request *, http_block_read ),
 	INTF_OP ( block_read_capacity, struct http_request *,
 		  http_block_read_capacity ),
@@ -842,8 +1257,6 @@ int http_open_filter ( struct interface *xfer, struct uri *uri,
 		       int ( * filter ) ( struct interface *xfer,
 					  struct interface **next ) ) {
 	struct http_request *http;
-	struct sockaddr_tcpip server;
-	struct interface *socket;
 	int rc;
 
 	/* Sanity checks */
@@ -860,19 +1273,12 @@ int http_open_filter ( struct interface *xfer, struct uri *uri,
        	http->uri = uri_get ( uri );
 	intf_init ( &http->socket, &http_socket_desc, &http->refcnt );
 	process_init ( &http->process, &http_process_desc, &http->refcnt );
+	http->default_port = default_port;
+	http->filter = filter;
 	http->flags = HTTP_TX_PENDING;
 
-	/* Open socket */
-	memset ( &server, 0, sizeof ( server ) );
-	server.st_port = htons ( uri_port ( http->uri, default_port ) );
-	socket = &http->socket;
-	if ( filter ) {
-		if ( ( rc = filter ( socket, &socket ) ) != 0 )
-			goto err;
-	}
-	if ( ( rc = xfer_open_named_socket ( socket, SOCK_STREAM,
-					     ( struct sockaddr * ) &server,
-					     uri->host, NULL ) ) != 0 )
+	/* Open (or reuse) transport-layer connection */
+	if ( ( rc = http_socket_open ( http ) ) != 0 )
 		goto err;
 
 	/* Attach to parent interface, mortalise self, and return */
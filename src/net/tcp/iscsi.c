@@ -39,6 +39,7 @@ FILE_LICENCE ( GPL2_OR_LATER );
 #include <ipxe/features.h>
 #include <ipxe/base16.h>
 #include <ipxe/base64.h>
+#include <ipxe/crc32c.h>
 #include <ipxe/ibft.h>
 #include <ipxe/iscsi.h>
 
@@ -87,6 +88,14 @@ FEATURE ( FEATURE_PROTOCOL, "iSCSI", DHCP_EB_FEATURE_ISCSI, 1 );
 	__einfo_error ( EINFO_EIO_TARGET_NO_RESOURCES )
 #define EINFO_EIO_TARGET_NO_RESOURCES \
 	__einfo_uniqify ( EINFO_EIO, 0x02, "Target out of resources" )
+#define EIO_HEADER_DIGEST \
+	__einfo_error ( EINFO_EIO_HEADER_DIGEST )
+#define EINFO_EIO_HEADER_DIGEST \
+	__einfo_uniqify ( EINFO_EIO, 0x03, "Header digest mismatch" )
+#define EIO_DATA_DIGEST \
+	__einfo_error ( EINFO_EIO_DATA_DIGEST )
+#define EINFO_EIO_DATA_DIGEST \
+	__einfo_uniqify ( EINFO_EIO, 0x04, "Data digest mismatch" )
 #define ENOTSUP_INITIATOR_STATUS \
 	__einfo_error ( EINFO_ENOTSUP_INITIATOR_STATUS )
 #define EINFO_ENOTSUP_INITIATOR_STATUS \
@@ -107,6 +116,10 @@ FEATURE ( FEATURE_PROTOCOL, "iSCSI", DHCP_EB_FEATURE_ISCSI, 1 );
 	__einfo_error ( EINFO_ENOTSUP_NOP_IN )
 #define EINFO_ENOTSUP_NOP_IN \
 	__einfo_uniqify ( EINFO_ENOTSUP, 0x05, "Unsupported NOP-In received" )
+#define ENOTSUP_DIGEST \
+	__einfo_error ( EINFO_ENOTSUP_DIGEST )
+#define EINFO_ENOTSUP_DIGEST \
+	__einfo_uniqify ( EINFO_ENOTSUP, 0x06, "Required digest not supported" )
 #define EPERM_INITIATOR_AUTHENTICATION \
 	__einfo_error ( EINFO_EPERM_INITIATOR_AUTHENTICATION )
 #define EINFO_EPERM_INITIATOR_AUTHENTICATION \
@@ -131,11 +144,25 @@ FEATURE ( FEATURE_PROTOCOL, "iSCSI", DHCP_EB_FEATURE_ISCSI, 1 );
 	__einfo_error ( EINFO_EPROTO_INVALID_CHAP_RESPONSE )
 #define EINFO_EPROTO_INVALID_CHAP_RESPONSE \
 	__einfo_uniqify ( EINFO_EPROTO, 0x04, "Invalid CHAP response" )
+#define EPROTO_TOO_MANY_R2T \
+	__einfo_error ( EINFO_EPROTO_TOO_MANY_R2T )
+#define EINFO_EPROTO_TOO_MANY_R2T \
+	__einfo_uniqify ( EINFO_EPROTO, 0x05, "Too many outstanding R2Ts" )
+#define EPROTO_UNKNOWN_ITT \
+	__einfo_error ( EINFO_EPROTO_UNKNOWN_ITT )
+#define EINFO_EPROTO_UNKNOWN_ITT \
+	__einfo_uniqify ( EINFO_EPROTO, 0x06, "Unknown initiator task tag" )
+
+/** Digest types offered during login */
+#ifdef ISCSI_DIGESTS_REQUIRED
+#define ISCSI_DIGEST_OFFER "CRC32C"
+#else
+#define ISCSI_DIGEST_OFFER "None,CRC32C"
+#endif
 
 static void iscsi_start_tx ( struct iscsi_session *iscsi );
 static void iscsi_start_login ( struct iscsi_session *iscsi );
-static void iscsi_start_data_out ( struct iscsi_session *iscsi,
-				   unsigned int datasn );
+static void iscsi_tx_next ( struct iscsi_session *iscsi );
 
 /**
  * Finish receiving PDU data into buffer
@@ -195,7 +222,6 @@ static void iscsi_free ( struct refcnt *refcnt ) {
 	free ( iscsi->target_password );
 	chap_finish ( &iscsi->chap );
 	iscsi_rx_buffered_data_done ( iscsi );
-	free ( iscsi->command );
 	free ( iscsi );
 }
 
@@ -206,6 +232,7 @@ static void iscsi_free ( struct refcnt *refcnt ) {
  * @v rc		Reason for close
  */
 static void iscsi_close ( struct iscsi_session *iscsi, int rc ) {
+	unsigned int i;
 
 	/* A TCP graceful close is still an error from our point of view */
 	if ( rc == 0 )
@@ -219,18 +246,41 @@ static void iscsi_close ( struct iscsi_session *iscsi, int rc ) {
 	/* Shut down interfaces */
 	intf_shutdown ( &iscsi->socket, rc );
 	intf_shutdown ( &iscsi->control, rc );
-	intf_shutdown ( &iscsi->data, rc );
+	for ( i = 0 ; i < ISCSI_MAX_TASKS ; i++ )
+		intf_shutdown ( &iscsi->tasks[i].data, rc );
 }
 
 /**
  * Assign new iSCSI initiator task tag
  *
- * @v iscsi		iSCSI session
+ * @ret itt		Initiator task tag
  */
-static void iscsi_new_itt ( struct iscsi_session *iscsi ) {
+static uint32_t iscsi_new_itt ( void ) {
 	static uint16_t itt_idx;
 
-	iscsi->itt = ( ISCSI_TAG_MAGIC | (++itt_idx) );
+	return ( ISCSI_TAG_MAGIC | (++itt_idx) );
+}
+
+/**
+ * Find iSCSI task by initiator task tag
+ *
+ * @v iscsi		iSCSI session
+ * @v itt		Initiator task tag
+ * @ret task		iSCSI task, or NULL if not found
+ */
+static struct iscsi_task * iscsi_find_task ( struct iscsi_session *iscsi,
+					     uint32_t itt ) {
+	struct iscsi_task *task;
+	unsigned int i;
+
+	for ( i = 0 ; i < ISCSI_MAX_TASKS ; i++ ) {
+		task = &iscsi->tasks[i];
+		if ( task->itt && ( task->itt == itt ) )
+			return task;
+	}
+
+	DBGC ( iscsi, "iSCSI %p has no task with ITT %#08x\n", iscsi, itt );
+	return NULL;
 }
 
 /**
@@ -265,11 +315,22 @@ static int iscsi_open_connection ( struct iscsi_session *iscsi ) {
 	if ( iscsi->target_username )
 		iscsi->status |= ISCSI_STATUS_AUTH_REVERSE_REQUIRED;
 
+	/* Digests are renegotiated on each login */
+	iscsi->digests = 0;
+
 	/* Assign new ISID */
 	iscsi->isid_iana_qual = ( random() & 0xffff );
 
+	/* Assume the most conservative operational parameters until
+	 * negotiation is complete.
+	 */
+	iscsi->initial_r2t = 1;
+	iscsi->immediate_data = 0;
+	iscsi->first_burst_len = ISCSI_FIRST_BURST_LEN;
+	iscsi->max_send_len = ISCSI_DEFAULT_MAX_SEND_LEN;
+
 	/* Assign fresh initiator task tag */
-	iscsi_new_itt ( iscsi );
+	iscsi->itt = iscsi_new_itt();
 
 	/* Initiate login */
 	iscsi_start_login ( iscsi );
@@ -287,6 +348,8 @@ static int iscsi_open_connection ( struct iscsi_session *iscsi ) {
  * ready to attempt a fresh login.
  */
 static void iscsi_close_connection ( struct iscsi_session *iscsi, int rc ) {
+	struct iscsi_task *task;
+	unsigned int i;
 
 	/* Close all data transfer interfaces */
 	intf_restart ( &iscsi->socket, rc );
@@ -299,6 +362,12 @@ static void iscsi_close_connection ( struct iscsi_session *iscsi, int rc ) {
 	iscsi->rx_state = ISCSI_RX_BHS;
 	iscsi->rx_offset = 0;
 
+	/* Discard any pending data-out sequences */
+	for ( i = 0 ; i < ISCSI_MAX_TASKS ; i++ ) {
+		task = &iscsi->tasks[i];
+		task->transfer_cons = task->transfer_prod;
+	}
+
 	/* Free any temporary dynamically allocated memory */
 	chap_finish ( &iscsi->chap );
 	iscsi_rx_buffered_data_done ( iscsi );
@@ -307,7 +376,7 @@ static void iscsi_close_connection ( struct iscsi_session *iscsi, int rc ) {
 /**
  * Mark iSCSI SCSI operation as complete
  *
- * @v iscsi		iSCSI session
+ * @v task		iSCSI task
  * @v rc		Return status code
  * @v rsp		SCSI response, if any
  *
@@ -316,27 +385,31 @@ static void iscsi_close_connection ( struct iscsi_session *iscsi, int rc ) {
  * appropriate state, otherwise bad things may happen on the next call
  * to iscsi_scsi_command().  The general rule is to call
  * iscsi_scsi_done() only at the end of receiving a PDU; at this point
- * the TX and RX engines should both be idle.
+ * the RX engine will be idle, and the TX engine will not be
+ * transmitting any PDU belonging to this task.
  */
-static void iscsi_scsi_done ( struct iscsi_session *iscsi, int rc,
+static void iscsi_scsi_done ( struct iscsi_task *task, int rc,
 			      struct scsi_rsp *rsp ) {
-	uint32_t itt = iscsi->itt;
+	struct iscsi_session *iscsi = task->iscsi;
 
-	assert ( iscsi->tx_state == ISCSI_TX_IDLE );
+	assert ( ( iscsi->tx_task != task ) ||
+		 ( iscsi->tx_state == ISCSI_TX_IDLE ) );
 
-	/* Clear command */
-	free ( iscsi->command );
-	iscsi->command = NULL;
+	/* Release task and discard any pending data-out sequences */
+	task->itt = 0;
+	task->command_pending = 0;
+	task->transfer_cons = task->transfer_prod;
 
 	/* Send SCSI response, if any */
-	scsi_response ( &iscsi->data, rsp );
+	scsi_response ( &task->data, rsp );
 
-	/* Close SCSI command, if this is still the same command.  (It
-	 * is possible that the command interface has already been
-	 * closed as a result of the SCSI response we sent.)
+	/* Close SCSI command, if the task has not already been reused.
+	 * (It is possible that the command interface has already been
+	 * closed as a result of the SCSI response we sent, and that a
+	 * new command has been issued using the same task.)
 	 */
-	if ( iscsi->itt == itt )
-		intf_restart ( &iscsi->data, rc );
+	if ( ! task->itt )
+		intf_restart ( &task->data, rc );
 }
 
 /****************************************************************************
@@ -354,36 +427,132 @@ static void iscsi_scsi_done ( struct iscsi_session *iscsi, int rc,
  * Data-In and Data-Out segments); these would require providing code
  * to generate an AHS, and there doesn't seem to be any need for it at
  * the moment.
+ *
+ * If the target permits it, the first part of any data-out buffer is
+ * sent as immediate data within the SCSI command PDU, and the
+ * remainder of the first burst is queued for transmission as
+ * unsolicited data-out PDUs.
  */
-static void iscsi_start_command ( struct iscsi_session *iscsi ) {
+static void iscsi_start_command ( struct iscsi_task *task ) {
+	struct iscsi_session *iscsi = task->iscsi;
 	struct iscsi_bhs_scsi_command *command = &iscsi->tx_bhs.scsi_command;
+	struct iscsi_transfer *transfer;
+	size_t burst_len = 0;
+	size_t immediate_len = 0;
+
+	assert ( ! ( task->command.data_in && task->command.data_out ) );
+
+	/* Determine amount of unsolicited data to send, if any */
+	if ( task->command.data_out &&
+	     ( iscsi->immediate_data || ! iscsi->initial_r2t ) ) {
+		burst_len = task->command.data_out_len;
+		if ( burst_len > iscsi->first_burst_len )
+			burst_len = iscsi->first_burst_len;
+		if ( iscsi->immediate_data ) {
+			immediate_len = burst_len;
+			if ( immediate_len > iscsi->max_send_len )
+				immediate_len = iscsi->max_send_len;
+		}
+		if ( iscsi->initial_r2t )
+			burst_len = immediate_len;
+	}
 
-	assert ( ! ( iscsi->command->data_in && iscsi->command->data_out ) );
+	/* Queue unsolicited data-out sequence, if applicable */
+	if ( burst_len > immediate_len ) {
+		assert ( task->transfer_prod == task->transfer_cons );
+		transfer = &task->transfers[ task->transfer_prod++ %
+					     ISCSI_MAX_TRANSFERS ];
+		transfer->ttt = ISCSI_TAG_RESERVED;
+		transfer->offset = immediate_len;
+		transfer->len = ( burst_len - immediate_len );
+		transfer->datasn = 0;
+	}
 
 	/* Construct BHS and initiate transmission */
 	iscsi_start_tx ( iscsi );
+	iscsi->tx_task = task;
+	task->command_pending = 0;
 	command->opcode = ISCSI_OPCODE_SCSI_COMMAND;
-	command->flags = ( ISCSI_FLAG_FINAL |
-			   ISCSI_COMMAND_ATTR_SIMPLE );
-	if ( iscsi->command->data_in )
+	command->flags = ISCSI_COMMAND_ATTR_SIMPLE;
+	if ( burst_len == immediate_len )
+		command->flags |= ISCSI_FLAG_FINAL;
+	if ( task->command.data_in )
 		command->flags |= ISCSI_COMMAND_FLAG_READ;
-	if ( iscsi->command->data_out )
+	if ( task->command.data_out )
 		command->flags |= ISCSI_COMMAND_FLAG_WRITE;
-	/* lengths left as zero */
-	memcpy ( &command->lun, &iscsi->command->lun,
+	ISCSI_SET_LENGTHS ( command->lengths, 0, immediate_len );
+	memcpy ( &command->lun, &task->command.lun,
 		 sizeof ( command->lun ) );
-	command->itt = htonl ( iscsi->itt );
-	command->exp_len = htonl ( iscsi->command->data_in_len |
-				   iscsi->command->data_out_len );
-	command->cmdsn = htonl ( iscsi->cmdsn );
+	command->itt = htonl ( task->itt );
+	command->exp_len = htonl ( task->command.data_in_len |
+				   task->command.data_out_len );
+	command->cmdsn = htonl ( task->cmdsn );
 	command->expstatsn = htonl ( iscsi->statsn + 1 );
-	memcpy ( &command->cdb, &iscsi->command->cdb, sizeof ( command->cdb ));
-	DBGC2 ( iscsi, "iSCSI %p start " SCSI_CDB_FORMAT " %s %#zx\n",
-		iscsi, SCSI_CDB_DATA ( command->cdb ),
-		( iscsi->command->data_in ? "in" : "out" ),
-		( iscsi->command->data_in ?
-		  iscsi->command->data_in_len :
-		  iscsi->command->data_out_len ) );
+	memcpy ( &command->cdb, &task->command.cdb, sizeof ( command->cdb ) );
+	DBGC2 ( iscsi, "iSCSI %p ITT %#08x start " SCSI_CDB_FORMAT
+		" %s %#zx\n", iscsi, task->itt,
+		SCSI_CDB_DATA ( command->cdb ),
+		( task->command.data_in ? "in" : "out" ),
+		( task->command.data_in ?
+		  task->command.data_in_len :
+		  task->command.data_out_len ) );
+	if ( burst_len ) {
+		DBGC2 ( iscsi, "iSCSI %p sending %#zx immediate and %#zx "
+			"unsolicited bytes\n", iscsi, immediate_len,
+			( burst_len - immediate_len ) );
+	}
+}
+
+/**
+ * Deliver iSCSI PDU data segment
+ *
+ * @v iscsi		iSCSI session
+ * @v iobuf		I/O buffer
+ * @ret rc		Return status code
+ *
+ * The data digest (if in use) is accumulated as the data segment is
+ * transmitted.
+ */
+static int iscsi_tx_deliver ( struct iscsi_session *iscsi,
+			      struct io_buffer *iobuf ) {
+
+	if ( iscsi->tx_digests & ISCSI_DIGEST_DATA ) {
+		iscsi->tx_crc = crc32c_le ( iscsi->tx_crc, iobuf->data,
+					    iob_len ( iobuf ) );
+	}
+	return xfer_deliver_iob ( &iscsi->socket, iobuf );
+}
+
+/**
+ * Send iSCSI SCSI command immediate data
+ *
+ * @v iscsi		iSCSI session
+ * @ret rc		Return status code
+ */
+static int iscsi_tx_command_data ( struct iscsi_session *iscsi ) {
+	struct iscsi_bhs_scsi_command *command = &iscsi->tx_bhs.scsi_command;
+	struct iscsi_task *task = iscsi->tx_task;
+	struct io_buffer *iobuf;
+	size_t len;
+
+	len = ISCSI_DATA_LEN ( command->lengths );
+
+	/* Do nothing if there is no immediate data */
+	if ( ! len )
+		return 0;
+
+	assert ( task != NULL );
+	assert ( task->command.data_out );
+	assert ( len <= task->command.data_out_len );
+
+	iobuf = xfer_alloc_iob ( &iscsi->socket, len );
+	if ( ! iobuf )
+		return -ENOMEM;
+
+	copy_from_user ( iob_put ( iobuf, len ),
+			 task->command.data_out, 0, len );
+
+	return iscsi_tx_deliver ( iscsi, iobuf );
 }
 
 /**
@@ -400,10 +569,16 @@ static int iscsi_rx_scsi_response ( struct iscsi_session *iscsi,
 				    size_t remaining ) {
 	struct iscsi_bhs_scsi_response *response
 		= &iscsi->rx_bhs.scsi_response;
+	struct iscsi_task *task;
 	struct scsi_rsp rsp;
 	uint32_t residual_count;
 	int rc;
 
+	/* Identify task */
+	task = iscsi_find_task ( iscsi, ntohl ( response->itt ) );
+	if ( ! task )
+		return -EPROTO_UNKNOWN_ITT;
+
 	/* Buffer up the PDU data */
 	if ( ( rc = iscsi_rx_buffered_data ( iscsi, data, len ) ) != 0 ) {
 		DBGC ( iscsi, "iSCSI %p could not buffer login response: %s\n",
@@ -432,7 +607,7 @@ static int iscsi_rx_scsi_response ( struct iscsi_session *iscsi,
 		return -EIO;
 
 	/* Mark as completed */
-	iscsi_scsi_done ( iscsi, 0, &rsp );
+	iscsi_scsi_done ( task, 0, &rsp );
 	return 0;
 }
 
@@ -449,14 +624,19 @@ static int iscsi_rx_data_in ( struct iscsi_session *iscsi,
 			      const void *data, size_t len,
 			      size_t remaining ) {
 	struct iscsi_bhs_data_in *data_in = &iscsi->rx_bhs.data_in;
+	struct iscsi_task *task;
 	unsigned long offset;
 
+	/* Identify task */
+	task = iscsi_find_task ( iscsi, ntohl ( data_in->itt ) );
+	if ( ! task )
+		return -EPROTO_UNKNOWN_ITT;
+
 	/* Copy data to data-in buffer */
 	offset = ntohl ( data_in->offset ) + iscsi->rx_offset;
-	assert ( iscsi->command != NULL );
-	assert ( iscsi->command->data_in );
-	assert ( ( offset + len ) <= iscsi->command->data_in_len );
-	copy_to_user ( iscsi->command->data_in, offset, data, len );
+	assert ( task->command.data_in );
+	assert ( ( offset + len ) <= task->command.data_in_len );
+	copy_to_user ( task->command.data_in, offset, data, len );
 
 	/* Wait for whole SCSI response to arrive */
 	if ( remaining )
@@ -464,10 +644,10 @@ static int iscsi_rx_data_in ( struct iscsi_session *iscsi,
 
 	/* Mark as completed if status is present */
 	if ( data_in->flags & ISCSI_DATA_FLAG_STATUS ) {
-		assert ( ( offset + len ) == iscsi->command->data_in_len );
+		assert ( ( offset + len ) == task->command.data_in_len );
 		assert ( data_in->flags & ISCSI_FLAG_FINAL );
 		/* iSCSI cannot return an error status via a data-in */
-		iscsi_scsi_done ( iscsi, 0, NULL );
+		iscsi_scsi_done ( task, 0, NULL );
 	}
 
 	return 0;
@@ -486,12 +666,35 @@ static int iscsi_rx_r2t ( struct iscsi_session *iscsi,
 			  const void *data __unused, size_t len __unused,
 			  size_t remaining __unused ) {
 	struct iscsi_bhs_r2t *r2t = &iscsi->rx_bhs.r2t;
+	struct iscsi_task *task;
+	struct iscsi_transfer *transfer;
+
+	/* Identify task */
+	task = iscsi_find_task ( iscsi, ntohl ( r2t->itt ) );
+	if ( ! task )
+		return -EPROTO_UNKNOWN_ITT;
+
+	/* Check that we have space to record the transfer */
+	if ( ( task->transfer_prod - task->transfer_cons ) >=
+	     ISCSI_MAX_TRANSFERS ) {
+		DBGC ( iscsi, "iSCSI %p ITT %#08x received too many R2Ts\n",
+		       iscsi, task->itt );
+		return -EPROTO_TOO_MANY_R2T;
+	}
+
+	/* Record transfer parameters */
+	transfer = &task->transfers[ task->transfer_prod++ %
+				     ISCSI_MAX_TRANSFERS ];
+	transfer->ttt = ntohl ( r2t->ttt );
+	transfer->offset = ntohl ( r2t->offset );
+	transfer->len = ntohl ( r2t->len );
+	transfer->datasn = 0;
+	DBGC2 ( iscsi, "iSCSI %p ITT %#08x received R2T TTT %#08x offset "
+		"%#x len %#x\n", iscsi, task->itt, transfer->ttt,
+		transfer->offset, transfer->len );
 
-	/* Record transfer parameters and trigger first data-out */
-	iscsi->ttt = ntohl ( r2t->ttt );
-	iscsi->transfer_offset = ntohl ( r2t->offset );
-	iscsi->transfer_len = ntohl ( r2t->len );
-	iscsi_start_data_out ( iscsi, 0 );
+	/* Start sending data, if not already doing so */
+	iscsi_tx_next ( iscsi );
 
 	return 0;
 }
@@ -499,56 +702,93 @@ static int iscsi_rx_r2t ( struct iscsi_session *iscsi,
 /**
  * Build iSCSI data-out BHS
  *
- * @v iscsi		iSCSI session
- * @v datasn		Data sequence number within the transfer
+ * @v task		iSCSI task
  *
+ * Starts transmission of the next data-out PDU for the task's oldest
+ * pending data-out sequence.
  */
-static void iscsi_start_data_out ( struct iscsi_session *iscsi,
-				   unsigned int datasn ) {
+static void iscsi_start_data_out ( struct iscsi_task *task ) {
+	struct iscsi_session *iscsi = task->iscsi;
 	struct iscsi_bhs_data_out *data_out = &iscsi->tx_bhs.data_out;
-	unsigned long offset;
-	unsigned long remaining;
+	struct iscsi_transfer *transfer;
 	unsigned long len;
 
-	/* We always send 512-byte Data-Out PDUs; this removes the
-	 * need to worry about the target's MaxRecvDataSegmentLength.
-	 */
-	offset = datasn * 512;
-	remaining = iscsi->transfer_len - offset;
-	len = remaining;
-	if ( len > 512 )
-		len = 512;
+	assert ( task->transfer_cons != task->transfer_prod );
+	transfer = &task->transfers[ task->transfer_cons %
+				     ISCSI_MAX_TRANSFERS ];
+
+	/* Send PDUs as large as the target will accept */
+	len = transfer->len;
+	if ( len > iscsi->max_send_len )
+		len = iscsi->max_send_len;
 
 	/* Construct BHS and initiate transmission */
 	iscsi_start_tx ( iscsi );
+	iscsi->tx_task = task;
 	data_out->opcode = ISCSI_OPCODE_DATA_OUT;
-	if ( len == remaining )
+	if ( len == transfer->len )
 		data_out->flags = ( ISCSI_FLAG_FINAL );
 	ISCSI_SET_LENGTHS ( data_out->lengths, 0, len );
-	data_out->lun = iscsi->command->lun;
-	data_out->itt = htonl ( iscsi->itt );
-	data_out->ttt = htonl ( iscsi->ttt );
+	data_out->lun = task->command.lun;
+	data_out->itt = htonl ( task->itt );
+	data_out->ttt = htonl ( transfer->ttt );
 	data_out->expstatsn = htonl ( iscsi->statsn + 1 );
-	data_out->datasn = htonl ( datasn );
-	data_out->offset = htonl ( iscsi->transfer_offset + offset );
-	DBGC ( iscsi, "iSCSI %p start data out DataSN %#x len %#lx\n",
-	       iscsi, datasn, len );
+	data_out->datasn = htonl ( transfer->datasn );
+	data_out->offset = htonl ( transfer->offset );
+	DBGC ( iscsi, "iSCSI %p ITT %#08x start data out DataSN %#x len "
+	       "%#lx\n", iscsi, task->itt, transfer->datasn, len );
+
+	/* Consume data, and discard sequence once complete */
+	transfer->offset += len;
+	transfer->len -= len;
+	transfer->datasn++;
+	if ( ! transfer->len )
+		task->transfer_cons++;
 }
 
 /**
- * Complete iSCSI data-out PDU transmission
+ * Start transmission of next iSCSI PDU, if any
  *
  * @v iscsi		iSCSI session
  *
+ * Does nothing if the TX engine is busy; this function will be
+ * called again once the current PDU has been transmitted.  SCSI
+ * command PDUs are sent first, in order of command sequence number.
+ * Data-out PDUs are then sent for each task in turn, so that a large
+ * write does not prevent other tasks from making progress.
  */
-static void iscsi_data_out_done ( struct iscsi_session *iscsi ) {
-	struct iscsi_bhs_data_out *data_out = &iscsi->tx_bhs.data_out;
+static void iscsi_tx_next ( struct iscsi_session *iscsi ) {
+	struct iscsi_task *task;
+	struct iscsi_task *next = NULL;
+	unsigned int i;
 
-	/* If we haven't reached the end of the sequence, start
-	 * sending the next data-out PDU.
-	 */
-	if ( ! ( data_out->flags & ISCSI_FLAG_FINAL ) )
-		iscsi_start_data_out ( iscsi, ntohl ( data_out->datasn ) + 1 );
+	/* Do nothing if TX engine is busy */
+	if ( iscsi->tx_state != ISCSI_TX_IDLE )
+		return;
+
+	/* Send oldest pending SCSI command, if any */
+	for ( i = 0 ; i < ISCSI_MAX_TASKS ; i++ ) {
+		task = &iscsi->tasks[i];
+		if ( ! ( task->itt && task->command_pending ) )
+			continue;
+		if ( ( ! next ) ||
+		     ( ( int32_t ) ( task->cmdsn - next->cmdsn ) < 0 ) )
+			next = task;
+	}
+	if ( next ) {
+		iscsi_start_command ( next );
+		return;
+	}
+
+	/* Otherwise, send next data-out PDU, if any */
+	for ( i = 0 ; i < ISCSI_MAX_TASKS ; i++ ) {
+		task = &iscsi->tasks[ iscsi->tx_next++ % ISCSI_MAX_TASKS ];
+		if ( task->itt &&
+		     ( task->transfer_cons != task->transfer_prod ) ) {
+			iscsi_start_data_out ( task );
+			return;
+		}
+	}
 }
 
 /**
@@ -559,6 +799,7 @@ static void iscsi_data_out_done ( struct iscsi_session *iscsi ) {
  */
 static int iscsi_tx_data_out ( struct iscsi_session *iscsi ) {
 	struct iscsi_bhs_data_out *data_out = &iscsi->tx_bhs.data_out;
+	struct iscsi_task *task = iscsi->tx_task;
 	struct io_buffer *iobuf;
 	unsigned long offset;
 	size_t len;
@@ -566,18 +807,18 @@ static int iscsi_tx_data_out ( struct iscsi_session *iscsi ) {
 	offset = ntohl ( data_out->offset );
 	len = ISCSI_DATA_LEN ( data_out->lengths );
 
-	assert ( iscsi->command != NULL );
-	assert ( iscsi->command->data_out );
-	assert ( ( offset + len ) <= iscsi->command->data_out_len );
+	assert ( task != NULL );
+	assert ( task->command.data_out );
+	assert ( ( offset + len ) <= task->command.data_out_len );
 
 	iobuf = xfer_alloc_iob ( &iscsi->socket, len );
 	if ( ! iobuf )
 		return -ENOMEM;
 	
 	copy_from_user ( iob_put ( iobuf, len ),
-			 iscsi->command->data_out, offset, len );
+			 task->command.data_out, offset, len );
 
-	return xfer_deliver_iob ( &iscsi->socket, iobuf );
+	return iscsi_tx_deliver ( iscsi, iobuf );
 }
 
 /**
@@ -623,24 +864,28 @@ static int iscsi_rx_nop_in ( struct iscsi_session *iscsi,
  * These are the initial set of strings sent in the first login
  * request PDU.  We want the following settings:
  *
- *     HeaderDigest=None
- *     DataDigest=None
+ *     HeaderDigest=None,CRC32C [6]
+ *     DataDigest=None,CRC32C [6]
  *     MaxConnections is irrelevant; we make only one connection anyway [4]
- *     InitialR2T=Yes [1]
- *     ImmediateData is irrelevant; we never send immediate data [4]
- *     MaxRecvDataSegmentLength=8192 (default; we don't care) [3]
+ *     InitialR2T=No [1]
+ *     ImmediateData=Yes [1]
+ *     MaxRecvDataSegmentLength=65536 [5]
  *     MaxBurstLength=262144 (default; we don't care) [3]
- *     FirstBurstLength=262144 (default; we don't care)
+ *     FirstBurstLength=65536 (default) [1]
  *     DefaultTime2Wait=0 [2]
  *     DefaultTime2Retain=0 [2]
- *     MaxOutstandingR2T=1
+ *     MaxOutstandingR2T=4 [1]
  *     DataPDUInOrder=Yes
  *     DataSequenceInOrder=Yes
  *     ErrorRecoveryLevel=0
  *
- * [1] InitialR2T has an OR resolution function, so the target may
- * force us to use it.  We therefore simplify our logic by always
- * using it.
+ * [1] These allow writes to avoid waiting for an R2T before sending
+ * the first burst of data, and allow the target to request several
+ * bursts at once.  InitialR2T has an OR resolution function and
+ * ImmediateData has an AND resolution function, so the target may
+ * force us to fall back to waiting for an R2T for each burst.  We
+ * handle R2Ts in order of arrival, which satisfies
+ * DataSequenceInOrder=Yes.
  *
  * [2] These ensure that we can safely start a new task once we have
  * reconnected after a failure, without having to manually tidy up
@@ -655,6 +900,15 @@ static int iscsi_rx_nop_in ( struct iscsi_session *iscsi,
  * these parameters, but some targets (notably a QNAP TS-639Pro) fail
  * unless they are supplied, so we explicitly specify the default
  * values.
+ *
+ * [5] Received data-in PDUs are processed as they arrive rather than
+ * being buffered, so we can accept PDUs considerably larger than the
+ * default, reducing the per-PDU overhead on reads.
+ *
+ * [6] Digests are offered but not insisted upon, unless
+ * ISCSI_DIGESTS_REQUIRED is defined, in which case we offer only
+ * CRC32C.  Digests take effect from the first PDU of the full
+ * feature phase.
  */
 static int iscsi_build_login_request_strings ( struct iscsi_session *iscsi,
 					       void *data, size_t len ) {
@@ -706,20 +960,25 @@ static int iscsi_build_login_request_strings ( struct iscsi_session *iscsi,
 
 	if ( iscsi->status & ISCSI_STATUS_STRINGS_OPERATIONAL ) {
 		used += ssnprintf ( data + used, len - used,
-				    "HeaderDigest=None%c"
-				    "DataDigest=None%c"
+				    "HeaderDigest=%s%c"
+				    "DataDigest=%s%c"
 				    "MaxConnections=1%c"
-				    "InitialR2T=Yes%c"
-				    "ImmediateData=No%c"
-				    "MaxRecvDataSegmentLength=8192%c"
+				    "InitialR2T=No%c"
+				    "ImmediateData=Yes%c"
+				    "MaxRecvDataSegmentLength=%d%c"
 				    "MaxBurstLength=262144%c"
+				    "FirstBurstLength=%d%c"
 				    "DefaultTime2Wait=0%c"
 				    "DefaultTime2Retain=0%c"
-				    "MaxOutstandingR2T=1%c"
+				    "MaxOutstandingR2T=%d%c"
 				    "DataPDUInOrder=Yes%c"
 				    "DataSequenceInOrder=Yes%c"
 				    "ErrorRecoveryLevel=0%c",
-				    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 );
+				    ISCSI_DIGEST_OFFER, 0,
+				    ISCSI_DIGEST_OFFER, 0, 0, 0, 0,
+				    ISCSI_MAX_RECV_DATA_SEG_LEN, 0, 0,
+				    ISCSI_FIRST_BURST_LEN, 0, 0, 0,
+				    ISCSI_MAX_OUTSTANDING_R2T, 0, 0, 0, 0 );
 	}
 
 	return used;
@@ -1079,6 +1338,151 @@ static int iscsi_handle_chap_r_value ( struct iscsi_session *iscsi,
 	return 0;
 }
 
+/**
+ * Parse iSCSI numerical text value
+ *
+ * @v value		Text value
+ * @v num		Numerical value to fill in
+ * @ret rc		Return status code
+ */
+static int iscsi_numerical_value ( const char *value, unsigned long *num ) {
+	char *endp;
+
+	*num = strtoul ( value, &endp, 0 );
+	if ( ( *endp != '\0' ) || ( endp == value ) )
+		return -EINVAL;
+
+	return 0;
+}
+
+/**
+ * Handle iSCSI HeaderDigest or DataDigest text value
+ *
+ * @v iscsi		iSCSI session
+ * @v value		Digest value
+ * @v digest		Digest flag (ISCSI_DIGEST_XXX)
+ * @ret rc		Return status code
+ */
+static int iscsi_handle_digest_value ( struct iscsi_session *iscsi,
+				       const char *value,
+				       unsigned int digest ) {
+
+	if ( strcmp ( value, "CRC32C" ) == 0 ) {
+		iscsi->digests |= digest;
+		return 0;
+	}
+
+	iscsi->digests &= ~digest;
+#ifdef ISCSI_DIGESTS_REQUIRED
+	DBGC ( iscsi, "iSCSI %p target refused required digest (\"%s\")\n",
+	       iscsi, value );
+	return -ENOTSUP_DIGEST;
+#else
+	return 0;
+#endif
+}
+
+/**
+ * Handle iSCSI HeaderDigest text value
+ *
+ * @v iscsi		iSCSI session
+ * @v value		HeaderDigest value
+ * @ret rc		Return status code
+ */
+static int iscsi_handle_headerdigest_value ( struct iscsi_session *iscsi,
+					     const char *value ) {
+	return iscsi_handle_digest_value ( iscsi, value, ISCSI_DIGEST_HEADER );
+}
+
+/**
+ * Handle iSCSI DataDigest text value
+ *
+ * @v iscsi		iSCSI session
+ * @v value		DataDigest value
+ * @ret rc		Return status code
+ */
+static int iscsi_handle_datadigest_value ( struct iscsi_session *iscsi,
+					   const char *value ) {
+	return iscsi_handle_digest_value ( iscsi, value, ISCSI_DIGEST_DATA );
+}
+
+/**
+ * Handle iSCSI InitialR2T text value
+ *
+ * @v iscsi		iSCSI session
+ * @v value		InitialR2T value
+ * @ret rc		Return status code
+ */
+static int iscsi_handle_initialr2t_value ( struct iscsi_session *iscsi,
+					   const char *value ) {
+
+	iscsi->initial_r2t = ( strcmp ( value, "No" ) != 0 );
+	return 0;
+}
+
+/**
+ * Handle iSCSI ImmediateData text value
+ *
+ * @v iscsi		iSCSI session
+ * @v value		ImmediateData value
+ * @ret rc		Return status code
+ */
+static int iscsi_handle_immediatedata_value ( struct iscsi_session *iscsi,
+					      const char *value ) {
+
+	iscsi->immediate_data = ( strcmp ( value, "Yes" ) == 0 );
+	return 0;
+}
+
+/**
+ * Handle iSCSI FirstBurstLength text value
+ *
+ * @v iscsi		iSCSI session
+ * @v value		FirstBurstLength value
+ * @ret rc		Return status code
+ */
+static int iscsi_handle_firstburstlength_value ( struct iscsi_session *iscsi,
+						 const char *value ) {
+	unsigned long len;
+
+	/* Ignore non-numerical values such as "Irrelevant" */
+	if ( iscsi_numerical_value ( value, &len ) != 0 )
+		return 0;
+
+	/* FirstBurstLength has a minimum resolution function */
+	if ( len < iscsi->first_burst_len )
+		iscsi->first_burst_len = len;
+
+	return 0;
+}
+
+/**
+ * Handle iSCSI MaxRecvDataSegmentLength text value
+ *
+ * @v iscsi		iSCSI session
+ * @v value		MaxRecvDataSegmentLength value
+ * @ret rc		Return status code
+ */
+static int
+iscsi_handle_maxrecvdatasegmentlength_value ( struct iscsi_session *iscsi,
+					      const char *value ) {
+	unsigned long len;
+
+	/* Ignore invalid values */
+	if ( ( iscsi_numerical_value ( value, &len ) != 0 ) || ( len == 0 ) )
+		return 0;
+
+	/* This is a declaration of the target's receive limit.  Avoid
+	 * allocating excessively large I/O buffers if the target's
+	 * limit is larger than our own.
+	 */
+	if ( len > ISCSI_MAX_RECV_DATA_SEG_LEN )
+		len = ISCSI_MAX_RECV_DATA_SEG_LEN;
+	iscsi->max_send_len = len;
+
+	return 0;
+}
+
 /** An iSCSI text string that we want to handle */
 struct iscsi_string_type {
 	/** String key
@@ -1105,6 +1509,13 @@ static struct iscsi_string_type iscsi_string_types[] = {
 	{ "CHAP_C=", iscsi_handle_chap_c_value },
 	{ "CHAP_N=", iscsi_handle_chap_n_value },
 	{ "CHAP_R=", iscsi_handle_chap_r_value },
+	{ "HeaderDigest=", iscsi_handle_headerdigest_value },
+	{ "DataDigest=", iscsi_handle_datadigest_value },
+	{ "InitialR2T=", iscsi_handle_initialr2t_value },
+	{ "ImmediateData=", iscsi_handle_immediatedata_value },
+	{ "FirstBurstLength=", iscsi_handle_firstburstlength_value },
+	{ "MaxRecvDataSegmentLength=",
+	  iscsi_handle_maxrecvdatasegmentlength_value },
 	{ NULL, NULL }
 };
 
@@ -1291,8 +1702,23 @@ static int iscsi_rx_login_response ( struct iscsi_session *iscsi,
 		return -EPROTO;
 	}
 
+#ifdef ISCSI_DIGESTS_REQUIRED
+	/* Check that the target agreed to use both digests.  A target
+	 * that omits either key has not agreed.
+	 */
+	if ( ( iscsi->digests & ( ISCSI_DIGEST_HEADER | ISCSI_DIGEST_DATA ) )
+	     != ( ISCSI_DIGEST_HEADER | ISCSI_DIGEST_DATA ) ) {
+		DBGC ( iscsi, "iSCSI %p target did not agree to required "
+		       "digests\n", iscsi );
+		return -ENOTSUP_DIGEST;
+	}
+#endif
+
 	/* Notify SCSI layer of window change */
-	DBGC ( iscsi, "iSCSI %p entering full feature phase\n", iscsi );
+	DBGC ( iscsi, "iSCSI %p entering full feature phase (digests:%s%s)\n",
+	       iscsi, ( ( iscsi->digests & ISCSI_DIGEST_HEADER ) ?
+			" header" : "" ),
+	       ( ( iscsi->digests & ISCSI_DIGEST_DATA ) ? " data" : "" ) );
 	xfer_window_changed ( &iscsi->control );
 
 	return 0;
@@ -1336,6 +1762,13 @@ static void iscsi_start_tx ( struct iscsi_session *iscsi ) {
 
 	/* Initialise TX BHS */
 	memset ( &iscsi->tx_bhs, 0, sizeof ( iscsi->tx_bhs ) );
+	iscsi->tx_task = NULL;
+
+	/* Digests apply only within the full feature phase */
+	iscsi->tx_digests = ( ( ( iscsi->status & ISCSI_STATUS_PHASE_MASK ) ==
+				ISCSI_STATUS_FULL_FEATURE_PHASE ) ?
+			      iscsi->digests : 0 );
+	iscsi->tx_crc = ~0;
 
 	/* Flag TX engine to start transmitting */
 	iscsi->tx_state = ISCSI_TX_BHS;
@@ -1365,6 +1798,24 @@ static int iscsi_tx_bhs ( struct iscsi_session *iscsi ) {
 				  sizeof ( iscsi->tx_bhs ) );
 }
 
+/**
+ * Transmit header digest of an iSCSI PDU
+ *
+ * @v iscsi		iSCSI session
+ * @ret rc		Return status code
+ */
+static int iscsi_tx_header_digest ( struct iscsi_session *iscsi ) {
+	uint32_t digest;
+
+	if ( ! ( iscsi->tx_digests & ISCSI_DIGEST_HEADER ) )
+		return 0;
+
+	digest = cpu_to_le32 ( ~crc32c_le ( ~0, &iscsi->tx_bhs,
+					    sizeof ( iscsi->tx_bhs ) ) );
+	return xfer_deliver_raw ( &iscsi->socket, &digest,
+				  sizeof ( digest ) );
+}
+
 /**
  * Transmit data segment of an iSCSI PDU
  *
@@ -1378,6 +1829,8 @@ static int iscsi_tx_data ( struct iscsi_session *iscsi ) {
 	struct iscsi_bhs_common *common = &iscsi->tx_bhs.common;
 
 	switch ( common->opcode & ISCSI_OPCODE_MASK ) {
+	case ISCSI_OPCODE_SCSI_COMMAND:
+		return iscsi_tx_command_data ( iscsi );
 	case ISCSI_OPCODE_DATA_OUT:
 		return iscsi_tx_data_out ( iscsi );
 	case ISCSI_OPCODE_LOGIN_REQUEST:
@@ -1406,9 +1859,34 @@ static int iscsi_tx_data_padding ( struct iscsi_session *iscsi ) {
 	if ( ! pad_len )
 		return 0;
 
+	if ( iscsi->tx_digests & ISCSI_DIGEST_DATA )
+		iscsi->tx_crc = crc32c_le ( iscsi->tx_crc, pad, pad_len );
+
 	return xfer_deliver_raw ( &iscsi->socket, pad, pad_len );
 }
 
+/**
+ * Transmit data digest of an iSCSI PDU
+ *
+ * @v iscsi		iSCSI session
+ * @ret rc		Return status code
+ *
+ * The data digest is sent only for PDUs with a non-empty data
+ * segment.
+ */
+static int iscsi_tx_data_digest ( struct iscsi_session *iscsi ) {
+	struct iscsi_bhs_common *common = &iscsi->tx_bhs.common;
+	uint32_t digest;
+
+	if ( ! ( ( iscsi->tx_digests & ISCSI_DIGEST_DATA ) &&
+		 ISCSI_DATA_LEN ( common->lengths ) ) )
+		return 0;
+
+	digest = cpu_to_le32 ( ~iscsi->tx_crc );
+	return xfer_deliver_raw ( &iscsi->socket, &digest,
+				  sizeof ( digest ) );
+}
+
 /**
  * Complete iSCSI PDU transmission
  *
@@ -1425,10 +1903,13 @@ static void iscsi_tx_done ( struct iscsi_session *iscsi ) {
 	iscsi_tx_pause ( iscsi );
 
 	switch ( common->opcode & ISCSI_OPCODE_MASK ) {
+	case ISCSI_OPCODE_SCSI_COMMAND:
 	case ISCSI_OPCODE_DATA_OUT:
-		iscsi_data_out_done ( iscsi );
+		iscsi_tx_next ( iscsi );
+		break;
 	case ISCSI_OPCODE_LOGIN_REQUEST:
 		iscsi_login_request_done ( iscsi );
+		break;
 	default:
 		/* No action */
 		break;
@@ -1462,6 +1943,12 @@ static void iscsi_tx_step ( struct iscsi_session *iscsi ) {
 		case ISCSI_TX_AHS:
 			tx = iscsi_tx_nothing;
 			tx_len = 0;
+			next_state = ISCSI_TX_HEADER_DIGEST;
+			break;
+		case ISCSI_TX_HEADER_DIGEST:
+			tx = iscsi_tx_header_digest;
+			tx_len = ( ( iscsi->tx_digests & ISCSI_DIGEST_HEADER ) ?
+				   sizeof ( uint32_t ) : 0 );
 			next_state = ISCSI_TX_DATA;
 			break;
 		case ISCSI_TX_DATA:
@@ -1472,6 +1959,13 @@ static void iscsi_tx_step ( struct iscsi_session *iscsi ) {
 		case ISCSI_TX_DATA_PADDING:
 			tx = iscsi_tx_data_padding;
 			tx_len = ISCSI_DATA_PAD_LEN ( common->lengths );
+			next_state = ISCSI_TX_DATA_DIGEST;
+			break;
+		case ISCSI_TX_DATA_DIGEST:
+			tx = iscsi_tx_data_digest;
+			tx_len = ( ( ( iscsi->tx_digests & ISCSI_DIGEST_DATA ) &&
+				     ISCSI_DATA_LEN ( common->lengths ) ) ?
+				   sizeof ( uint32_t ) : 0 );
 			next_state = ISCSI_TX_IDLE;
 			break;
 		case ISCSI_TX_IDLE:
@@ -1557,6 +2051,42 @@ static int iscsi_rx_discard ( struct iscsi_session *iscsi __unused,
 	return 0;
 }
 
+/**
+ * Receive header digest of an iSCSI PDU
+ *
+ * @v iscsi		iSCSI session
+ * @v data		Received data
+ * @v len		Length of received data
+ * @v remaining		Data remaining after this data
+ * @ret rc		Return status code
+ *
+ * iscsi::rx_crc holds the CRC32C of the BHS and AHS when this is
+ * called.
+ */
+static int iscsi_rx_header_digest ( struct iscsi_session *iscsi,
+				    const void *data, size_t len,
+				    size_t remaining ) {
+	uint32_t expected;
+
+	/* Do nothing unless header digest is in use */
+	if ( ! iscsi->rx_len )
+		return 0;
+
+	memcpy ( &iscsi->rx_digest.bytes[iscsi->rx_offset], data, len );
+	if ( remaining )
+		return 0;
+
+	expected = ~iscsi->rx_crc;
+	if ( le32_to_cpu ( iscsi->rx_digest.crc ) != expected ) {
+		DBGC ( iscsi, "iSCSI %p header digest mismatch (got %08x, "
+		       "expected %08x)\n", iscsi,
+		       le32_to_cpu ( iscsi->rx_digest.crc ), expected );
+		return -EIO_HEADER_DIGEST;
+	}
+
+	return 0;
+}
+
 /**
  * Receive data segment of an iSCSI PDU
  *
@@ -1573,10 +2103,25 @@ static int iscsi_rx_data ( struct iscsi_session *iscsi, const void *data,
 			   size_t len, size_t remaining ) {
 	struct iscsi_bhs_common_response *response
 		= &iscsi->rx_bhs.common_response;
-
-	/* Update cmdsn and statsn */
-	iscsi->cmdsn = ntohl ( response->expcmdsn );
+	uint32_t expcmdsn = ntohl ( response->expcmdsn );
+	uint32_t maxcmdsn = ntohl ( response->maxcmdsn );
+
+	/* Update statsn and command window.  The initial cmdsn and
+	 * command window are determined by the login response;
+	 * thereafter we assign command sequence numbers ourselves as
+	 * commands are issued.  As per RFC 3720 section 3.2.2.1, a
+	 * MaxCmdSN that is not serially greater than the current
+	 * value, or that is less than ExpCmdSN-1, is ignored.
+	 */
 	iscsi->statsn = ntohl ( response->statsn );
+	if ( ( response->opcode & ISCSI_OPCODE_MASK ) ==
+	     ISCSI_OPCODE_LOGIN_RESPONSE ) {
+		iscsi->cmdsn = expcmdsn;
+		iscsi->maxcmdsn = maxcmdsn;
+	} else if ( ( ( int32_t ) ( maxcmdsn - ( expcmdsn - 1 ) ) >= 0 ) &&
+		    ( ( int32_t ) ( maxcmdsn - iscsi->maxcmdsn ) > 0 ) ) {
+		iscsi->maxcmdsn = maxcmdsn;
+	}
 
 	switch ( response->opcode & ISCSI_OPCODE_MASK ) {
 	case ISCSI_OPCODE_LOGIN_RESPONSE:
@@ -1598,6 +2143,58 @@ static int iscsi_rx_data ( struct iscsi_session *iscsi, const void *data,
 	}
 }
 
+/**
+ * Receive data digest of an iSCSI PDU
+ *
+ * @v iscsi		iSCSI session
+ * @v data		Received data
+ * @v len		Length of received data
+ * @v remaining		Data remaining after this data
+ * @ret rc		Return status code
+ *
+ * iscsi::rx_crc holds the CRC32C of the data segment and padding
+ * when this is called.  Completion of the data segment is deferred
+ * until the digest has been verified, so that a corrupted PDU is
+ * never acted upon.
+ */
+static int iscsi_rx_data_digest ( struct iscsi_session *iscsi,
+				  const void *data, size_t len,
+				  size_t remaining ) {
+	struct iscsi_bhs_common *common = &iscsi->rx_bhs.common;
+	size_t offset = iscsi->rx_offset;
+	size_t digest_len = iscsi->rx_len;
+	uint32_t expected;
+	int rc;
+
+	/* Do nothing unless data digest is in use */
+	if ( ! iscsi->rx_len )
+		return 0;
+
+	memcpy ( &iscsi->rx_digest.bytes[iscsi->rx_offset], data, len );
+	if ( remaining )
+		return 0;
+
+	expected = ~iscsi->rx_crc;
+	if ( le32_to_cpu ( iscsi->rx_digest.crc ) != expected ) {
+		DBGC ( iscsi, "iSCSI %p data digest mismatch (got %08x, "
+		       "expected %08x)\n", iscsi,
+		       le32_to_cpu ( iscsi->rx_digest.crc ), expected );
+		return -EIO_DATA_DIGEST;
+	}
+
+	/* Complete the deferred data segment processing */
+	iscsi->rx_offset = iscsi->rx_len = ISCSI_DATA_LEN ( common->lengths );
+	rc = iscsi_rx_data ( iscsi, NULL, 0, 0 );
+
+	/* Restore RX state, unless the connection has been reset */
+	if ( iscsi->rx_state == ISCSI_RX_DATA_DIGEST ) {
+		iscsi->rx_offset = offset;
+		iscsi->rx_len = digest_len;
+	}
+
+	return rc;
+}
+
 /**
  * Receive new data
  *
@@ -1620,6 +2217,7 @@ static int iscsi_socket_deliver ( struct iscsi_session *iscsi,
 	int ( * rx ) ( struct iscsi_session *iscsi, const void *data,
 		       size_t len, size_t remaining );
 	enum iscsi_rx_state next_state;
+	unsigned int digest;
 	size_t frag_len;
 	size_t remaining;
 	int rc;
@@ -1629,21 +2227,42 @@ static int iscsi_socket_deliver ( struct iscsi_session *iscsi,
 		case ISCSI_RX_BHS:
 			rx = iscsi_rx_bhs;
 			iscsi->rx_len = sizeof ( iscsi->rx_bhs );
+			digest = ISCSI_DIGEST_HEADER;
 			next_state = ISCSI_RX_AHS;			
 			break;
 		case ISCSI_RX_AHS:
 			rx = iscsi_rx_discard;
 			iscsi->rx_len = 4 * ISCSI_AHS_LEN ( common->lengths );
+			digest = ISCSI_DIGEST_HEADER;
+			next_state = ISCSI_RX_HEADER_DIGEST;
+			break;
+		case ISCSI_RX_HEADER_DIGEST:
+			rx = iscsi_rx_header_digest;
+			iscsi->rx_len =
+				( ( iscsi->rx_digests & ISCSI_DIGEST_HEADER ) ?
+				  sizeof ( iscsi->rx_digest ) : 0 );
+			digest = 0;
 			next_state = ISCSI_RX_DATA;
 			break;
 		case ISCSI_RX_DATA:
 			rx = iscsi_rx_data;
 			iscsi->rx_len = ISCSI_DATA_LEN ( common->lengths );
+			digest = ISCSI_DIGEST_DATA;
 			next_state = ISCSI_RX_DATA_PADDING;
 			break;
 		case ISCSI_RX_DATA_PADDING:
 			rx = iscsi_rx_discard;
 			iscsi->rx_len = ISCSI_DATA_PAD_LEN ( common->lengths );
+			digest = ISCSI_DIGEST_DATA;
+			next_state = ISCSI_RX_DATA_DIGEST;
+			break;
+		case ISCSI_RX_DATA_DIGEST:
+			rx = iscsi_rx_data_digest;
+			iscsi->rx_len =
+				( ( ( iscsi->rx_digests & ISCSI_DIGEST_DATA ) &&
+				    ISCSI_DATA_LEN ( common->lengths ) ) ?
+				  sizeof ( iscsi->rx_digest ) : 0 );
+			digest = 0;
 			next_state = ISCSI_RX_BHS;
 			break;
 		default:
@@ -1656,6 +2275,39 @@ static int iscsi_socket_deliver ( struct iscsi_session *iscsi,
 		if ( frag_len > iob_len ( iobuf ) )
 			frag_len = iob_len ( iobuf );
 		remaining = iscsi->rx_len - iscsi->rx_offset - frag_len;
+
+		/* Defer completion of a digested data segment until
+		 * the data digest has been verified.
+		 */
+		if ( ( iscsi->rx_state == ISCSI_RX_DATA ) &&
+		     ( iscsi->rx_digests & ISCSI_DIGEST_DATA ) &&
+		     iscsi->rx_len ) {
+			remaining += ( ISCSI_DATA_PAD_LEN ( common->lengths ) +
+				       sizeof ( iscsi->rx_digest ) );
+		}
+
+		/* Start header digest at start of PDU (digests apply
+		 * only within the full feature phase), and data
+		 * digest at start of data segment.
+		 */
+		if ( ( iscsi->rx_state == ISCSI_RX_BHS ) &&
+		     ( iscsi->rx_offset == 0 ) ) {
+			iscsi->rx_digests =
+				( ( ( iscsi->status & ISCSI_STATUS_PHASE_MASK )
+				    == ISCSI_STATUS_FULL_FEATURE_PHASE ) ?
+				  iscsi->digests : 0 );
+			iscsi->rx_crc = ~0;
+		}
+		if ( ( iscsi->rx_state == ISCSI_RX_DATA ) &&
+		     ( iscsi->rx_offset == 0 ) )
+			iscsi->rx_crc = ~0;
+
+		/* Accumulate header or data digest, if in use */
+		if ( iscsi->rx_digests & digest ) {
+			iscsi->rx_crc = crc32c_le ( iscsi->rx_crc, iobuf->data,
+						    frag_len );
+		}
+
 		if ( ( rc = rx ( iscsi, iobuf->data, frag_len,
 				 remaining ) ) != 0 ) {
 			DBGC ( iscsi, "iSCSI %p could not process received "
@@ -1743,17 +2395,35 @@ static struct interface_descriptor iscsi_socket_desc =
  *
  * @v iscsi		iSCSI session
  * @ret len		Length of window
+ *
+ * The window is the number of further commands that may be issued,
+ * limited both by the number of unused tasks and by the target's
+ * command window (i.e. MaxCmdSN).
  */
 static size_t iscsi_scsi_window ( struct iscsi_session *iscsi ) {
+	int32_t cmds;
+	size_t window = 0;
+	unsigned int i;
 
-	if ( ( ( iscsi->status & ISCSI_STATUS_PHASE_MASK ) ==
-	       ISCSI_STATUS_FULL_FEATURE_PHASE ) &&
-	     ( iscsi->command == NULL ) ) {
-		/* We cannot handle concurrent commands */
-		return 1;
-	} else {
+	/* Refuse commands until login is complete */
+	if ( ( iscsi->status & ISCSI_STATUS_PHASE_MASK ) !=
+	     ISCSI_STATUS_FULL_FEATURE_PHASE )
 		return 0;
+
+	/* Count unused tasks */
+	for ( i = 0 ; i < ISCSI_MAX_TASKS ; i++ ) {
+		if ( ! iscsi->tasks[i].itt )
+			window++;
 	}
+
+	/* Limit to target's command window */
+	cmds = ( ( int32_t ) ( iscsi->maxcmdsn - iscsi->cmdsn ) + 1 );
+	if ( cmds <= 0 )
+		return 0;
+	if ( window > ( size_t ) cmds )
+		window = cmds;
+
+	return window;
 }
 
 /**
@@ -1767,31 +2437,41 @@ static size_t iscsi_scsi_window ( struct iscsi_session *iscsi ) {
 static int iscsi_scsi_command ( struct iscsi_session *iscsi,
 				struct interface *parent,
 				struct scsi_cmd *command ) {
+	struct iscsi_task *task;
+	unsigned int i;
 
-	/* This iSCSI implementation cannot handle multiple concurrent
-	 * commands or commands arriving before login is complete.
+	/* Refuse commands arriving before login is complete, or
+	 * beyond the limits of our flow-control window.
 	 */
 	if ( iscsi_scsi_window ( iscsi ) == 0 ) {
-		DBGC ( iscsi, "iSCSI %p cannot handle concurrent commands\n",
+		DBGC ( iscsi, "iSCSI %p cannot accept further commands\n",
 		       iscsi );
 		return -EOPNOTSUPP;
 	}
 
+	/* Find an unused task */
+	for ( i = 0 ; i < ISCSI_MAX_TASKS ; i++ ) {
+		task = &iscsi->tasks[i];
+		if ( ! task->itt )
+			break;
+	}
+	assert ( i < ISCSI_MAX_TASKS );
+
 	/* Store command */
-	iscsi->command = malloc ( sizeof ( *command ) );
-	if ( ! iscsi->command )
-		return -ENOMEM;
-	memcpy ( iscsi->command, command, sizeof ( *command ) );
+	memcpy ( &task->command, command, sizeof ( task->command ) );
 
-	/* Assign new ITT */
-	iscsi_new_itt ( iscsi );
+	/* Assign new ITT and CmdSN */
+	task->itt = iscsi_new_itt();
+	task->cmdsn = iscsi->cmdsn++;
+	assert ( task->transfer_cons == task->transfer_prod );
 
 	/* Start sending command */
-	iscsi_start_command ( iscsi );
+	task->command_pending = 1;
+	iscsi_tx_next ( iscsi );
 
 	/* Attach to parent interface and return */
-	intf_plug_plug ( &iscsi->data, parent );
-	return iscsi->itt;
+	intf_plug_plug ( &task->data, parent );
+	return task->itt;
 }
 
 /** iSCSI SCSI command-issuing interface operations */
@@ -1809,29 +2489,29 @@ static struct interface_descriptor iscsi_control_desc =
 /**
  * Close iSCSI command
  *
- * @v iscsi		iSCSI session
+ * @v task		iSCSI task
  * @v rc		Reason for close
  */
-static void iscsi_command_close ( struct iscsi_session *iscsi, int rc ) {
+static void iscsi_command_close ( struct iscsi_task *task, int rc ) {
 
 	/* Restart interface */
-	intf_restart ( &iscsi->data, rc );
+	intf_restart ( &task->data, rc );
 
 	/* Treat unsolicited command closures mid-command as fatal,
 	 * because we have no code to handle partially-completed PDUs.
 	 */
-	if ( iscsi->command != NULL )
-		iscsi_close ( iscsi, ( ( rc == 0 ) ? -ECANCELED : rc ) );
+	if ( task->itt )
+		iscsi_close ( task->iscsi, ( ( rc == 0 ) ? -ECANCELED : rc ) );
 }
 
 /** iSCSI SCSI command interface operations */
 static struct interface_operation iscsi_data_op[] = {
-	INTF_OP ( intf_close, struct iscsi_session *, iscsi_command_close ),
+	INTF_OP ( intf_close, struct iscsi_task *, iscsi_command_close ),
 };
 
 /** iSCSI SCSI command interface descriptor */
 static struct interface_descriptor iscsi_data_desc =
-	INTF_DESC ( struct iscsi_session, data, iscsi_data_op );
+	INTF_DESC ( struct iscsi_task, data, iscsi_data_op );
 
 /****************************************************************************
  *
@@ -2046,6 +2726,8 @@ static int iscsi_check_auth ( struct iscsi_session *iscsi ) {
  */
 static int iscsi_open ( struct interface *parent, struct uri *uri ) {
 	struct iscsi_session *iscsi;
+	struct iscsi_task *task;
+	unsigned int i;
 	int rc;
 
 	/* Sanity check */
@@ -2062,7 +2744,11 @@ static int iscsi_open ( struct interface *parent, struct uri *uri ) {
 	}
 	ref_init ( &iscsi->refcnt, iscsi_free );
 	intf_init ( &iscsi->control, &iscsi_control_desc, &iscsi->refcnt );
-	intf_init ( &iscsi->data, &iscsi_data_desc, &iscsi->refcnt );
+	for ( i = 0 ; i < ISCSI_MAX_TASKS ; i++ ) {
+		task = &iscsi->tasks[i];
+		task->iscsi = iscsi;
+		intf_init ( &task->data, &iscsi_data_desc, &iscsi->refcnt );
+	}
 	intf_init ( &iscsi->socket, &iscsi_socket_desc, &iscsi->refcnt );
 	process_init_stopped ( &iscsi->process, &iscsi_process_desc,
 			       &iscsi->refcnt );
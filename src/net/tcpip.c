@@ -4,6 +4,7 @@
 #include <byteswap.h>
 #include <ipxe/iobuf.h>
 #include <ipxe/tables.h>
+#include <ipxe/netdevice.h>
 #include <ipxe/tcpip.h>
 
 /** @file
@@ -19,6 +20,7 @@ FILE_LICENCE ( GPL2_OR_LATER );
 /** Process a received TCP/IP packet
  *
  * @v iobuf		I/O buffer
+ * @v netdev		Network device
  * @v tcpip_proto	Transport-layer protocol number
  * @v st_src		Partially-filled source address
  * @v st_dest		Partially-filled destination address
@@ -31,8 +33,8 @@ FILE_LICENCE ( GPL2_OR_LATER );
  * address family and the network-layer addresses, but leave the ports
  * and the rest of the structures as zero).
  */
-int tcpip_rx ( struct io_buffer *iobuf, uint8_t tcpip_proto, 
-	       struct sockaddr_tcpip *st_src,
+int tcpip_rx ( struct io_buffer *iobuf, struct net_device *netdev,
+	       uint8_t tcpip_proto, struct sockaddr_tcpip *st_src,
 	       struct sockaddr_tcpip *st_dest,
 	       uint16_t pshdr_csum ) {
 	struct tcpip_protocol *tcpip;
@@ -41,7 +43,8 @@ int tcpip_rx ( struct io_buffer *iobuf, uint8_t tcpip_proto,
 	for_each_table_entry ( tcpip, TCPIP_PROTOCOLS ) {
 		if ( tcpip->tcpip_proto == tcpip_proto ) {
 			DBG ( "TCP/IP received %s packet\n", tcpip->name );
-			return tcpip->rx ( iobuf, st_src, st_dest, pshdr_csum );
+			return tcpip->rx ( iobuf, netdev, st_src, st_dest,
+					   pshdr_csum );
 		}
 	}
 
@@ -79,6 +82,87 @@ int tcpip_tx ( struct io_buffer *iobuf, struct tcpip_protocol *tcpip_protocol,
 	return -EAFNOSUPPORT;
 }
 
+/**
+ * Calculate transport-layer checksum for transmission
+ *
+ * @v iobuf		I/O buffer
+ * @v netdev		Transmitting network device
+ * @v csum		Transport-layer checksum, as provided by transport
+ * @ret csum		Transport-layer checksum, excluding pseudo-header
+ *
+ * If the transport layer has deferred calculation of its checksum
+ * (by marking the I/O buffer with @c IOB_FL_CSUM_PARTIAL), then the
+ * checksum is calculated here unless the transmitting network device
+ * is capable of calculating it.  The network layer should add its
+ * pseudo-header checksum to the returned value and, if the I/O buffer
+ * is still marked with @c IOB_FL_CSUM_PARTIAL, store the complement
+ * of the result in the checksum field.
+ */
+uint16_t tcpip_tx_chksum ( struct io_buffer *iobuf, struct net_device *netdev,
+			   uint16_t csum ) {
+
+	/* Use existing checksum unless calculation was deferred */
+	if ( ! ( iobuf->flags & IOB_FL_CSUM_PARTIAL ) )
+		return csum;
+
+	/* Leave checksum to hardware, if possible */
+	if ( netdev->features & NETDEV_TX_CSUM )
+		return TCPIP_EMPTY_CSUM;
+
+	/* Otherwise, calculate checksum in software */
+	iobuf->flags &= ~IOB_FL_CSUM_PARTIAL;
+	return tcpip_chksum ( iobuf->csum_start,
+			      ( iobuf->tail - iobuf->csum_start ) );
+}
+
+/**
+ * Determine maximum transmission unit
+ *
+ * @v st_dest		Destination address
+ * @ret mtu		Maximum transport-layer packet length, or zero
+ *
+ * A return value of zero indicates that the maximum transmission
+ * unit is unknown (e.g. because there is no route to the
+ * destination).
+ */
+size_t tcpip_mtu ( struct sockaddr_tcpip *st_dest ) {
+	struct tcpip_net_protocol *tcpip_net;
+
+	for_each_table_entry ( tcpip_net, TCPIP_NET_PROTOCOLS ) {
+		if ( ( tcpip_net->sa_family == st_dest->st_family ) &&
+		     tcpip_net->mtu ) {
+			return tcpip_net->mtu ( st_dest );
+		}
+	}
+	return 0;
+}
+
+/**
+ * Handle reduction in path MTU
+ *
+ * @v tcpip_proto	Transport-layer protocol number
+ * @v st_src		Source address of original packet
+ * @v st_dest		Destination address of original packet
+ * @v mtu		New maximum transport-layer packet length
+ *
+ * This function is called by the network layer upon receiving an
+ * indication (such as an ICMP "fragmentation needed" message) that
+ * a packet was too large for the path to its destination.
+ */
+void tcpip_pmtu ( uint8_t tcpip_proto, struct sockaddr_tcpip *st_src,
+		  struct sockaddr_tcpip *st_dest, size_t mtu ) {
+	struct tcpip_protocol *tcpip;
+
+	for_each_table_entry ( tcpip, TCPIP_PROTOCOLS ) {
+		if ( ( tcpip->tcpip_proto == tcpip_proto ) && tcpip->pmtu ) {
+			DBG ( "TCP/IP path MTU for %s reduced to %zd\n",
+			      tcpip->name, mtu );
+			tcpip->pmtu ( st_src, st_dest, mtu );
+			return;
+		}
+	}
+}
+
 /**
  * Calculate continued TCP/IP checkum
  *
@@ -97,8 +181,8 @@ int tcpip_tx ( struct io_buffer *iobuf, struct tcpip_protocol *tcpip_protocol,
  * or both.  Deciding which to swap is left as an exercise for the
  * interested reader.
  */
-uint16_t tcpip_continue_chksum ( uint16_t partial, const void *data,
-				 size_t len ) {
+uint16_t generic_tcpip_continue_chksum ( uint16_t partial, const void *data,
+					 size_t len ) {
 	unsigned int cksum = ( ( ~partial ) & 0xffff );
 	unsigned int value;
 	unsigned int i;
@@ -120,6 +204,26 @@ uint16_t tcpip_continue_chksum ( uint16_t partial, const void *data,
 	return ( ~cksum );
 }
 
+/**
+ * Copy data and calculate continued TCP/IP checksum
+ *
+ * @v partial		Checksum of already-summed data, in network byte order
+ * @v dest		Destination buffer
+ * @v src		Source buffer
+ * @v len		Length of data
+ * @ret cksum		Updated checksum, in network byte order
+ *
+ * This performs the equivalent of memcpy() followed by
+ * tcpip_continue_chksum() over the copied data.  Architectures may
+ * provide an implementation that touches each byte only once.
+ */
+uint16_t generic_tcpip_copy_chksum ( uint16_t partial, void *dest,
+				     const void *src, size_t len ) {
+
+	memcpy ( dest, src, len );
+	return tcpip_continue_chksum ( partial, dest, len );
+}
+
 /**
  * Calculate TCP/IP checkum
  *
@@ -264,12 +264,15 @@ static struct udp_connection * udp_demux ( struct sockaddr_tcpip *local ) {
  * Process a received packet
  *
  * @v iobuf		I/O buffer
+ * @v netdev		Network device
  * @v st_src		Partially-filled source address
  * @v st_dest		Partially-filled destination address
  * @v pshdr_csum	Pseudo-header checksum
  * @ret rc		Return status code
  */
-static int udp_rx ( struct io_buffer *iobuf, struct sockaddr_tcpip *st_src,
+static int udp_rx ( struct io_buffer *iobuf,
+		    struct net_device *netdev __unused,
+		    struct sockaddr_tcpip *st_src,
 		    struct sockaddr_tcpip *st_dest, uint16_t pshdr_csum ) {
 	struct udp_header *udphdr = iobuf->data;
 	struct udp_connection *udp;
@@ -299,7 +302,7 @@ static int udp_rx ( struct io_buffer *iobuf, struct sockaddr_tcpip *st_src,
 		rc = -EINVAL;
 		goto done;
 	}
-	if ( udphdr->chksum ) {
+	if ( udphdr->chksum && ! ( iobuf->flags & IOB_FL_CSUM_VALID ) ) {
 		csum = tcpip_continue_chksum ( pshdr_csum, iobuf->data, ulen );
 		if ( csum != 0 ) {
 			DBG ( "UDP checksum incorrect (is %04x including "
@@ -24,15 +24,19 @@ FILE_LICENCE ( GPL2_OR_LATER );
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
 #include <errno.h>
 #include <byteswap.h>
 #include <ipxe/refcnt.h>
+#include <ipxe/list.h>
 #include <ipxe/iobuf.h>
 #include <ipxe/xfer.h>
 #include <ipxe/open.h>
 #include <ipxe/resolv.h>
 #include <ipxe/retry.h>
+#include <ipxe/process.h>
+#include <ipxe/timer.h>
 #include <ipxe/tcpip.h>
 #include <ipxe/settings.h>
 #include <ipxe/features.h>
@@ -53,15 +57,41 @@ FEATURE ( FEATURE_PROTOCOL, "DNS", DHCP_EB_FEATURE_DNS, 1 );
 #define ENXIO_NO_NAMESERVER __einfo_error ( EINFO_ENXIO_NO_NAMESERVER )
 #define EINFO_ENXIO_NO_NAMESERVER \
 	__einfo_uniqify ( EINFO_ENXIO, 0x02, "No DNS servers available" )
+#define ENXIO_SERVER_FAILURE __einfo_error ( EINFO_ENXIO_SERVER_FAILURE )
+#define EINFO_ENXIO_SERVER_FAILURE \
+	__einfo_uniqify ( EINFO_ENXIO, 0x03, "All DNS servers failed" )
 
-/** The DNS server */
-static struct sockaddr_tcpip nameserver = {
-	.st_port = htons ( DNS_PORT ),
-};
+/** The DNS servers */
+static struct sockaddr_tcpip nameservers[DNS_MAX_NAMESERVERS];
+
+/** Number of DNS servers */
+static unsigned int num_nameservers;
 
 /** The local domain */
 static char *localdomain;
 
+/** A DNS cache entry */
+struct dns_cache_entry {
+	/** List of cache entries, most recently used first */
+	struct list_head list;
+	/** Time at which entry was created */
+	unsigned long created;
+	/** Lifetime of entry (in ticks) */
+	unsigned long lifetime;
+	/** Resolved address (for a positive entry) */
+	struct in_addr in_addr;
+	/** Status code (zero for a positive entry) */
+	int rc;
+	/** Fully-qualified name
+	 *
+	 * Must be at end of structure
+	 */
+	char name[0];
+};
+
+/** DNS cache */
+static LIST_HEAD ( dns_cache );
+
 /** A DNS request */
 struct dns_request {
 	/** Reference counter */
@@ -72,6 +102,8 @@ struct dns_request {
 	struct interface socket;
 	/** Retry timer */
 	struct retry_timer timer;
+	/** Cached result completion process */
+	struct process process;
 
 	/** Socket address to fill in with resolved address */
 	struct sockaddr sa;
@@ -85,8 +117,110 @@ struct dns_request {
 	struct dns_query_info *qinfo;
 	/** Recursion counter */
 	unsigned int recursion;
+	/** Minimum TTL of records used so far (in seconds) */
+	unsigned long ttl;
+	/** Servers which have reported a failure for the current query */
+	unsigned int failed;
+	/** Cached result status code */
+	int rc;
+	/** Fully-qualified name being resolved
+	 *
+	 * Must be at end of structure
+	 */
+	char fqdn[0];
 };
 
+/**
+ * Find DNS cache entry
+ *
+ * @v fqdn		Fully-qualified name
+ * @ret cache		DNS cache entry, or NULL if not found
+ *
+ * Expired entries are discarded.
+ */
+static struct dns_cache_entry * dns_cache_find ( const char *fqdn ) {
+	struct dns_cache_entry *cache;
+	struct dns_cache_entry *tmp;
+
+	list_for_each_entry_safe ( cache, tmp, &dns_cache, list ) {
+		if ( ( currticks() - cache->created ) >= cache->lifetime ) {
+			list_del ( &cache->list );
+			free ( cache );
+			continue;
+		}
+		if ( strcasecmp ( cache->name, fqdn ) == 0 ) {
+			/* Mark as most recently used */
+			list_del ( &cache->list );
+			list_add ( &cache->list, &dns_cache );
+			return cache;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Add DNS cache entry
+ *
+ * @v fqdn		Fully-qualified name
+ * @v in_addr		Resolved address (for a positive entry)
+ * @v rc		Status code (zero for a positive entry)
+ * @v ttl		Time to live (in seconds)
+ */
+static void dns_cache_add ( const char *fqdn, struct in_addr in_addr,
+			    int rc, unsigned long ttl ) {
+	struct dns_cache_entry *cache;
+	unsigned int count = 0;
+
+	/* Do not cache records which must not be cached */
+	if ( ! ttl )
+		return;
+	if ( ttl > DNS_CACHE_MAX_TTL )
+		ttl = DNS_CACHE_MAX_TTL;
+
+	/* Discard any existing entry for this name, and the least
+	 * recently used entry if the cache is full.
+	 */
+	if ( ( cache = dns_cache_find ( fqdn ) ) != NULL ) {
+		list_del ( &cache->list );
+		free ( cache );
+	}
+	list_for_each_entry ( cache, &dns_cache, list )
+		count++;
+	if ( count >= DNS_CACHE_SIZE ) {
+		cache = list_entry ( dns_cache.prev, struct dns_cache_entry,
+				     list );
+		list_del ( &cache->list );
+		free ( cache );
+	}
+
+	/* Create new entry */
+	cache = zalloc ( sizeof ( *cache ) + strlen ( fqdn ) + 1 /* NUL */ );
+	if ( ! cache )
+		return;
+	cache->created = currticks();
+	cache->lifetime = ( ttl * TICKS_PER_SEC );
+	cache->in_addr = in_addr;
+	cache->rc = rc;
+	strcpy ( cache->name, fqdn );
+	list_add ( &cache->list, &dns_cache );
+	DBG ( "DNS cached %s \"%s\" for %lds\n",
+	      ( rc ? "failure for" : inet_ntoa ( in_addr ) ), fqdn, ttl );
+}
+
+/**
+ * Flush DNS cache
+ *
+ */
+static void dns_cache_flush ( void ) {
+	struct dns_cache_entry *cache;
+	struct dns_cache_entry *tmp;
+
+	list_for_each_entry_safe ( cache, tmp, &dns_cache, list ) {
+		list_del ( &cache->list );
+		free ( cache );
+	}
+}
+
 /**
  * Mark DNS request as complete
  *
@@ -95,8 +229,9 @@ struct dns_request {
  */
 static void dns_done ( struct dns_request *dns, int rc ) {
 
-	/* Stop the retry timer */
+	/* Stop the retry timer and cached result process */
 	stop_timer ( &dns->timer );
+	process_del ( &dns->process );
 
 	/* Shut down interfaces */
 	intf_shutdown ( &dns->socket, rc );
@@ -191,6 +326,116 @@ static union dns_rr_info * dns_find_rr ( struct dns_request *dns,
 	return NULL;
 }
 
+/**
+ * Skip over a (possibly compressed) DNS name within a reply
+ *
+ * @v name		DNS name
+ * @v end		End of reply
+ * @ret name		Next DNS name, or NULL if name overruns the reply
+ */
+static const char * dns_skip_name_within ( const char *name,
+					   const char *end ) {
+	while ( name < end ) {
+		if ( ! *name ) {
+			/* End of name */
+			return ( name + 1 );
+		}
+		if ( *name & 0xc0 ) {
+			/* Start of a compressed name */
+			return ( ( ( end - name ) >= 2 ) ? ( name + 2 ) : NULL );
+		}
+		/* Uncompressed name portion */
+		name += *name + 1;
+	}
+	return NULL;
+}
+
+/**
+ * Skip over an RR within a reply
+ *
+ * @v p			RR
+ * @v end		End of reply
+ * @v rr_info		RR information to fill in
+ * @ret next		Next RR, or NULL if RR overruns the reply
+ */
+static const char * dns_skip_rr_within ( const char *p, const char *end,
+					 const union dns_rr_info **rr_info ) {
+	size_t remaining;
+
+	p = dns_skip_name_within ( p, end );
+	if ( ! p )
+		return NULL;
+	*rr_info = ( ( const union dns_rr_info * ) p );
+	remaining = ( end - p );
+	if ( remaining < sizeof ( (*rr_info)->common ) )
+		return NULL;
+	remaining -= sizeof ( (*rr_info)->common );
+	if ( remaining < ntohs ( (*rr_info)->common.rdlength ) )
+		return NULL;
+	return ( p + sizeof ( (*rr_info)->common ) +
+		 ntohs ( (*rr_info)->common.rdlength ) );
+}
+
+/**
+ * Determine negative caching TTL from a DNS reply
+ *
+ * @v reply		DNS reply
+ * @v len		Length of DNS reply
+ * @ret ttl		Negative caching TTL (in seconds)
+ *
+ * As described in RFC 2308, this is the lesser of the TTL and the
+ * MINIMUM field of the SOA record in the authority section, if
+ * present.  The reply has not been validated beyond its header, so
+ * the default negative TTL is used if any record overruns it.
+ */
+static unsigned long dns_negative_ttl ( const struct dns_header *reply,
+					size_t len ) {
+	const char *end = ( ( ( const char * ) reply ) + len );
+	const char *p = ( ( ( const char * ) reply ) + sizeof ( *reply ) );
+	const union dns_rr_info *rr_info;
+	const struct dns_soa_tail *soa;
+	const char *names;
+	unsigned long ttl;
+	int i;
+
+	/* Skip over the questions and answers sections */
+	for ( i = ntohs ( reply->qdcount ) ; i > 0 ; i-- ) {
+		p = dns_skip_name_within ( p, end );
+		if ( ( ! p ) ||
+		     ( ( size_t ) ( end - p ) <
+		       sizeof ( struct dns_query_info ) ) )
+			return DNS_DEFAULT_NEGATIVE_TTL;
+		p += sizeof ( struct dns_query_info );
+	}
+	for ( i = ntohs ( reply->ancount ) ; i > 0 ; i-- ) {
+		p = dns_skip_rr_within ( p, end, &rr_info );
+		if ( ! p )
+			return DNS_DEFAULT_NEGATIVE_TTL;
+	}
+
+	/* Look for an SOA record in the authority section */
+	for ( i = ntohs ( reply->nscount ) ; i > 0 ; i-- ) {
+		p = dns_skip_rr_within ( p, end, &rr_info );
+		if ( ! p )
+			return DNS_DEFAULT_NEGATIVE_TTL;
+		if ( rr_info->common.type != htons ( DNS_TYPE_SOA ) )
+			continue;
+		names = dns_skip_name_within ( rr_info->soa.names, p );
+		if ( names )
+			names = dns_skip_name_within ( names, p );
+		if ( ( ! names ) ||
+		     ( ( size_t ) ( p - names ) < sizeof ( *soa ) ) )
+			return DNS_DEFAULT_NEGATIVE_TTL;
+		soa = ( ( const struct dns_soa_tail * ) names );
+		ttl = ntohl ( rr_info->common.ttl );
+		if ( ttl > ntohl ( soa->minimum ) )
+			ttl = ntohl ( soa->minimum );
+		return ttl;
+	}
+
+	return DNS_DEFAULT_NEGATIVE_TTL;
+}
+
 /**
  * Append DHCP domain name if available and name is not fully qualified
  *
@@ -292,20 +537,53 @@ static char * dns_decompress_name ( const struct dns_header *reply,
  */
 static int dns_send_packet ( struct dns_request *dns ) {
 	static unsigned int qid = 0;
+	struct xfer_metadata meta;
 	size_t qlen;
+	unsigned int i;
+	int rc = 0;
 
 	/* Increment query ID */
 	dns->query.dns.id = htons ( ++qid );
+	dns->failed = 0;
 
 	DBGC ( dns, "DNS %p sending query ID %d\n", dns, qid );
 
 	/* Start retransmission timer */
 	start_timer ( &dns->timer );
 
-	/* Send the data */
+	/* Send the query to all servers in parallel; the first
+	 * useful answer wins.
+	 */
 	qlen = ( ( ( void * ) dns->qinfo ) - ( ( void * ) &dns->query )
 		 + sizeof ( dns->qinfo ) );
-	return xfer_deliver_raw ( &dns->socket, &dns->query, qlen );
+	memset ( &meta, 0, sizeof ( meta ) );
+	for ( i = 0 ; i < num_nameservers ; i++ ) {
+		meta.dest = ( ( struct sockaddr * ) &nameservers[i] );
+		rc = xfer_deliver_raw_meta ( &dns->socket, &dns->query, qlen,
+					     &meta );
+	}
+	return rc;
+}
+
+/**
+ * Identify DNS server
+ *
+ * @v sa		Socket address
+ * @ret index		Server index, or negative if not a known server
+ */
+static int dns_server_index ( struct sockaddr *sa ) {
+	struct sockaddr_in *sin = ( ( struct sockaddr_in * ) sa );
+	struct sockaddr_in *server;
+	unsigned int i;
+
+	for ( i = 0 ; i < num_nameservers ; i++ ) {
+		server = ( ( struct sockaddr_in * ) &nameservers[i] );
+		if ( ( sin->sin_family == server->sin_family ) &&
+		     ( sin->sin_addr.s_addr == server->sin_addr.s_addr ) &&
+		     ( sin->sin_port == server->sin_port ) )
+			return i;
+	}
+	return -1;
 }
 
 /**
@@ -335,11 +613,14 @@ static void dns_timer_expired ( struct retry_timer *timer, int fail ) {
  */
 static int dns_xfer_deliver ( struct dns_request *dns,
 			      struct io_buffer *iobuf,
-			      struct xfer_metadata *meta __unused ) {
+			      struct xfer_metadata *meta ) {
 	const struct dns_header *reply = iobuf->data;
 	union dns_rr_info *rr_info;
 	struct sockaddr_in *sin;
 	unsigned int qtype = dns->qinfo->qtype;
+	unsigned int rcode;
+	unsigned long ttl;
+	int server;
 	int rc;
 
 	/* Sanity check */
@@ -359,7 +640,31 @@ static int dns_xfer_deliver ( struct dns_request *dns,
 		goto done;
 	}
 
-	DBGC ( dns, "DNS %p received reply ID %d\n", dns, ntohs ( reply->id ));
+	/* Ignore replies from anything other than our servers */
+	server = ( meta->src ? dns_server_index ( meta->src ) : -1 );
+	if ( server < 0 ) {
+		DBGC ( dns, "DNS %p received reply from unknown server\n",
+		       dns );
+		rc = -EINVAL;
+		goto done;
+	}
+
+	DBGC ( dns, "DNS %p received reply ID %d from server %d\n",
+	       dns, ntohs ( reply->id ), server );
+
+	/* Ignore failure responses unless all servers have failed,
+	 * since another server may yet provide a useful answer.
+	 */
+	rcode = DNS_FLAG_RCODE ( ntohs ( reply->flags ) );
+	if ( ( rcode != DNS_FLAG_RCODE_OK ) && ( rcode != DNS_FLAG_RCODE_NX ) ){
+		DBGC ( dns, "DNS %p server %d failed with RCODE %d\n",
+		       dns, server, rcode );
+		dns->failed |= ( 1 << server );
+		if ( dns->failed == ( ( 1U << num_nameservers ) - 1 ) )
+			dns_done ( dns, -ENXIO_SERVER_FAILURE );
+		rc = 0;
+		goto done;
+	}
 
 	/* Stop the retry timer.  After this point, each code path
 	 * must either restart the timer by calling dns_send_packet(),
@@ -368,6 +673,12 @@ static int dns_xfer_deliver ( struct dns_request *dns,
 	 */
 	stop_timer ( &dns->timer );
 
+	/* A name error is a definitive negative answer */
+	if ( rcode == DNS_FLAG_RCODE_NX ) {
+		DBGC ( dns, "DNS %p name does not exist\n", dns );
+		goto no_record;
+	}
+
 	/* Search through response for useful answers.  Do this
 	 * multiple times, to take advantage of useful nameservers
 	 * which send us e.g. the CNAME *and* the A record for the
@@ -385,6 +696,12 @@ static int dns_xfer_deliver ( struct dns_request *dns,
 			sin->sin_family = AF_INET;
 			sin->sin_addr = rr_info->a.in_addr;
 
+			/* Cache result, using the lowest TTL in the chain */
+			ttl = ntohl ( rr_info->common.ttl );
+			if ( ttl > dns->ttl )
+				ttl = dns->ttl;
+			dns_cache_add ( dns->fqdn, sin->sin_addr, 0, ttl );
+
 			/* Return resolved address */
 			resolv_done ( &dns->resolv, &dns->sa );
 
@@ -397,6 +714,9 @@ static int dns_xfer_deliver ( struct dns_request *dns,
 
 			/* Found a CNAME record; update query and recurse */
 			DBGC ( dns, "DNS %p found CNAME\n", dns );
+			ttl = ntohl ( rr_info->common.ttl );
+			if ( ttl < dns->ttl )
+				dns->ttl = ttl;
 			dns->qinfo = ( void * ) dns_decompress_name ( reply,
 							 rr_info->cname.cname,
 							 dns->query.payload );
@@ -446,9 +766,7 @@ static int dns_xfer_deliver ( struct dns_request *dns,
 			goto done;
 		} else {
 			DBGC ( dns, "DNS %p found no CNAME record\n", dns );
-			dns_done ( dns, -ENXIO_NO_RECORD );
-			rc = 0;
-			goto done;
+			goto no_record;
 		}
 
 	default:
@@ -458,6 +776,16 @@ static int dns_xfer_deliver ( struct dns_request *dns,
 		goto done;
 	}
 
+ no_record:
+	/* Cache negative result, as per RFC 2308 */
+	ttl = dns_negative_ttl ( reply, iob_len ( iobuf ) );
+	if ( ttl > dns->ttl )
+		ttl = dns->ttl;
+	sin = ( struct sockaddr_in * ) &dns->sa;
+	dns_cache_add ( dns->fqdn, sin->sin_addr, -ENXIO_NO_RECORD, ttl );
+	dns_done ( dns, -ENXIO_NO_RECORD );
+	rc = 0;
+
  done:
 	/* Free I/O buffer */
 	free_iob ( iobuf );
@@ -497,6 +825,22 @@ static struct interface_operation dns_resolv_op[] = {
 static struct interface_descriptor dns_resolv_desc =
 	INTF_DESC ( struct dns_request, resolv, dns_resolv_op );
 
+/**
+ * Complete DNS request from cache
+ *
+ * @v dns		DNS request
+ */
+static void dns_step ( struct dns_request *dns ) {
+
+	if ( dns->rc == 0 )
+		resolv_done ( &dns->resolv, &dns->sa );
+	dns_done ( dns, dns->rc );
+}
+
+/** DNS cached result process descriptor */
+static struct process_descriptor dns_process_desc =
+	PROC_DESC_ONCE ( struct dns_request, process, dns_step );
+
 /**
  * Resolve name using DNS
  *
@@ -508,11 +852,13 @@ static struct interface_descriptor dns_resolv_desc =
 static int dns_resolv ( struct interface *resolv,
 			const char *name, struct sockaddr *sa ) {
 	struct dns_request *dns;
+	struct dns_cache_entry *cache;
+	struct sockaddr_in *sin;
 	char *fqdn;
 	int rc;
 
 	/* Fail immediately if no DNS servers */
-	if ( ! nameserver.st_family ) {
+	if ( ! num_nameservers ) {
 		DBG ( "DNS not attempting to resolve \"%s\": "
 		      "no DNS servers\n", name );
 		rc = -ENXIO_NO_NAMESERVER;
@@ -527,7 +873,7 @@ static int dns_resolv ( struct interface *resolv,
 	}
 
 	/* Allocate DNS structure */
-	dns = zalloc ( sizeof ( *dns ) );
+	dns = zalloc ( sizeof ( *dns ) + strlen ( fqdn ) + 1 /* NUL */ );
 	if ( ! dns ) {
 		rc = -ENOMEM;
 		goto err_alloc_dns;
@@ -536,7 +882,24 @@ static int dns_resolv ( struct interface *resolv,
 	intf_init ( &dns->resolv, &dns_resolv_desc, &dns->refcnt );
 	intf_init ( &dns->socket, &dns_socket_desc, &dns->refcnt );
 	timer_init ( &dns->timer, dns_timer_expired, &dns->refcnt );
+	process_init_stopped ( &dns->process, &dns_process_desc,
+			       &dns->refcnt );
 	memcpy ( &dns->sa, sa, sizeof ( dns->sa ) );
+	strcpy ( dns->fqdn, fqdn );
+	dns->ttl = DNS_CACHE_MAX_TTL;
+
+	/* Use cached result, if available */
+	if ( ( cache = dns_cache_find ( fqdn ) ) != NULL ) {
+		DBGC ( dns, "DNS %p using cached %s for \"%s\"\n", dns,
+		       ( cache->rc ? "failure" : inet_ntoa ( cache->in_addr ) ),
+		       fqdn );
+		sin = ( struct sockaddr_in * ) &dns->sa;
+		sin->sin_family = AF_INET;
+		sin->sin_addr = cache->in_addr;
+		dns->rc = cache->rc;
+		process_add ( &dns->process );
+		goto done;
+	}
 
 	/* Create query */
 	dns->query.dns.flags = htons ( DNS_FLAG_QUERY | DNS_FLAG_OPCODE_QUERY |
@@ -548,7 +911,7 @@ static int dns_resolv ( struct interface *resolv,
 
 	/* Open UDP connection */
 	if ( ( rc = xfer_open_socket ( &dns->socket, SOCK_DGRAM,
-				       ( struct sockaddr * ) &nameserver,
+				       ( struct sockaddr * ) &nameservers[0],
 				       NULL ) ) != 0 ) {
 		DBGC ( dns, "DNS %p could not open socket: %s\n",
 		       dns, strerror ( rc ) );
@@ -558,6 +921,7 @@ static int dns_resolv ( struct interface *resolv,
 	/* Send first DNS packet */
 	dns_send_packet ( dns );
 
+ done:
 	/* Attach parent interface, mortalise self, and return */
 	intf_plug_plug ( &dns->resolv, resolv );
 	ref_put ( &dns->refcnt );
@@ -608,19 +972,32 @@ struct setting domain_setting __setting ( SETTING_IPv4_EXTRA ) = {
  * @ret rc		Return status code
  */
 static int apply_dns_settings ( void ) {
-	struct sockaddr_in *sin_nameserver =
-		( struct sockaddr_in * ) &nameserver;
+	struct in_addr addrs[DNS_MAX_NAMESERVERS];
+	struct sockaddr_in *sin_nameserver;
+	unsigned int i;
 	int len;
 
-	/* Fetch DNS server address */
-	nameserver.st_family = 0;
-	if ( ( len = fetch_ipv4_setting ( NULL, &dns_setting,
-					  &sin_nameserver->sin_addr ) ) >= 0 ){
-		nameserver.st_family = AF_INET;
+	/* Fetch DNS server addresses */
+	num_nameservers = 0;
+	memset ( nameservers, 0, sizeof ( nameservers ) );
+	if ( ( len = fetch_ipv4_array_setting ( NULL, &dns_setting, addrs,
+						DNS_MAX_NAMESERVERS ) ) > 0 ) {
+		num_nameservers = ( len / sizeof ( addrs[0] ) );
+		if ( num_nameservers > DNS_MAX_NAMESERVERS )
+			num_nameservers = DNS_MAX_NAMESERVERS;
+	}
+	for ( i = 0 ; i < num_nameservers ; i++ ) {
+		sin_nameserver = ( struct sockaddr_in * ) &nameservers[i];
+		sin_nameserver->sin_family = AF_INET;
+		sin_nameserver->sin_port = htons ( DNS_PORT );
+		sin_nameserver->sin_addr = addrs[i];
 		DBG ( "DNS using nameserver %s\n",
 		      inet_ntoa ( sin_nameserver->sin_addr ) );
 	}
 
+	/* Discard any results obtained via the previous configuration */
+	dns_cache_flush();
+
 	/* Get local domain DHCP option */
 	free ( localdomain );
 	if ( ( len = fetch_string_setting_copy ( NULL, &domain_setting,
@@ -55,6 +55,9 @@ FEATURE ( FEATURE_PROTOCOL, "TFTP", DHCP_EB_FEATURE_TFTP, 1 );
 #define EINVAL_TSIZE __einfo_error ( EINFO_EINVAL_TSIZE )
 #define EINFO_EINVAL_TSIZE __einfo_uniqify \
 	( EINFO_EINVAL, 0x02, "Invalid tsize" )
+#define EINVAL_WINDOWSIZE __einfo_error ( EINFO_EINVAL_WINDOWSIZE )
+#define EINFO_EINVAL_WINDOWSIZE __einfo_uniqify \
+	( EINFO_EINVAL, 0x08, "Invalid windowsize" )
 #define EINVAL_MC_NO_PORT __einfo_error ( EINFO_EINVAL_MC_NO_PORT )
 #define EINFO_EINVAL_MC_NO_PORT __einfo_uniqify \
 	( EINFO_EINVAL, 0x03, "Missing multicast port" )
@@ -103,6 +106,14 @@ struct tftp_request {
 	 * "tsize" option, this value will be zero.
 	 */
 	unsigned long tsize;
+	/** Window size
+	 *
+	 * This is the "windowsize" option (RFC 7440) negotiated with
+	 * the TFTP server: the number of data blocks sent by the
+	 * server for each ACK.  (If the TFTP server does not support
+	 * this option, this will default to 1).
+	 */
+	unsigned int windowsize;
 	
 	/** Server port
 	 *
@@ -122,6 +133,14 @@ struct tftp_request {
 
 	/** Block bitmap */
 	struct bitmap bitmap;
+	/** Block number most recently acknowledged */
+	unsigned int acked;
+	/** First missing block most recently reported via an ACK
+	 *
+	 * Used to avoid sending a stream of duplicate ACKs when
+	 * several blocks beyond a missing block are received.
+	 */
+	unsigned int gap_reported;
 	/** Maximum known length
 	 *
 	 * We don't always know the file length in advance.  In
@@ -142,7 +161,7 @@ struct tftp_request {
 enum {
 	/** Send ACK packets */
 	TFTP_FL_SEND_ACK = 0x0001,
-	/** Request blksize and tsize options */
+	/** Request blksize, tsize and windowsize options */
 	TFTP_FL_RRQ_SIZES = 0x0002,
 	/** Request multicast option */
 	TFTP_FL_RRQ_MULTICAST = 0x0004,
@@ -205,8 +224,11 @@ static int tftp_reopen ( struct tftp_request *tftp ) {
 	/* Disable ACK sending. */
 	tftp->flags &= ~TFTP_FL_SEND_ACK;
 
-	/* Reset peer address */
+	/* Reset peer address and window */
 	memset ( &tftp->peer, 0, sizeof ( tftp->peer ) );
+	tftp->windowsize = TFTP_DEFAULT_WINDOWSIZE;
+	tftp->acked = 0;
+	tftp->gap_reported = ~0U;
 
 	/* Open socket */
 	memset ( &server, 0, sizeof ( server ) );
@@ -364,6 +386,7 @@ static int tftp_send_rrq ( struct tftp_request *tftp ) {
 		+ 5 + 1 /* "octet" + NUL */
 		+ 7 + 1 + 5 + 1 /* "blksize" + NUL + ddddd + NUL */
 		+ 5 + 1 + 1 + 1 /* "tsize" + NUL + "0" + NUL */ 
+		+ 10 + 1 + 5 + 1 /* "windowsize" + NUL + ddddd + NUL */
 		+ 9 + 1 + 1 /* "multicast" + NUL + NUL */ );
 	iobuf = xfer_alloc_iob ( &tftp->socket, len );
 	if ( ! iobuf )
@@ -380,6 +403,13 @@ static int tftp_send_rrq ( struct tftp_request *tftp ) {
 					    "blksize%c%d%ctsize%c0", 0,
 					    tftp_request_blksize, 0, 0 ) + 1 );
 	}
+	if ( ( tftp->flags & TFTP_FL_RRQ_SIZES ) &&
+	     ! ( tftp->flags & TFTP_FL_RRQ_MULTICAST ) ) {
+		iob_put ( iobuf, snprintf ( iobuf->tail,
+					    iob_tailroom ( iobuf ),
+					    "windowsize%c%d", 0,
+					    TFTP_MAX_WINDOWSIZE ) + 1 );
+	}
 	if ( tftp->flags & TFTP_FL_RRQ_MULTICAST ) {
 		iob_put ( iobuf, snprintf ( iobuf->tail,
 					    iob_tailroom ( iobuf ),
@@ -409,6 +439,7 @@ static int tftp_send_ack ( struct tftp_request *tftp ) {
 	/* Determine next required block number */
 	block = bitmap_first_gap ( &tftp->bitmap );
 	DBGC2 ( tftp, "TFTP %p sending ACK for block %d\n", tftp, block );
+	tftp->acked = block;
 
 	/* Allocate buffer */
 	iobuf = xfer_alloc_iob ( &tftp->socket, sizeof ( *ack ) );
@@ -601,6 +632,29 @@ static int tftp_process_tsize ( struct tftp_request *tftp,
 	return 0;
 }
 
+/**
+ * Process TFTP "windowsize" option
+ *
+ * @v tftp		TFTP connection
+ * @v value		Option value
+ * @ret rc		Return status code
+ */
+static int tftp_process_windowsize ( struct tftp_request *tftp,
+				     const char *value ) {
+	char *end;
+
+	tftp->windowsize = strtoul ( value, &end, 10 );
+	if ( *end || ( tftp->windowsize == 0 ) ||
+	     ( tftp->windowsize > TFTP_MAX_WINDOWSIZE ) ) {
+		DBGC ( tftp, "TFTP %p got invalid windowsize \"%s\"\n",
+		       tftp, value );
+		return -EINVAL_WINDOWSIZE;
+	}
+	DBGC ( tftp, "TFTP %p windowsize=%d\n", tftp, tftp->windowsize );
+
+	return 0;
+}
+
 /**
  * Process TFTP "multicast" option
  *
@@ -688,6 +742,7 @@ struct tftp_option {
 static struct tftp_option tftp_options[] = {
 	{ "blksize", tftp_process_blksize },
 	{ "tsize", tftp_process_tsize },
+	{ "windowsize", tftp_process_windowsize },
 	{ "multicast", tftp_process_multicast },
 	{ NULL, NULL }
 };
@@ -812,7 +867,10 @@ static int tftp_rx_data ( struct tftp_request *tftp,
 			  struct io_buffer *iobuf ) {
 	struct tftp_data *data = iobuf->data;
 	struct xfer_metadata meta;
+	unsigned int gap;
 	unsigned int block;
+	int delta;
+	int duplicate;
 	off_t offset;
 	size_t data_len;
 	int rc;
@@ -832,14 +890,20 @@ static int tftp_rx_data ( struct tftp_request *tftp,
 		goto done;
 	}
 
-	/* Calculate block number */
-	block = ( ( bitmap_first_gap ( &tftp->bitmap ) + 1 ) & ~0xffff );
-	if ( data->block == 0 && block == 0 ) {
-		DBGC ( tftp, "TFTP %p received data block 0\n", tftp );
+	/* Calculate block number.  The 16-bit block number is
+	 * extended to the full block number nearest to the first
+	 * missing block, since the blocks within a window may straddle
+	 * a block number wraparound.
+	 */
+	gap = bitmap_first_gap ( &tftp->bitmap );
+	delta = ( ( int16_t ) ( ntohs ( data->block ) - 1 - gap ) );
+	if ( ( delta < 0 ) && ( ( unsigned int ) -delta > gap ) ) {
+		DBGC ( tftp, "TFTP %p received data block %d before start "
+		       "of file\n", tftp, ntohs ( data->block ) );
 		rc = -EINVAL;
 		goto done;
 	}
-	block += ( ntohs ( data->block ) - 1 );
+	block = ( gap + delta );
 
 	/* Extract data */
 	offset = ( block * tftp->blksize );
@@ -868,10 +932,29 @@ static int tftp_rx_data ( struct tftp_request *tftp,
 		goto done;
 
 	/* Mark block as received */
+	duplicate = bitmap_test ( &tftp->bitmap, block );
 	bitmap_set ( &tftp->bitmap, block );
-
-	/* Acknowledge block */
-	tftp_send_packet ( tftp );
+	gap = bitmap_first_gap ( &tftp->bitmap );
+
+	/* Acknowledge block, if applicable.  We acknowledge at the
+	 * end of each window, at the end of the file, on receiving a
+	 * duplicate of the most recent block (in case our last ACK was
+	 * lost), and on first detecting a missing block (which causes
+	 * the server to restart the window from the missing block).
+	 * With a window size of 1, this acknowledges every block.
+	 */
+	if ( ( ( gap - tftp->acked ) >= tftp->windowsize ) ||
+	     bitmap_full ( &tftp->bitmap ) ||
+	     ( duplicate && ( block == ( gap - 1 ) ) ) ||
+	     ( ( block > gap ) && ( tftp->gap_reported != gap ) ) ) {
+		if ( block > gap )
+			tftp->gap_reported = gap;
+		tftp_send_packet ( tftp );
+	} else {
+		/* Restart retransmission timer */
+		stop_timer ( &tftp->timer );
+		start_timer ( &tftp->timer );
+	}
 
 	/* If all blocks have been received, finish. */
 	if ( bitmap_full ( &tftp->bitmap ) )
@@ -0,0 +1,70 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <ipxe/timer.h>
+#include <ipxe/crc32.h>
+#include <ipxe/crc32c.h>
+
+/*
+ * This file exists for testing the correctness and throughput of
+ * crc32_le(), crc32c_le() and generic_crc32c_le().
+ *
+ */
+
+/** CRC32 check value for the standard "123456789" test vector */
+#define CRC32_CHECK 0xcbf43926
+
+/** CRC32C check value for the standard "123456789" test vector */
+#define CRC32C_CHECK 0xe3069283
+
+/** Size of benchmark buffer */
+#define CRC32_BENCH_LEN 65536
+
+/** Number of passes over benchmark buffer */
+#define CRC32_BENCH_PASSES 256
+
+static uint8_t crc32_bench_data[CRC32_BENCH_LEN];
+
+static void crc32_bench ( const char *name, uint32_t expected,
+			  uint32_t ( * crc32 ) ( uint32_t seed,
+						 const void *data,
+						 size_t len ) ) {
+	static const char check[] = "123456789";
+	unsigned long start;
+	unsigned long elapsed;
+	unsigned int i;
+	uint32_t crc;
+
+	/* Verify against test vector, at each possible alignment */
+	for ( i = 0 ; i < 8 ; i++ ) {
+		memcpy ( ( crc32_bench_data + i ), check,
+			 ( sizeof ( check ) - 1 ) );
+		crc = ~crc32 ( ~0, ( crc32_bench_data + i ),
+			       ( sizeof ( check ) - 1 ) );
+		printf ( "%s check at alignment %d: %08x (%s)\n", name, i,
+			 crc, ( ( crc == expected ) ? "ok" : "FAILED" ) );
+	}
+
+	/* Measure throughput */
+	for ( i = 0 ; i < CRC32_BENCH_LEN ; i++ )
+		crc32_bench_data[i] = i;
+	crc = ~0;
+	start = currticks();
+	for ( i = 0 ; i < CRC32_BENCH_PASSES ; i++ )
+		crc = crc32 ( crc, crc32_bench_data, CRC32_BENCH_LEN );
+	elapsed = ( currticks() - start );
+	printf ( "%s processed %d kB in %ld ticks (%ld ticks/s): %08x\n",
+		 name, ( ( CRC32_BENCH_LEN / 1024 ) * CRC32_BENCH_PASSES ),
+		 elapsed, TICKS_PER_SEC, ~crc );
+}
+
+static uint32_t crc32c_test_le ( uint32_t seed, const void *data,
+				 size_t len ) {
+	return crc32c_le ( seed, data, len );
+}
+
+void crc32_test ( void ) {
+	crc32_bench ( "CRC32", CRC32_CHECK, crc32_le );
+	crc32_bench ( "CRC32C (generic)", CRC32C_CHECK, generic_crc32c_le );
+	crc32_bench ( "CRC32C", CRC32C_CHECK, crc32c_test_le );
+}
@@ -21,12 +21,21 @@ FILE_LICENCE ( GPL2_OR_LATER );
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
 #include <ipxe/image.h>
 #include <ipxe/downloader.h>
 #include <ipxe/monojob.h>
 #include <ipxe/open.h>
 #include <ipxe/uri.h>
+#include <ipxe/list.h>
+#include <ipxe/refcnt.h>
+#include <ipxe/interface.h>
+#include <ipxe/job.h>
+#include <ipxe/process.h>
+#include <ipxe/console.h>
+#include <ipxe/keys.h>
+#include <ipxe/timer.h>
 #include <usr/imgmgmt.h>
 
 /** @file
@@ -102,6 +111,12 @@ int register_and_select_image ( struct image *image ) {
 int register_and_boot_image ( struct image *image ) {
 	int rc;
 
+	/* Complete any background downloads before booting */
+	if ( ( rc = imgwait() ) != 0 ) {
+		image_put ( image );
+		return rc;
+	}
+
 	if ( ( rc = register_and_select_image ( image ) ) != 0 )
 		return rc;
 
@@ -132,26 +147,21 @@ int register_and_replace_image ( struct image *image ) {
 }
 
 /**
- * Download an image
+ * Allocate an image to be downloaded
  *
  * @v uri		URI
  * @v name		Image name, or NULL to use default
  * @v cmdline		Command line, or NULL for no command line
- * @v action		Action to take upon a successful download
- * @ret rc		Return status code
+ * @ret image		Image, or NULL on failure
  */
-int imgdownload ( struct uri *uri, const char *name, const char *cmdline,
-		  int ( * action ) ( struct image *image ) ) {
+static struct image * imgdownload_alloc ( struct uri *uri, const char *name,
+					  const char *cmdline ) {
 	struct image *image;
-	size_t len = ( unparse_uri ( NULL, 0, uri, URI_ALL ) + 1 );
-	char uri_string_redacted[len];
-	const char *password;
-	int rc;
 
 	/* Allocate image */
 	image = alloc_image();
 	if ( ! image )
-		return -ENOMEM;
+		return NULL;
 
 	/* Set image name */
 	if ( name )
@@ -163,13 +173,51 @@ int imgdownload ( struct uri *uri, const char *name, const char *cmdline,
 	/* Set image command line */
 	image_set_cmdline ( image, cmdline );
 
+	return image;
+}
+
+/**
+ * Describe URI with password redacted
+ *
+ * @v uri		URI
+ * @v buf		Buffer to fill in
+ * @v len		Length of buffer
+ */
+static void imgdownload_redact ( struct uri *uri, char *buf, size_t len ) {
+	const char *password;
+
 	/* Redact password portion of URI, if necessary */
 	password = uri->password;
 	if ( password )
 		uri->password = "***";
-	unparse_uri ( uri_string_redacted, sizeof ( uri_string_redacted ),
-		      uri, URI_ALL );
+	unparse_uri ( buf, len, uri, URI_ALL );
 	uri->password = password;
+}
+
+/**
+ * Download an image
+ *
+ * @v uri		URI
+ * @v name		Image name, or NULL to use default
+ * @v cmdline		Command line, or NULL for no command line
+ * @v action		Action to take upon a successful download
+ * @ret rc		Return status code
+ */
+int imgdownload ( struct uri *uri, const char *name, const char *cmdline,
+		  int ( * action ) ( struct image *image ) ) {
+	struct image *image;
+	size_t len = ( unparse_uri ( NULL, 0, uri, URI_ALL ) + 1 );
+	char uri_string_redacted[len];
+	int rc;
+
+	/* Allocate image */
+	image = imgdownload_alloc ( uri, name, cmdline );
+	if ( ! image )
+		return -ENOMEM;
+
+	/* Describe download */
+	imgdownload_redact ( uri, uri_string_redacted,
+			     sizeof ( uri_string_redacted ) );
 
 	/* Create downloader */
 	if ( ( rc = create_downloader ( &monojob, image, LOCATION_URI,
@@ -217,6 +265,254 @@ int imgdownload_string ( const char *uri_string, const char *name,
 	return rc;
 }
 
+/** A background image download */
+struct imgdownload_job {
+	/** Reference count */
+	struct refcnt refcnt;
+	/** List of background downloads, in order of issue */
+	struct list_head list;
+	/** Job control interface */
+	struct interface job;
+	/** Image being downloaded */
+	struct image *image;
+	/** Action to take upon a successful download */
+	int ( * action ) ( struct image *image );
+	/** Final status code, or -EINPROGRESS */
+	int rc;
+	/** Amount of data downloaded (normalised), as last reported */
+	unsigned long completed;
+	/** Total amount of data (normalised), as last reported */
+	unsigned long total;
+	/** Description of download (with any password redacted) */
+	char description[0];
+};
+
+/** List of background image downloads */
+static LIST_HEAD ( imgdownload_jobs );
+
+/**
+ * Free background image download
+ *
+ * @v refcnt		Reference count
+ */
+static void imgdownload_job_free ( struct refcnt *refcnt ) {
+	struct imgdownload_job *bg =
+		container_of ( refcnt, struct imgdownload_job, refcnt );
+
+	image_put ( bg->image );
+	free ( bg );
+}
+
+/**
+ * Handle completion of background image download
+ *
+ * @v bg		Background image download
+ * @v rc		Reason for completion
+ */
+static void imgdownload_job_close ( struct imgdownload_job *bg, int rc ) {
+
+	/* A successful download is entirely complete */
+	if ( rc == 0 )
+		bg->completed = bg->total = ( bg->image->len / 128 );
+
+	bg->rc = rc;
+	intf_restart ( &bg->job, rc );
+}
+
+/** Background image download job control interface operations */
+static struct interface_operation imgdownload_job_op[] = {
+	INTF_OP ( intf_close, struct imgdownload_job *,
+		  imgdownload_job_close ),
+};
+
+/** Background image download job control interface descriptor */
+static struct interface_descriptor imgdownload_job_desc =
+	INTF_DESC ( struct imgdownload_job, job, imgdownload_job_op );
+
+/**
+ * Start downloading an image in the background
+ *
+ * @v uri		URI
+ * @v name		Image name, or NULL to use default
+ * @v cmdline		Command line, or NULL for no command line
+ * @v action		Action to take upon a successful download
+ * @ret rc		Return status code
+ *
+ * The action is deferred until imgwait() is called, so that images
+ * are registered in the order in which the downloads were issued
+ * regardless of the order in which they complete.
+ */
+int imgdownload_background ( struct uri *uri, const char *name,
+			     const char *cmdline,
+			     int ( * action ) ( struct image *image ) ) {
+	struct imgdownload_job *bg;
+	size_t len = ( unparse_uri ( NULL, 0, uri, URI_ALL ) + 1 );
+	int rc;
+
+	/* Allocate and initialise structure */
+	bg = zalloc ( sizeof ( *bg ) + len );
+	if ( ! bg ) {
+		rc = -ENOMEM;
+		goto err_alloc;
+	}
+	ref_init ( &bg->refcnt, imgdownload_job_free );
+	intf_init ( &bg->job, &imgdownload_job_desc, &bg->refcnt );
+	bg->action = action;
+	bg->rc = -EINPROGRESS;
+	imgdownload_redact ( uri, bg->description, len );
+
+	/* Allocate image */
+	bg->image = imgdownload_alloc ( uri, name, cmdline );
+	if ( ! bg->image ) {
+		rc = -ENOMEM;
+		goto err_alloc_image;
+	}
+
+	/* Create downloader */
+	if ( ( rc = create_downloader ( &bg->job, bg->image, LOCATION_URI,
+					uri ) ) != 0 )
+		goto err_create_downloader;
+
+	/* Add to list of background downloads, transferring our
+	 * reference to the list.
+	 */
+	list_add_tail ( &bg->list, &imgdownload_jobs );
+	return 0;
+
+ err_create_downloader:
+ err_alloc_image:
+	ref_put ( &bg->refcnt );
+ err_alloc:
+	return rc;
+}
+
+/**
+ * Start downloading an image in the background
+ *
+ * @v uri_string	URI as a string (e.g. "http://www.nowhere.com/vmlinuz")
+ * @v name		Image name, or NULL to use default
+ * @v cmdline		Command line, or NULL for no command line
+ * @v action		Action to take upon a successful download
+ * @ret rc		Return status code
+ */
+int imgdownload_background_string ( const char *uri_string, const char *name,
+				    const char *cmdline,
+				    int ( * action ) ( struct image *image ) ) {
+	struct uri *uri;
+	int rc;
+
+	if ( ! ( uri = parse_uri ( uri_string ) ) )
+		return -ENOMEM;
+
+	rc = imgdownload_background ( uri, name, cmdline, action );
+
+	uri_put ( uri );
+	return rc;
+}
+
+/**
+ * Wait for all background image downloads to complete
+ *
+ * @ret rc		Return status code
+ *
+ * Each successfully downloaded image is acted upon in the order in
+ * which the downloads were issued.  The status code is that of the
+ * first download to fail, if any.
+ */
+int imgwait ( void ) {
+	struct imgdownload_job *bg;
+	struct job_progress progress;
+	unsigned long last_progress;
+	unsigned long completed;
+	unsigned long total;
+	unsigned int pending;
+	int shown_progress = 0;
+	int rc = 0;
+
+	/* Do nothing if there are no background downloads */
+	if ( list_empty ( &imgdownload_jobs ) )
+		return 0;
+
+	/* Wait for all downloads to complete */
+	printf ( "Waiting for background downloads..." );
+	last_progress = currticks();
+	while ( 1 ) {
+
+		/* Count incomplete downloads and total progress.
+		 * Finished downloads retain their last progress
+		 * figures, so that the aggregate does not go
+		 * backwards as downloads complete.
+		 */
+		pending = 0;
+		completed = total = 0;
+		list_for_each_entry ( bg, &imgdownload_jobs, list ) {
+			if ( bg->rc == -EINPROGRESS ) {
+				pending++;
+				job_progress ( &bg->job, &progress );
+				/* Normalise progress figures to avoid
+				 * overflow.
+				 */
+				bg->completed = ( progress.completed / 128 );
+				bg->total = ( progress.total / 128 );
+			}
+			completed += bg->completed;
+			total += bg->total;
+		}
+		if ( ! pending )
+			break;
+
+		/* Allow downloads to be cancelled */
+		if ( iskey() && ( getchar() == CTRL_C ) ) {
+			list_for_each_entry ( bg, &imgdownload_jobs, list ) {
+				if ( bg->rc == -EINPROGRESS ) {
+					imgdownload_job_close ( bg,
+								-ECANCELED );
+				}
+			}
+		}
+
+		/* Display aggregate progress */
+		if ( ( currticks() - last_progress ) >= TICKS_PER_SEC ) {
+			if ( shown_progress )
+				printf ( "\b\b\b\b    \b\b\b\b" );
+			if ( total ) {
+				printf ( "%3ld%%", ( ( 100 * completed ) / total ));
+				shown_progress = 1;
+			} else {
+				printf ( "." );
+				shown_progress = 0;
+			}
+			last_progress = currticks();
+		}
+
+		step();
+	}
+	if ( shown_progress )
+		printf ( "\b\b\b\b    \b\b\b\b" );
+	printf ( "\n" );
+
+	/* Act upon each download in order of issue.  Each download is
+	 * removed from the list before acting upon it, since the
+	 * action may itself wait for background downloads.
+	 */
+	while ( ! list_empty ( &imgdownload_jobs ) ) {
+		bg = list_entry ( imgdownload_jobs.next,
+				  struct imgdownload_job, list );
+		list_del ( &bg->list );
+		printf ( "%s... ", bg->description );
+		if ( bg->rc == 0 ) {
+			/* This action assumes ownership of the image */
+			bg->rc = bg->action ( image_get ( bg->image ) );
+		}
+		printf ( "%s\n", ( bg->rc ? strerror ( bg->rc ) : "ok" ) );
+		if ( bg->rc && ( rc == 0 ) )
+			rc = bg->rc;
+		ref_put ( &bg->refcnt );
+	}
+
+	return rc;
+}
+
 /**
  * Display status of an image
  *
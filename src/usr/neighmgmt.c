@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+FILE_LICENCE ( GPL2_OR_LATER );
+
+#include <stdio.h>
+#include <ipxe/netdevice.h>
+#include <ipxe/timer.h>
+#include <ipxe/neighbour.h>
+#include <usr/neighmgmt.h>
+
+/** @file
+ *
+ * Neighbour cache management
+ *
+ */
+
+/**
+ * Print neighbour cache entries and statistics
+ *
+ */
+void neighbour_stat ( void ) {
+	struct neighbour *neighbour;
+	struct net_device *netdev;
+	struct net_protocol *net_protocol;
+	struct ll_protocol *ll_protocol;
+	unsigned int count = 0;
+
+	list_for_each_entry ( neighbour, &neighbours, list ) {
+		netdev = neighbour->netdev;
+		net_protocol = neighbour->net_protocol;
+		ll_protocol = netdev->ll_protocol;
+		printf ( "%s: %s %s", netdev->name, net_protocol->name,
+			 net_protocol->ntoa ( neighbour->net_addr ) );
+		if ( neighbour->state == NEIGHBOUR_INCOMPLETE ) {
+			printf ( " (incomplete, %d queued)\n",
+				 neighbour->tx_count );
+		} else {
+			printf ( " => %s (%s, %lds)\n",
+				 ll_protocol->ntoa ( neighbour->ll_addr ),
+				 neighbour_state_name ( neighbour ),
+				 ( ( currticks() - neighbour->confirmed ) /
+				   TICKS_PER_SEC ) );
+		}
+		count++;
+	}
+	printf ( "%d entries: %d hits, %d misses, %d evictions, "
+		 "%d failures, %d drops\n", count, neighbour_stats.hits,
+		 neighbour_stats.misses, neighbour_stats.evictions,
+		 neighbour_stats.failures, neighbour_stats.drops );
+}
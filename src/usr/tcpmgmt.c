@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+FILE_LICENCE ( GPL2_OR_LATER );
+
+#include <stdio.h>
+#include <ipxe/tcp.h>
+#include <usr/tcpmgmt.h>
+
+/** @file
+ *
+ * TCP management
+ *
+ */
+
+/**
+ * Print TCP statistics
+ *
+ */
+void tcp_stat ( void ) {
+
+	printf ( "TCP: %d retransmits (%d fast, %d timeouts), "
+		 "%d duplicate ACKs\n", tcp_stats.retransmits,
+		 tcp_stats.fast_retransmits, tcp_stats.timeouts,
+		 tcp_stats.dupacks );
+}